@@ -0,0 +1,94 @@
+//  boost/btree/blob.hpp  --------------------------------------------------------------//
+
+//  Copyright Boost.Btree contributors 2026
+
+//  Distributed under the Boost Software License, Version 1.0.
+//  http://www.boost.org/LICENSE_1_0.txt
+
+//  See http://www.boost.org/libs/btree for documentation.
+
+#ifndef BOOST_BTREE_BLOB_HPP
+#define BOOST_BTREE_BLOB_HPP
+
+#include <boost/btree/dynamic_size.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/assert.hpp>
+#include <cstring>
+
+/*
+
+  blob is a mapped_type for values of widely varying size. A blob holds either the
+  value's bytes, stored inline on the leaf, or a reference to a chain of overflow nodes
+  in the btree's file that hold them. Inline blobs are constructed directly; a btree
+  constructs blobs with make_blob(), which stores values larger than its
+  overflow_threshold() in overflow nodes, and read_blob() retrieves the bytes of either
+  kind. Since a leaf holds only 8 bytes for an overflow blob, leaves stay dense, and
+  iteration, searches, and key-only scans never read the overflow nodes.
+
+  The btree frees a blob's overflow nodes when the element is erased or its mapped value
+  is replaced by update(), and compact() carries them over.
+
+*/
+
+namespace boost
+{
+namespace btree
+{
+
+  class blob
+  {
+  public:
+    static const std::size_t max_inline_size = 1016;
+
+    blob() : m_size(0), m_node_id(0) {}
+
+    blob(const void* p, std::size_t sz)
+    {
+      BOOST_ASSERT_MSG(sz <= max_inline_size, "blob: size exceeds max_inline_size");
+      m_size = static_cast<boost::uint32_t>(sz);
+      m_node_id = 0;
+      std::memcpy(m_data, p, sz);
+    }
+
+    //  only the dynamic size is copied, since a blob on a leaf has no bytes beyond it
+    blob(const blob& b)                { std::memcpy(this, &b, b.dynamic_size()); }
+    blob& operator=(const blob& b)
+    {
+      std::memmove(this, &b, b.dynamic_size());
+      return *this;
+    }
+
+    std::size_t      size() const          { return m_size; }  // bytes in the value
+    bool             is_overflow() const   { return m_node_id != 0; }
+    boost::uint32_t  overflow_id() const   { return m_node_id; }  // first overflow node
+    const char*      data() const
+    {
+      BOOST_ASSERT_MSG(!is_overflow(), "blob: data() of overflow blob; use read_blob()");
+      return m_data;
+    }
+
+    std::size_t      dynamic_size() const
+      { return sizeof(m_size) + sizeof(m_node_id) + (m_node_id ? 0 : m_size); }
+
+    static blob      overflow(boost::uint32_t node_id, std::size_t sz)
+    {
+      BOOST_ASSERT(node_id);
+      blob b;
+      b.m_size = static_cast<boost::uint32_t>(sz);
+      b.m_node_id = node_id;
+      return b;
+    }
+
+  private:
+    boost::uint32_t  m_size;
+    boost::uint32_t  m_node_id;   // 0 if the bytes are in m_data
+    char             m_data[max_inline_size];
+  };
+
+  inline std::size_t dynamic_size(const blob& b)  {return b.dynamic_size();}
+  template<> struct has_dynamic_size<blob> : public true_type{};
+
+}  // namespace btree
+}  // namespace boost
+
+#endif  // BOOST_BTREE_BLOB_HPP
@@ -49,7 +49,12 @@ namespace boost
         random      =1<<6,    // hint: optimize for random access
         sequential  =1<<7,    // hint: optimize for sequential access
 
-        preload     =1<<8     // hint: read entire file on open to preload O/S disk cache
+        preload     =1<<8,    // hint: read entire file on open to preload O/S disk cache
+        mapped      =1<<9,    // read-only memory mapped access; see buffer_manager
+        async_io    =1<<10,   // use an asynchronous I/O engine, if available, for
+                              // batched transfers; see BOOST_BTREE_IO_URING
+        concurrent  =1<<11    // read-only; several threads may read at once; only
+                              // meaningful to buffer_manager
       };
 
       BOOST_BITMASK(bitmask);
@@ -65,6 +70,19 @@ namespace boost
       };
     }
 
+    //  write_segment  -----------------------------------------------------------------//
+
+    struct write_segment  // one source for a gather write; see binary_file::gather_write_at
+    {
+      const void*  source;
+      std::size_t  size;
+    };
+
+    namespace detail
+    {
+      class io_engine;  // defined in binary_file.cpp
+    }
+
     //  class binary_file  -------------------------------------------------------------//
     
     class BOOST_BTREE_DECL binary_file // noncopyable
@@ -86,13 +104,16 @@ namespace boost
 
  
       binary_file()
-        : m_handle(invalid_handle) {}
+        : m_handle(invalid_handle), m_map(0), m_map_size(0), m_map_handle(0),
+          m_io_engine(0) {}
 
       explicit binary_file(const filesystem::path& p, oflag::bitmask flags=oflag::in)
-        : m_handle(invalid_handle) { open(p, flags); }
+        : m_handle(invalid_handle), m_map(0), m_map_size(0), m_map_handle(0),
+          m_io_engine(0) { open(p, flags); }
 
       binary_file(const filesystem::path& p, oflag::bitmask flags, system::error_code& ec)
-        : m_handle(invalid_handle) { open(p, flags, ec); }
+        : m_handle(invalid_handle), m_map(0), m_map_size(0), m_map_handle(0),
+          m_io_engine(0) { open(p, flags, ec); }
 
      ~binary_file();
 
@@ -104,8 +125,8 @@ namespace boost
 
       void close();
       bool close(system::error_code& ec);
-      // Effects: If the file is not open, none, othewise as if calls POSIX
-      // close(). Sets ec to 0 if no error, otherwise to the system error code.
+      // Effects: If the file is not open, none, othewise unmap(), then as if calls
+      // POSIX close(). Sets ec to 0 if no error, otherwise to the system error code.
       // Returns: true if successful.
 
       bool is_open() const
@@ -220,6 +241,124 @@ namespace boost
         m_write(source, sz);
       }
 
+      // -------------------------------------------------------------------------------//
+
+      // Positional I/O: read_at/write_at transfer data at an explicit file offset in a
+      // single system call per transfer, and do not use the current file offset, so
+      // no seek is needed.
+
+      template<typename T>
+      bool read_at(offset_type offset, T& target, std::size_t sz, system::error_code& ec)
+      // Requires: is_open()
+      // Effects: As if calls POSIX pread(), except will finish partial reads.
+      // ec.clear() if no error, otherwise set ec to the system error code.
+      // Returns: true, except false if end-of-file or error.
+      // Remarks: On POSIX, the current file offset is not changed. On Windows, it is
+      // unspecified.
+      {
+        BOOST_ASSERT(is_open());
+        return m_read_at(offset, &target, sz, ec);
+      }
+
+      template<typename T>
+      bool read_at(offset_type offset, T& target, std::size_t sz = sizeof(T))
+      // Requires: is_open()
+      // Effects: As if calls POSIX pread(), except will finish partial reads.
+      // Throws: On error.
+      // Returns: true, except false if end-of-file.
+      // Remarks: See above.
+      {
+        BOOST_ASSERT(is_open());
+        return m_read_at(offset, &target, sz);
+      }
+
+      void write_at(offset_type offset, const void* source, std::size_t sz,
+        system::error_code& ec)
+      // Requires: is_open()
+      // Effects: As if calls POSIX pwrite(), except will finish partial writes.
+      // Sets ec to 0 if no error, otherwise to the system error code.
+      // Remarks: See above.
+      {
+        BOOST_ASSERT(is_open());
+        m_write_at(offset, source, sz, ec);
+      }
+
+      void write_at(offset_type offset, const void* source, std::size_t sz)
+      // Requires: is_open()
+      // Effects: As if calls POSIX pwrite(), except will finish partial writes.
+      // Throws: On error.
+      // Remarks: See above.
+      {
+        BOOST_ASSERT(is_open());
+        m_write_at(offset, source, sz);
+      }
+
+      void gather_write_at(offset_type offset, const write_segment* segments,
+        std::size_t count, system::error_code& ec);
+      // Requires: is_open()
+      // Effects: Writes the count segments, in order, to contiguous file positions
+      // starting at offset, as if calls POSIX pwritev(), except will finish partial
+      // writes. Sets ec to 0 if no error, otherwise to the system error code.
+      // Remarks: See above. On Windows, as if calls write_at() for each segment.
+
+      void gather_write_at(offset_type offset, const write_segment* segments,
+        std::size_t count);
+      // Requires: is_open()
+      // Effects: As above.
+      // Throws: On error.
+
+      // -------------------------------------------------------------------------------//
+
+      // Batched I/O: each request is a positional transfer as for read_at/write_at. If
+      // async_io(), all of the requests are submitted to the kernel together and may
+      // complete in any order, so a storage device sees a deep queue rather than one
+      // request at a time. Otherwise, the requests are performed one at a time.
+
+      struct io_request
+      {
+        offset_type  offset;
+        char*        data;    // target for reads, source for writes
+        std::size_t  size;
+      };
+
+      bool read_batch_at(const io_request* requests, std::size_t count,
+        system::error_code& ec);
+      // Requires: is_open()
+      // Effects: As if read_at(requests[i].offset, *requests[i].data, requests[i].size,
+      // ec) for each i. Sets ec to 0 if no error, otherwise to the system error code.
+      // Returns: true, except false if any request hits end-of-file or on error.
+
+      bool read_batch_at(const io_request* requests, std::size_t count);
+      // Requires: is_open()
+      // Effects: As above.
+      // Returns: true, except false if any request hits end-of-file.
+      // Throws: On error.
+
+      void write_batch_at(const io_request* requests, std::size_t count,
+        system::error_code& ec);
+      // Requires: is_open()
+      // Effects: As if write_at(requests[i].offset, requests[i].data, requests[i].size,
+      // ec) for each i. Sets ec to 0 if no error, otherwise to the system error code.
+
+      void write_batch_at(const io_request* requests, std::size_t count);
+      // Requires: is_open()
+      // Effects: As above.
+      // Throws: On error.
+
+      bool async_io() const  { return m_io_engine != 0; }
+      // Returns: true if opened with oflag::async_io and an asynchronous I/O engine is
+      // available
+
+      void will_need(offset_type offset, std::size_t sz);
+      // Requires: is_open()
+      // Effects: Hints that the sz bytes at offset will be read soon, so that the
+      // operating system may read them in the background, as if by POSIX
+      // posix_fadvise() with POSIX_FADV_WILLNEED. Does nothing if the operating system
+      // has no such hint.
+      // Remarks: Never throws; being a hint, errors are ignored.
+
+      // -------------------------------------------------------------------------------//
+
       offset_type seek(offset_type offset, seekdir::pos from,
         system::error_code& ec);
       // Effects: As if POSIX lseek(), except with offset argument of a type
@@ -235,6 +374,32 @@ namespace boost
       // for maximum file size possible for operating system.
       // Throws: On error.
 
+      // -------------------------------------------------------------------------------//
+
+      const char* map(system::error_code& ec);
+      // Requires: is_open() && !mapped()
+      // Effects: As if calls POSIX mmap() to map the entire file read-only. Sets ec
+      // to 0 if no error, otherwise to the system error code.
+      // Returns: mapping(), or 0 if error.
+      // Remarks: The mapping reflects the file size at the time of the call.
+      // Writing through the mapping is undefined behavior.
+
+      const char* map();
+      // Requires: is_open() && !mapped()
+      // Effects: As if calls POSIX mmap() to map the entire file read-only.
+      // Returns: mapping().
+      // Throws: On error, or if the file is empty.
+
+      bool unmap(system::error_code& ec);
+      void unmap();
+      // Effects: If mapped(), as if calls POSIX munmap(). Sets ec to 0 if no error,
+      // otherwise to the system error code.
+      // Postconditions: !mapped()
+
+      bool        mapped() const        { return m_map != 0; }
+      const char* mapping() const       { return m_map; }
+      offset_type mapping_size() const  { return m_map_size; }
+
       // dup, dup2 ?
       // lockf ?
       // static sync?
@@ -242,11 +407,24 @@ namespace boost
     private:
       handle_type              m_handle; // -1 indicates not open
       boost::filesystem::path  m_path;
+      char*                    m_map;         // 0 if not mapped
+      offset_type              m_map_size;
+      void*                    m_map_handle;  // Windows file mapping object; else unused
+      detail::io_engine*       m_io_engine;   // 0 unless async_io()
+
+      bool m_run_batch(bool is_read, const io_request* requests, std::size_t count,
+        system::error_code& ec);
 
       bool m_read(void* target, std::size_t sz, system::error_code& ec);
       bool m_read(void* target, std::size_t sz);
       void m_write(const void* source, std::size_t sz, system::error_code& ec);
       void m_write(const void* source, std::size_t sz);
+      bool m_read_at(offset_type offset, void* target, std::size_t sz,
+        system::error_code& ec);
+      bool m_read_at(offset_type offset, void* target, std::size_t sz);
+      void m_write_at(offset_type offset, const void* source, std::size_t sz,
+        system::error_code& ec);
+      void m_write_at(offset_type offset, const void* source, std::size_t sz);
 
     }; // binary_file
 
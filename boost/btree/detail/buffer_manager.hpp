@@ -14,12 +14,16 @@
 
 #include <boost/btree/detail/binary_file.hpp>
 #include <boost/filesystem/operations.hpp>
-#include <boost/intrusive/set.hpp>
 #include <boost/intrusive/list.hpp>
+#include <boost/iterator/iterator_facade.hpp>
 #include <boost/scoped_array.hpp>
+#include <boost/smart_ptr/detail/lightweight_mutex.hpp>
+#include <boost/atomic.hpp>
 #include <boost/cstdint.hpp>
 #include <boost/assert.hpp>
 #include <iosfwd>
+#include <string>
+#include <vector>
 #include <cstddef>  // for size_t
 #include <cstring>  // for memset
 
@@ -30,7 +34,7 @@
 #include <boost/config/abi_prefix.hpp>  // must be the last #include
 
 #ifdef BOOST_MSVC
-// for intrusive_list and intrusive_set, disable C4251, ...needs to have
+// for intrusive_list, disable C4251, ...needs to have
 // dll-interface to be used by clients of class ...
 #  pragma warning(push)
 #  pragma warning(disable: 4251) 
@@ -107,6 +111,118 @@ namespace boost
       buffer* m_ptr;
     };
 
+    BOOST_BTREE_DECL void latch_wait(unsigned k);
+    //  Effects: Backs off before the k'th retry of a spin wait: returns at once for
+    //    small k, then yields the processor, then sleeps briefly.
+
+    BOOST_BTREE_DECL void optimistic_copy(void* to, const void* from, std::size_t n);
+    //  Effects: Copies n bytes, as by memcpy(), with relaxed atomic loads.
+    //  Remarks: For optimistic reads; see rw_latch. The source may be changing, so the
+    //    copy may be torn, and must not be acted on until the read is validated.
+
+//--------------------------------------------------------------------------------------//
+//                                                                                      //
+//           rw_latch - a brief reader/writer lock for in-memory structures             //
+//                                                                                      //
+//  Any number of threads may hold a rw_latch shared, or one thread may hold it         //
+//  exclusive. A thread waiting for exclusive ownership keeps new shared owners out,   //
+//  so writers are not starved. Waiters spin and then yield, so latches are only for   //
+//  short critical sections. Not recursive.                                             //
+//                                                                                      //
+//  A rw_latch also counts its exclusive ownerships, so a reader may instead read the   //
+//  guarded structure optimistically, without writing to the latch: take                //
+//  version_begin(), read, and accept what was read only if version_valid() then       //
+//  returns true. Optimistic reads may see a structure while it is being changed, so   //
+//  must stay within memory that remains valid, and must not act on what they read     //
+//  before it is validated.                                                             //
+//                                                                                      //
+//--------------------------------------------------------------------------------------//
+
+    class rw_latch
+    {
+      rw_latch(const rw_latch&);
+      rw_latch& operator=(const rw_latch&);
+
+    public:
+      rw_latch() : m_state(0), m_version(0) {}
+
+      void lock_shared()
+      {
+        for (unsigned k = 0;; latch_wait(++k))
+        {
+          boost::int32_t x = m_state.load(boost::memory_order_relaxed);
+          if (!(x & writer) && m_state.compare_exchange_weak(x, x + 1,
+            boost::memory_order_acquire, boost::memory_order_relaxed))
+            return;
+        }
+      }
+      void unlock_shared()  { m_state.fetch_sub(1, boost::memory_order_release); }
+
+      void lock()
+      {
+        for (unsigned k = 0;; latch_wait(++k))  // claim the writer bit
+        {
+          boost::int32_t x = m_state.load(boost::memory_order_relaxed);
+          if (!(x & writer) && m_state.compare_exchange_weak(x, x | writer,
+            boost::memory_order_acquire, boost::memory_order_relaxed))
+            break;
+        }
+        boost::atomic_thread_fence(boost::memory_order_release);  // for version_valid()
+        for (unsigned k = 0;                               // let the readers drain
+          m_state.load(boost::memory_order_acquire) != writer; latch_wait(++k)) {}
+      }
+      void unlock()
+      {
+        m_version.fetch_add(1, boost::memory_order_relaxed);
+        m_state.store(0, boost::memory_order_release);
+      }
+
+      boost::uint32_t version_begin() const  // waits out an exclusive owner
+      {
+        for (unsigned k = 0;
+          m_state.load(boost::memory_order_acquire) & writer; latch_wait(++k)) {}
+        return m_version.load(boost::memory_order_acquire);
+      }
+      bool version_valid(boost::uint32_t v) const
+      // returns: true if the latch has not been held exclusive since version_begin()
+      //   returned v, so reads made in between saw no changes
+      {
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        return !(m_state.load(boost::memory_order_relaxed) & writer)
+          && m_version.load(boost::memory_order_relaxed) == v;
+      }
+
+      //  scoped ownership; does nothing if constructed with engaged false
+      class shared_guard
+      {
+      public:
+        explicit shared_guard(rw_latch& l, bool engaged = true)
+          : m_latch(engaged ? &l : 0)         { if (m_latch) m_latch->lock_shared(); }
+        ~shared_guard()                       { if (m_latch) m_latch->unlock_shared(); }
+      private:
+        shared_guard(const shared_guard&);
+        shared_guard& operator=(const shared_guard&);
+        rw_latch* m_latch;
+      };
+
+      class guard
+      {
+      public:
+        explicit guard(rw_latch& l, bool engaged = true)
+          : m_latch(engaged ? &l : 0)         { if (m_latch) m_latch->lock(); }
+        ~guard()                              { if (m_latch) m_latch->unlock(); }
+      private:
+        guard(const guard&);
+        guard& operator=(const guard&);
+        rw_latch* m_latch;
+      };
+
+    private:
+      static const boost::int32_t writer = 0x40000000;
+      boost::atomic<boost::int32_t>  m_state;  // count of shared owners, plus writer
+      boost::atomic<boost::uint32_t> m_version;  // count of exclusive ownerships
+    };
+
 //--------------------------------------------------------------------------------------//
 //                                                                                      //
 //                       buffer - a buffer holding disk buffers                         //
@@ -114,8 +230,7 @@ namespace boost
 //--------------------------------------------------------------------------------------//
 
     class buffer
-      : public boost::intrusive::set_base_hook<>, 
-        public boost::intrusive::list_base_hook<> 
+      : public boost::intrusive::list_base_hook<> 
     {
     public:
       typedef boost::uint32_t    buffer_id_type;
@@ -123,25 +238,36 @@ namespace boost
 
       buffer()
         : m_buffer_id(-1), m_use_count(0), m_manager(0),
-          m_data(0), m_needs_write(false) {}
+          m_data(0), m_needs_write(false), m_retain(false), m_flusher_copy(not_copied),
+          m_policy_state(0),
+          m_aux_size(0), m_aux_state(once_not_done), m_links_state(once_not_done),
+          m_links_epoch(0) {}
 
       //  construct a dummy buffer w/ id only
       explicit buffer(buffer_id_type id)
         : m_buffer_id(id), m_use_count(0), m_manager(0),
-          m_data(0), m_needs_write(false) {}
+          m_data(0), m_needs_write(false), m_retain(false), m_flusher_copy(not_copied),
+          m_policy_state(0),
+          m_aux_size(0), m_aux_state(once_not_done), m_links_state(once_not_done),
+          m_links_epoch(0) {}
 
       //  construct a complete fully-managed buffer
       buffer(buffer_id_type id, buffer_manager& pm);
 
       buffer_id_type   buffer_id() const       { return m_buffer_id; }
-      use_count_type   use_count() const       { return m_use_count; }
+      use_count_type   use_count() const
+                                  { return m_use_count.load(boost::memory_order_relaxed); }
       buffer_manager*  manager() const         { return m_manager; }  // may be 0; see below
       bool             needs_write() const     { return m_needs_write; }
+      bool             retain() const          { return m_retain; }
       bool operator<(const buffer& rhs) const  { return buffer_id() < rhs.buffer_id(); }
 
       void             manager(buffer_manager* pm) { m_manager = pm; }
 
-      void inc_use_count()                     { ++m_use_count; }
+      //  The use count is atomic, so that buffer_ptr's to a buffer may be copied and
+      //  destroyed by several threads at once; see buffer_manager::concurrent()
+      void inc_use_count()
+                            { m_use_count.fetch_add(1, boost::memory_order_relaxed); }
       void dec_use_count();
 
       void             reuse(buffer_id_type id)
@@ -149,25 +275,335 @@ namespace boost
         BOOST_ASSERT(m_use_count == 0);  // must not reuse buffer if still in use
         BOOST_ASSERT(!m_needs_write);  // must not reuse buffer if it needs to be written
         m_buffer_id = id;
+        BOOST_ASSERT(m_flusher_copy == not_copied);  // the flusher is writing it
+        m_retain = false;
+        m_policy_state = 0;
+        m_aux_state.store(once_not_done, boost::memory_order_relaxed);
+        m_links_state.store(once_not_done, boost::memory_order_relaxed);
       }
 
-      void             needs_write(bool x)     { m_needs_write = x; }
+      void             needs_write(bool x)
+      {
+        m_needs_write = x;
+        if (x)  // contents are changing
+          m_aux_state.store(once_not_done, boost::memory_order_relaxed);
+      }
+      void             retain(bool x)          { m_retain = x; }
+      //  retain() is a hint to the replacement policy that the buffer is likely to be
+      //  needed again soon, such as a btree branch node; see two_queue_policy
+
+      unsigned char    policy_state() const    { return m_policy_state; }
+      void             policy_state(unsigned char x) { m_policy_state = x; }
+      //  policy_state() is reserved for use by the buffer manager's replacement policy
+
+      char*            data()                  { return m_data; }
+      const char*      data() const            { return m_data; }
+      //  Remarks: If the manager is mapped(), data() points into the read-only mapping
+      //  and is invalid once the manager is closed
+
+      //  aux is in-memory storage for data the owner derives from the buffer contents,
+      //  such as an index of the elements on a btree node. It is never written to the
+      //  file. aux_valid() becomes false when the contents may change, i.e. on
+      //  needs_write(true) and on reuse. To build aux, call aux_begin() and, if it
+      //  returns true, build it and call aux_valid(true). Concurrent readers sharing
+      //  the buffer then build it only once: aux_begin() returns true to just one
+      //  caller, and to others returns false once aux is valid.
+      char*            aux()                   { return m_aux.get(); }
+      char*            aux(std::size_t sz)
+      // Returns: aux(), after growing it to at least sz bytes
+      {
+        if (sz > m_aux_size)
+        {
+          m_aux.reset(new char[sz]);
+          m_aux_size = sz;
+        }
+        return m_aux.get();
+      }
+      bool             aux_begin()             { return m_once_begin(m_aux_state); }
+      bool             aux_valid() const
+                      { return m_aux_state.load(boost::memory_order_acquire) == once_done; }
+      void             aux_valid(bool x)
+        { m_aux_state.store(x ? once_done : once_not_done, boost::memory_order_release); }
+
+      //  links_begin() and links_end() guard, in the same way, in-memory data the owner
+      //  derives from where the buffer sits in its structure, such as a btree node's
+      //  link to its parent. The data is tagged with the owner's epoch, which the owner
+      //  changes whenever its structure changes; links_begin(epoch) returns true to one
+      //  caller if the data is not yet set for that epoch. Reset on reuse.
+      bool             links_begin(boost::uint32_t epoch)
+      {
+        unsigned char x = m_links_state.load(boost::memory_order_acquire);
+        for (unsigned k = 0;;)
+        {
+          if (x == once_running)  // another thread is setting the links
+          {
+            latch_wait(++k);
+            x = m_links_state.load(boost::memory_order_acquire);
+          }
+          else if (x == once_done
+            && m_links_epoch.load(boost::memory_order_acquire) == epoch)
+            return false;
+          else if (m_links_state.compare_exchange_weak(x, once_running,
+            boost::memory_order_acquire))
+            return true;
+        }
+      }
+      void             links_end(boost::uint32_t epoch)
+      {
+        m_links_epoch.store(epoch, boost::memory_order_release);
+        m_links_state.store(once_done, boost::memory_order_release);
+      }
+      bool             links_current(boost::uint32_t epoch) const
+      //  returns: true if the data is set for epoch; only reads the state, so may be
+      //    called by an optimistic reader that must not write to the buffer
+      {
+        return m_links_state.load(boost::memory_order_acquire) == once_done
+          && m_links_epoch.load(boost::memory_order_acquire) == epoch;
+      }
 
-      char*            data()                  { return m_data.get(); }
-      const char*      data() const            { return m_data.get(); }
+      //  latch() is for the owner's use, such as a btree's per-leaf latching of
+      //  concurrent writers; the buffer_manager does not use it
+      rw_latch&        latch()                 { return m_latch; }
 
     protected:
       friend class buffer_manager;
 
+      enum { once_not_done, once_running, once_done };  // m_aux_state, m_links_state
+      enum { not_copied, copied, copied_changed };       // m_flusher_copy
+
+      static bool m_once_begin(boost::atomic<unsigned char>& state)
+      //  Returns: true if the caller is to do the work, which must finish by setting
+      //    state to once_done, otherwise false once the work is done
+      {
+        unsigned char x = state.load(boost::memory_order_acquire);
+        for (unsigned k = 0; x != once_done;)
+        {
+          if (x == once_not_done)
+          {
+            if (state.compare_exchange_weak(x, once_running, boost::memory_order_acquire))
+              return true;
+          }
+          else  // another thread is doing the work, which is brief
+          {
+            latch_wait(++k);
+            x = state.load(boost::memory_order_acquire);
+          }
+        }
+        return false;
+      }
+
       buffer_id_type              m_buffer_id;
-      use_count_type              m_use_count;
+      boost::atomic<use_count_type>
+                                  m_use_count;
       buffer_manager*             m_manager;       // 0 if orphaned; this happens when
                                                    // manager closed but use_count > 0
-      boost::scoped_array<char>   m_data;          // file buffer
+      boost::scoped_array<char>   m_storage;       // file buffer; 0 if mapped
+      char*                       m_data;          // m_storage.get(), or a pointer
+                                                   // into the manager's mapping
       bool                        m_needs_write;
+      bool                        m_retain;
+      unsigned char               m_flusher_copy;  // see m_flusher_pass()
+      unsigned char               m_policy_state;
+      boost::scoped_array<char>   m_aux;
+      std::size_t                 m_aux_size;
+      boost::atomic<unsigned char>
+                                  m_aux_state;
+      boost::atomic<unsigned char>
+                                  m_links_state;
+      boost::atomic<boost::uint32_t>
+                                  m_links_epoch;   // see links_begin()
+      rw_latch                    m_latch;
+    };
+
+    typedef boost::intrusive::list<buffer>  buffer_list;
+
+//--------------------------------------------------------------------------------------//
+//                                                                                      //
+//     replacement_policy - chooses which available buffer to evict or reuse            //
+//                                                                                      //
+//  A buffer is available when its use_count() drops to zero. The buffer_manager hands  //
+//  available buffers to its replacement policy, takes them back when they are read     //
+//  again, and asks the policy for a victim when the cache is full. A buffer is on at   //
+//  most one policy list at a time, so policies share buffer's list hook.               //
+//                                                                                      //
+//--------------------------------------------------------------------------------------//
+
+    class BOOST_BTREE_DECL replacement_policy
+    {
+    public:
+      virtual ~replacement_policy() {}
+
+      virtual void released(buffer& buf) = 0;
+      //  Effects: buf, whose use_count() has become zero, is now available
+
+      virtual void reclaimed(buffer& buf) = 0;
+      //  Requires: buf was made available by released() and not yet returned by victim()
+      //  Effects: buf is no longer available; it has been read again
+
+      virtual buffer* victim() = 0;
+      //  Returns: An available buffer, removed from the policy, or 0 if size() == 0
+
+      virtual std::size_t size() const = 0;
+      //  Returns: The number of available buffers
+
+      virtual void clear() = 0;
+      //  Effects: Forgets all available buffers without deleting them
+    };
+
+    //  lru_policy: evicts the least recently used buffer
+    class BOOST_BTREE_DECL lru_policy : public replacement_policy
+    {
+    public:
+      ~lru_policy()                         { m_list.clear(); }
+
+      void released(buffer& buf)            { m_list.push_back(buf); }
+      void reclaimed(buffer& buf)           { m_list.erase(m_list.iterator_to(buf)); }
+      buffer* victim();
+      std::size_t size() const              { return m_list.size(); }
+      void clear()                          { m_list.clear(); }
+
+      //  the available buffers, least recently used, hence next victim, first
+      typedef buffer_list::iterator iterator;
+      iterator begin()                      { return m_list.begin(); }
+      iterator end()                        { return m_list.end(); }
+
+    private:
+      buffer_list  m_list;  // begin() is the least recently used buffer
+    };
+
+    //  two_queue_policy: a simplified 2Q. Buffers released for the first time enter a
+    //  probationary FIFO queue; buffers that are read again while available, or that are
+    //  marked retain(), enter a protected LRU queue. Victims come from the probationary
+    //  queue unless the protected queue exceeds its share of the available buffers, so a
+    //  single pass over many buffers, such as a full btree scan, cannot flush the hot
+    //  set of branch buffers.
+    class BOOST_BTREE_DECL two_queue_policy : public replacement_policy
+    {
+    public:
+      explicit two_queue_policy(unsigned protected_percent = 75)
+        : m_protected_percent(protected_percent)
+        { BOOST_ASSERT(protected_percent <= 100); }
+      ~two_queue_policy()                   { clear(); }
+
+      void released(buffer& buf);
+      void reclaimed(buffer& buf);
+      buffer* victim();
+      std::size_t size() const              { return m_probation.size()
+                                                + m_protected.size(); }
+      void clear()                          { m_probation.clear(); m_protected.clear(); }
+
+      std::size_t probation_size() const    { return m_probation.size(); }
+      std::size_t protected_size() const    { return m_protected.size(); }
+      unsigned    protected_percent() const { return m_protected_percent; }
+      void        protected_percent(unsigned pct)
+        { BOOST_ASSERT(pct <= 100); m_protected_percent = pct; }
+
+    private:
+      enum { on_protected = 1, referenced = 2 };  // policy_state() bits
+
+      buffer_list  m_probation;
+      buffer_list  m_protected;
+      unsigned     m_protected_percent;
     };
 
 
+//--------------------------------------------------------------------------------------//
+//                                                                                      //
+//          buffer_index - hash table of buffer pointers, keyed on buffer_id            //
+//                                                                                      //
+//  Open addressing with linear probing over a flat array of (buffer_id, buffer*)      //
+//  slots. A lookup compares ids stored in the slot array itself, so a hit touches one  //
+//  or two cache lines instead of walking tree nodes embedded in scattered buffers.     //
+//  Capacity is a power of two and the load factor is kept at or below 1/2. Erase uses  //
+//  backward shift deletion, so no tombstones accumulate.                               //
+//                                                                                      //
+//--------------------------------------------------------------------------------------//
+
+    class BOOST_BTREE_DECL buffer_index
+    {
+      // buffer_index is a non-copyable type
+      buffer_index(const buffer_index&);
+      buffer_index& operator=(const buffer_index&);
+
+    public:
+      typedef buffer::buffer_id_type  buffer_id_type;
+
+      struct slot
+      {
+        buffer_id_type  id;
+        buffer*         ptr;   // 0 if the slot is empty
+      };
+
+      class iterator
+        : public boost::iterator_facade<iterator, buffer, forward_traversal_tag>
+      {
+      public:
+        iterator() : m_slot(0), m_end(0) {}
+        iterator(slot* s, slot* e) : m_slot(s), m_end(e) { m_skip_empty(); }
+      private:
+        friend class boost::iterator_core_access;
+
+        slot*  m_slot;
+        slot*  m_end;
+
+        buffer& dereference() const                 { return *m_slot->ptr; }
+        bool equal(const iterator& rhs) const       { return m_slot == rhs.m_slot; }
+        void increment()                            { ++m_slot; m_skip_empty(); }
+        void m_skip_empty()
+        {
+          while (m_slot != m_end && !m_slot->ptr)
+            ++m_slot;
+        }
+      };
+
+      buffer_index() : m_slots(0), m_capacity(0), m_size(0), m_shift(32) {}
+      ~buffer_index()                              { delete [] m_slots; }
+
+      std::size_t  size() const                    { return m_size; }
+      bool         empty() const                   { return m_size == 0; }
+      std::size_t  capacity() const                { return m_capacity; }
+
+      iterator     begin() const  { return iterator(m_slots, m_slots + m_capacity); }
+      iterator     end() const    { return iterator(m_slots + m_capacity,
+                                                    m_slots + m_capacity); }
+
+      buffer* find(buffer_id_type id) const
+      //  Returns: pointer to the buffer with buffer_id() == id, or 0 if not present
+      {
+        if (!m_size)
+          return 0;
+        for (std::size_t i = m_home(id);; i = (i + 1) & (m_capacity - 1))
+        {
+          if (!m_slots[i].ptr)
+            return 0;
+          if (m_slots[i].id == id)
+            return m_slots[i].ptr;
+        }
+      }
+
+      void insert(buffer& buf);
+      //  Requires: No buffer with an id of buf.buffer_id() is present
+
+      void erase(const buffer& buf);
+      //  Requires: buf is present
+
+      void clear();
+      //  Postconditions: empty(); capacity is retained
+
+    private:
+      slot*           m_slots;
+      std::size_t     m_capacity;  // 0 or a power of 2
+      std::size_t     m_size;
+      unsigned        m_shift;     // 32 - log2(m_capacity)
+
+      std::size_t m_home(buffer_id_type id) const
+      {
+        //  Fibonacci hashing; spreads the runs of adjacent ids typical of btree nodes
+        return static_cast<boost::uint32_t>(id * 2654435769U) >> m_shift;
+      }
+      void m_grow();
+    };
+
 //--------------------------------------------------------------------------------------//
 //                                                                                      //
 //  buffer_manager - manages a binary disk file and its associated buffer objects       //
@@ -177,10 +613,28 @@ namespace boost
 //  relying on operating system disk caching is not sufficient.                         //
 //                                                                                      //
 //  The associated buffer objects are owned by buffer_ptr smart pointers.               //
-//  Buffer objects are cached; the buffer_manager keeps a map of the buffers, keyed on  //
-//  buffer_id, so that requests for a buffer are always satisfied with a buffer_ptr to  //
-//  the same buffer object if it is in memory. To prevent memory allocation churn, a    //
-//  list of available buffers still in memory is also kept.                             //
+//  Buffer objects are cached; the buffer_manager keeps a hash index of the buffers,    //
+//  keyed on buffer_id, so that requests for a buffer are always satisfied with a       //
+//  buffer_ptr to the same buffer object if it is in memory. To prevent memory          //
+//  allocation churn, a list of available buffers still in memory is also kept.         //
+//                                                                                      //
+//  If opened with oflag::mapped, the file must be opened read-only and is memory       //
+//  mapped once its data size is known. Buffers then point directly into the mapping,  //
+//  so a read() of a buffer not in memory copies nothing and issues no system call.    //
+//                                                                                      //
+//  If opened with oflag::concurrent, read() and read_many() may be called by several  //
+//  threads at once, as may copying and destroying buffer_ptr's. The buffers in memory  //
+//  are then divided by buffer_id among shard_count shards, each with its own mutex,    //
+//  index, and LRU list of available buffers, the lists together holding up to          //
+//  max_cache_size() buffers. The mutex is only taken by a read(), and when the last    //
+//  buffer_ptr to a buffer is destroyed. The replacement() policy is not used. If the   //
+//  file is also writable, available buffers that need writing are written when their   //
+//  memory is reused. The caller must keep new_buffer() and reuse() calls from          //
+//  overlapping each other or reads, and flush(), clear_write_needed(), close(),        //
+//  start_flusher(), and stop_flusher() from overlapping any other use.                 //
+//                                                                                      //
+//  A concurrent() buffer_manager may run a background thread, the flusher, that        //
+//  writes available buffers ahead of their reuse; see start_flusher().                 //
 //                                                                                      //
 //--------------------------------------------------------------------------------------//
 
@@ -202,7 +656,9 @@ namespace boost
       explicit buffer_manager(buffer_alloc alloc = default_buffer_alloc)
         //  alloc function pointer allows management of classes derived from buffer
         //  yet still permits separate compilation
-        : m_buffer_count(0), m_data_size(0), m_max_cache_size(0), m_alloc(alloc) {}
+        : m_buffer_count(0), m_data_size(0), m_max_cache_size(0), m_alloc(alloc),
+          m_policy(&m_lru), m_map_requested(false), m_flusher(0),
+          m_flusher_microseconds(0), m_flusher_failed(false) {}
 
       ~buffer_manager();
 
@@ -229,6 +685,57 @@ namespace boost
       buffer_ptr read(buffer_id_type buffer_id);
       //  Throws: if buffer_id is not a valid (i.e. existing) buffer number
 
+      buffer_ptr reuse(buffer_id_type buffer_id);
+      //  Requires: buffer_id is a valid (i.e. existing) buffer number
+      //  Returns: Pointer to the buffer, ready for use as if by new_buffer(). If the
+      //    buffer is not in memory, its contents are zeroed rather than read.
+      //  Postconditions: needs_write() is true
+      //  Remarks: For callers that track unused buffers themselves, and so don't need
+      //    the old contents.
+
+      void read_many(const buffer_id_type* ids, std::size_t count, buffer_ptr* result);
+      //  Remarks: If concurrent(), the buffers are read one at a time by read()
+      //  Requires: count <= max_cache_size(), or enough memory for count buffers
+      //  Effects: result[i] = read(ids[i]) for each i, except that the buffers that are
+      //    not already in memory are read with a single binary_file::read_batch_at().
+      //    If async_io(), the reads are in flight concurrently.
+      //  Throws: if any id is not a valid (i.e. existing) buffer number, or if the batch
+      //    can't be read in full. The buffers prepared for the batch are then removed
+      //    from memory, so a later read() reads them again, and result[0..count) are null.
+
+      void prefetch(const buffer_id_type* ids, std::size_t count);
+      //  Effects: Hints to the operating system that the buffers ids[0..count) that
+      //    are not in memory will soon be read, so it may start reading them into its
+      //    own cache. Runs of adjacent ids are hinted together. Nothing is read into
+      //    buffers, so later read() calls are still needed. Does nothing if mapped().
+      //  Remarks: A hint only; see binary_file::will_need(). May be called
+      //    concurrently with read() if concurrent(). Ids not less than buffer_count()
+      //    are ignored.
+
+      void pin(buffer& pg);
+      //  Requires: concurrent()
+      //  Effects: If pg.buffer_id() < pin_limit and pg is not pinned, pins it: it then
+      //    stays in memory, holding a use count, until unpin() or close(), and is found
+      //    by pinned().
+      //  Remarks: For a few buffers that all threads read, such as btree branch nodes.
+      //    May be called concurrently with read(), pin(), unpin(), and pinned().
+
+      void unpin(buffer_id_type buffer_id);
+      //  Effects: If the buffer with buffer_id is pinned, unpins it.
+
+      buffer* pinned(buffer_id_type buffer_id) const
+      //  Returns: The pinned buffer with buffer_id, or 0 if there is none.
+      //  Remarks: Takes no mutex and changes no use count. The buffer stays valid
+      //    memory until close(), but once unpinned may be reused for another
+      //    buffer_id, so callers must hold a use count or validate what they read.
+      {
+        if (!m_pins || buffer_id >= pin_limit)
+          return 0;
+        pin_slot* chunk = m_pins[buffer_id / pin_chunk_size].load(boost::memory_order_acquire);
+        return chunk
+          ? chunk[buffer_id % pin_chunk_size].load(boost::memory_order_acquire) : 0;
+      }
+
       void write(buffer& pg);
 
       void clear_write_needed();
@@ -236,25 +743,85 @@ namespace boost
       bool flush();
       //  Returns: true iff any buffers written to disk
 
+      void start_flusher(unsigned high_percent, unsigned low_percent);
+      //  Requires: concurrent(), the file is writable, and
+      //    low_percent < high_percent <= 100
+      //  Effects: Starts the flusher, a background thread. When more than high_percent
+      //    of a shard's share of max_cache_size() are available buffers that need
+      //    writing, the flusher writes them, least recently used first, until
+      //    low_percent or fewer are left. A read then seldom has to write the buffer
+      //    it reuses. The flusher checks the shards every flusher_interval
+      //    milliseconds, and as soon as a read has had to write a buffer. If the
+      //    flusher is already running, only the percentages are changed.
+      //  Remarks: The buffers are copied with their shard's mutex held, and the copies
+      //    written with it released, so reads of the shard only wait for the copying.
+      //    flush(), clear_write_needed(), and close() wait for a flusher pass to end.
+      //    If a write fails, the flusher ends, flusher_running() returns false, and
+      //    flusher_error() describes the failure; the buffers it was writing still
+      //    need writing. start_flusher() then starts a new flusher.
+
+      void stop_flusher();
+      //  Effects: Stops the flusher, if running, and waits for it to finish.
+      //    close() also stops the flusher.
+
+      static const unsigned flusher_interval = 10;  // milliseconds
+
       // modifiers
       void             max_cache_size(std::size_t m) {m_max_cache_size = m;}
 
+      enum replacement_type { lru, two_queue };
+      void             replacement(replacement_type r)
+        { replacement(r == lru ? static_cast<replacement_policy&>(m_lru) : m_two_queue); }
+      void             replacement(replacement_policy& p);
+      //  Effects: Makes p the replacement policy. Buffers available under the prior
+      //    policy are transferred to p.
+      //  Remarks: p must outlive its use by *this.
+
       // observers
       std::size_t      max_cache_size() const       {return m_max_cache_size;}
-      buffer_count_type  buffer_count() const       {return m_buffer_count;}
+      bool             concurrent() const           {return m_shards.get() != 0;}
+      bool             flusher_running() const
+        {return m_flusher != 0 && !m_flusher_failed;}
+      std::string      flusher_error() const
+        {return m_flusher_failed ? m_flusher_error : std::string();}
+      //  the error that ended the flusher, if any, until start_flusher() or open()
+      buffer_count_type  buffer_count() const
+                              {return m_buffer_count.load(boost::memory_order_relaxed);}
       data_size_type   data_size() const            {return m_data_size;}  // on disk
 
       void*            owner() const                {return m_owner;}
       void             owner(void* p)               {m_owner = p;}
 
-      boost::uint32_t  active_buffers_read() const  {return m_active_buffers_read;}
-      boost::uint32_t  cached_buffers_read() const  {return m_cached_buffers_read;}
-      boost::uint32_t  file_buffers_read() const    {return m_file_buffers_read;}
-      boost::uint32_t  file_buffers_written() const {return m_file_buffers_written;}
+      boost::uint32_t  active_buffers_read() const
+        {return m_active_buffers_read + m_shard_total(&shard::active_buffers_read);}
+      boost::uint32_t  cached_buffers_read() const
+        {return m_cached_buffers_read + m_shard_total(&shard::cached_buffers_read);}
+      boost::uint32_t  file_buffers_read() const
+        {return m_file_buffers_read + m_shard_total(&shard::file_buffers_read);}
+      boost::uint32_t  file_buffers_written() const
+        {return m_file_buffers_written + m_shard_total(&shard::file_buffers_written);}
+      boost::uint32_t  flusher_buffers_written() const
+        {return m_shard_total(&shard::flusher_buffers_written);}
+      //  number of buffers written by the flusher; included in file_buffers_written()
+      boost::uint64_t  flusher_microseconds() const  {return m_flusher_microseconds;}
+      //  wall clock time the flusher has spent writing
+      boost::uint32_t  flush_writes() const         {return m_flush_writes;}
+      //  number of writes issued by flush(); each is a gather write covering a run
+      //  of one or more adjacent buffers or, if async_io(), a batch of all the
+      //  dirty buffers
+      boost::uint32_t  batch_reads() const          {return m_batch_reads;}
+      //  number of read_batch_at() calls issued by read_many()
+      boost::uint32_t  buffers_prefetched() const
+        {return m_buffers_prefetched + m_shard_total(&shard::buffers_prefetched);}
+      //  number of buffers hinted by prefetch()
       boost::uint32_t  new_buffer_requests() const  {return m_new_buffer_requests;}
-      boost::uint32_t  buffer_allocs() const        {return m_buffer_allocs;}
-      boost::uint32_t  buffers_in_memory() const    {return buffers.size();}
-      boost::uint32_t  buffers_available() const    {return buffer_cache.size();}
+      boost::uint32_t  buffer_allocs() const
+        {return m_buffer_allocs + m_shard_total(&shard::buffer_allocs);}
+      boost::uint32_t  buffers_in_memory() const
+        {return buffers.size() + m_shard_total(&shard::buffers_in_memory);}
+      boost::uint32_t  buffers_available() const
+        {return m_policy->size() + m_shard_total(&shard::buffers_available);}
+      replacement_policy&  replacement() const       {return *m_policy;}
 
 #ifndef BOOST_BUFFER_MANAGER_TEST
     private:
@@ -262,26 +829,30 @@ namespace boost
 
       friend class buffer;
 
-      typedef boost::intrusive::set<buffer>   buffers_type;
-      typedef boost::intrusive::list<buffer>  buffer_cache_type;
+      typedef buffer_index                    buffers_type;
+      typedef buffer_list                     buffer_cache_type;
 
       buffers_type   buffers;           // all buffers in memory that are being
                                         // managed by this buffer manager, including
                                         // buffers in use (use_count() > 0) and
-                                        // buffers in the buffer_cache (use_count() == 0)
-
-      buffer_cache_type  buffer_cache;  // buffers in memory with use_count() == 0;
-                                        // least recently used (LRU) order, begin()
-                                        // being the least recently used buffer
+                                        // available buffers (use_count() == 0)
 
     private:
 
-      buffer_count_type   m_buffer_count;     // number of buffers in the file
+      boost::atomic<buffer_count_type>
+                          m_buffer_count;     // number of buffers in the file; atomic
+                                              // for read() racing with new_buffer()
       data_size_type      m_data_size;        // number of bytes per disk buffer
       std::size_t         m_max_cache_size;   // maximum # buffers to cache; may be 0
       void*               m_owner;            // not used by buffer_manager itself
       buffer_alloc        m_alloc;            // memory allocation function pointer
 
+      //  the replacement policy keeps the available buffers
+      lru_policy          m_lru;
+      two_queue_policy    m_two_queue;
+      replacement_policy* m_policy;           // never 0
+      bool                m_map_requested;    // oflag::mapped; map() in data_size()
+
       //  activity counts
       boost::uint32_t   m_active_buffers_read;
       boost::uint32_t   m_cached_buffers_read;
@@ -289,8 +860,81 @@ namespace boost
       boost::uint32_t   m_file_buffers_written;
       boost::uint32_t   m_new_buffer_requests;
       boost::uint32_t   m_buffer_allocs;
+      boost::uint32_t   m_flush_writes;
+      boost::uint32_t   m_batch_reads;
+      boost::uint32_t   m_buffers_prefetched;
+
+      std::vector<buffer*>  m_flush_list;     // flush() workspace, kept to avoid
+                                              // reallocation on every flush
+
+      //  concurrent() state; the buffer with a given id is in shard id % shard_count
+    public:
+      static const std::size_t  shard_count = 16;
+    private:
+      struct shard
+      {
+        boost::detail::lightweight_mutex  mutex;
+        buffers_type      buffers;
+        lru_policy        available;
+        boost::uint32_t   active_buffers_read;
+        boost::uint32_t   cached_buffers_read;
+        boost::uint32_t   file_buffers_read;
+        boost::uint32_t   buffer_allocs;
+        boost::uint32_t   file_buffers_written;
+        boost::uint32_t   flusher_buffers_written;
+        boost::uint32_t   buffers_prefetched;
+
+        boost::uint32_t   buffers_in_memory() const   { return buffers.size(); }
+        boost::uint32_t   buffers_available() const   { return available.size(); }
+      };
+      boost::scoped_array<shard>  m_shards;   // 0 unless concurrent()
+
+      //  pinned buffers, by id; chunks of pin_chunk_size slots are allocated as needed
+    public:
+      static const std::size_t  pin_chunk_size = 4096;
+      static const std::size_t  pin_limit = 16384 * pin_chunk_size;
+    private:
+      typedef boost::atomic<buffer*>  pin_slot;
+      boost::scoped_array<boost::atomic<pin_slot*> >
+                                  m_pins;     // 0 unless concurrent()
+      void       m_unpin_all();
+
+      shard& m_shard(buffer_id_type pg_id) const  { return m_shards[pg_id % shard_count]; }
+      buffer*    m_shared_prepare(shard& sh, buffer_id_type pg_id);
+      buffer_ptr m_shared_read(buffer_id_type pg_id);
+      buffer_ptr m_shared_reuse(buffer_id_type pg_id);
+      void       m_shared_release(buffer& buf);
+      void       m_shared_close();
+      boost::uint32_t m_shard_total(boost::uint32_t shard::* count) const;
+      boost::uint32_t m_shard_total(boost::uint32_t (shard::* count)() const) const;
+
+      //  start_flusher() state; the flusher holds its mutex during a pass
+      struct flusher;
+      flusher*                        m_flusher;   // 0 unless flusher_running()
+      boost::atomic<boost::uint64_t>  m_flusher_microseconds;
+      boost::atomic<bool>             m_flusher_failed;  // m_flusher_error is set
+      std::string                     m_flusher_error;
+      void       m_flusher_run();
+      void       m_flusher_pass(shard& sh, unsigned high_percent, unsigned low_percent);
+
+      struct buffer_id_less
+      {
+        bool operator()(const buffer* x, const buffer* y) const
+          { return x->buffer_id() < y->buffer_id(); }
+      };
 
       buffer* m_prepare_buffer(buffer_id_type pg_id);
+      void    m_discard(const std::vector<buffer*>& prepared, buffer_ptr* result,
+                std::size_t count);
+      //  read_many()'s cleanup when the batch fails: removes the prepared buffers from
+      //  the index, resets result[0..count), and deletes the prepared buffers
+
+      char*   m_mapped_data(buffer_id_type pg_id) const
+      {
+        BOOST_ASSERT(mapped());
+        BOOST_ASSERT(pg_id < buffer_count());
+        return const_cast<char*>(mapping()) + pg_id * data_size();
+      }
     };
 
     BOOST_BTREE_DECL
@@ -328,12 +972,22 @@ namespace boost
 
     inline buffer::buffer(buffer_id_type id, boost::btree::buffer_manager& pm)
       : m_buffer_id(id), m_use_count(0), m_manager(&pm),
-        m_data(new char[pm.data_size()]), m_needs_write(false) {}
+        m_storage(pm.mapped() ? 0 : new char[pm.data_size()]),
+        m_data(pm.mapped() ? pm.m_mapped_data(id) : m_storage.get()),
+        m_needs_write(false), m_retain(false), m_flusher_copy(not_copied), m_policy_state(0),
+        m_aux_size(0), m_aux_state(once_not_done), m_links_state(once_not_done),
+        m_links_epoch(0) {}
 
     inline void buffer::dec_use_count()
     {
       BOOST_ASSERT(use_count() != 0);
-      if ( --m_use_count == 0
+      if (manager() && manager()->concurrent()
+        && buffer_id() != static_cast<buffer_id_type>(-1))
+      {
+        manager()->m_shared_release(*this);
+        return;
+      }
+      if ( m_use_count.fetch_sub(1, boost::memory_order_acq_rel) == 1
            && buffer_id() != static_cast<buffer_id_type>(-1)  // dummy buffers have id -1
          )
       {
@@ -344,20 +998,20 @@ namespace boost
         }
         else
         {
-          if (manager()->buffer_cache.size()
-            && manager()->buffer_cache.size() >= manager()->max_cache_size())
+          replacement_policy* policy = manager()->m_policy;
+          if (policy->size()
+            && policy->size() >= manager()->max_cache_size())
           {
             // release a buffer
-            buffer* lru = &*manager()->buffer_cache.begin();
-            manager()->buffer_cache.pop_front();
-            manager()->buffers.erase(manager()->buffers.iterator_to(*lru));
-            if (lru->needs_write())
+            buffer* victim = policy->victim();
+            manager()->buffers.erase(*victim);
+            if (victim->needs_write())
             {
-              manager()->write(*lru);
+              manager()->write(*victim);
             }
-            delete lru;
+            delete victim;
           }
-          manager()->buffer_cache.push_back(*this);
+          policy->released(*this);
         }
       }
     }
@@ -11,12 +11,19 @@
 #define BOOST_BTREE_COMMON_HPP
 
 #include <boost/iterator/iterator_facade.hpp>
+#include <boost/next_prior.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/btree/detail/buffer_manager.hpp>
+#include <boost/btree/detail/node_search.hpp>
+#include <boost/btree/blob.hpp>
 #include <boost/assert.hpp>
 #include <boost/static_assert.hpp>
 #include <boost/type_traits/is_const.hpp>
 #include <boost/type_traits/remove_const.hpp>
+#include <boost/type_traits/is_same.hpp>
+#include <boost/type_traits/integral_constant.hpp>
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
 #include <boost/mpl/or.hpp>
 #include <boost/mpl/if.hpp>
 #include <cstddef>     // for size_t
@@ -28,6 +35,8 @@
 #include <algorithm>
 #include <ostream>
 #include <stdexcept>
+#include <vector>
+#include <set>
 
 /*
 
@@ -36,8 +45,6 @@
 
   * btree_unit_test.cpp: move erase tests out of insert test.
 
-  * Upgrade m_update() to allow new dynamic size different from old dynamic size
-
   * Add static_assert Key, T are is_trivially_copyable
 
   * Should header() be part of the public interface?
@@ -52,9 +59,6 @@
   * Either add code to align mapped() or add a requirement that PID, K does not
     require alignment.
 
-  * Add a function (apply(key, mapped_value)?) that inserts if key not present,
-    updates if present.
-
   * Header should contain uuid for value_type; used to check existing file is being
     opened with the right template parameters.
 
@@ -162,6 +166,7 @@ public:
   typedef Comp  value_compare;
 
   const Key& key(const value_type& v) const {return v;}  // really handy, so expose
+  const Key& mapped(const value_type& v) const {return v;}
 
   static std::size_t key_size() { return -1; }
   static std::size_t mapped_size() { return -1; }
@@ -187,6 +192,8 @@ public:
 
   const Key& key(const value_type& v) const  // really handy, so expose
     {return v.key();}
+  const T& mapped(const value_type& v) const
+    {return v.mapped_value();}
 
   static std::size_t key_size() { return -1; }
   static std::size_t mapped_size() { return -1; }
@@ -485,7 +492,10 @@ public:
 
   void flush()                              {
                                               BOOST_ASSERT(is_open());
-                                              if (m_mgr.flush())
+                                              bool map_changed = m_free_map_changed;
+                                              if (map_changed)
+                                                m_write_free_map();
+                                              if (m_mgr.flush() || map_changed)
                                                 m_write_header();
                                             }
   void close();
@@ -525,12 +535,82 @@ public:
   // capacity:
 
   bool          empty() const               { return !size(); }
-  size_type     size() const                { return m_hdr.element_count(); }
+  size_type     size() const
+    { return static_cast<size_type>(m_element_count.load(boost::memory_order_relaxed)); }
   //size_type     max_size() const            { return ; }
   std::size_t   node_size() const           { return m_mgr.data_size(); }
   std::size_t   max_cache_size() const      { return m_mgr.max_cache_size(); }
   void          max_cache_size(std::size_t m) {m_mgr.max_cache_size(m);}
 
+  //  Background writes: with flags::concurrent_write, start_flusher() starts a thread
+  //  that writes cached nodes before they are evicted, so a search that evicts a
+  //  node seldom waits for the node to be written. The flusher writes once more than
+  //  high_percent of the cache is changed nodes no thread is using, and stops at
+  //  low_percent; see buffer_manager::start_flusher(). close() stops it.
+  void          start_flusher(unsigned high_percent = 50, unsigned low_percent = 25)
+  {
+    BOOST_ASSERT_MSG(m_concurrent_write, "start_flusher() requires concurrent_write");
+    m_mgr.start_flusher(high_percent, low_percent);
+  }
+  void          stop_flusher()              { m_mgr.stop_flusher(); }
+
+  //  Underflow maintenance: if min_fill() is non-zero, an erase that leaves a non-root
+  //  node less than min_fill() percent full merges the node with an adjacent sibling
+  //  or, if both will not fit on one node, borrows elements from the sibling. Borrowing
+  //  is only done for leaves whose key_type is not dynamic size. The default, 0, only
+  //  removes nodes once they are empty. The counts are since the btree was opened.
+  unsigned      min_fill() const            { return m_min_fill; }
+  void          min_fill(unsigned percent)
+  {
+    BOOST_ASSERT_MSG(percent <= 50, "min_fill() percent must be 50 or less");
+    m_min_fill = percent;
+  }
+  boost::uint32_t  node_merges() const      { return m_node_merges; }
+  boost::uint32_t  node_borrows() const     { return m_node_borrows; }
+
+  //  Read-ahead: when an iterator or range scan steps from one leaf to the next, the
+  //  next read_ahead() leaves under the same parent that are not in the cache are
+  //  hinted to the operating system, which may then read them in the background while
+  //  the scan works through the current leaf; see buffer_manager::prefetch(). Only
+  //  forward steps read ahead. A step still reads its one leaf by itself, since an
+  //  iterator holds only one. find_many() and lower_bound_many() read up to read_ahead()
+  //  leaves at a time instead. 0 turns read-ahead off. The default is
+  //  default_read_ahead_nodes. Hints have no effect where the operating system has none.
+  unsigned      read_ahead() const          { return m_read_ahead; }
+  void          read_ahead(unsigned n)      { m_read_ahead = n; }
+
+  //  Overflow values: for a mapped_type of blob (see boost/btree/blob.hpp), values larger
+  //  than overflow_threshold() bytes are kept out of line in a chain of overflow nodes,
+  //  allocated like any other node. The threshold is not stored in the file. It
+  //  defaults to node_size() / 8, and may not exceed blob::max_inline_size.
+  std::size_t   overflow_threshold() const
+  {
+    if (m_overflow_threshold)
+      return m_overflow_threshold;
+    std::size_t max_sz = blob::max_inline_size;  // std::min() would bind a reference
+    return std::min(node_size() / 8, max_sz);
+  }
+  void          overflow_threshold(std::size_t sz)
+  {
+    BOOST_ASSERT_MSG(sz <= blob::max_inline_size,
+      "overflow_threshold() must not exceed blob::max_inline_size");
+    m_overflow_threshold = sz;
+  }
+
+  blob          make_blob(const void* p, std::size_t sz);
+  //  Requires: is_open() && !read_only()
+  //  Returns: A blob holding the sz bytes at p; inline if sz <= overflow_threshold(),
+  //    otherwise written to new overflow nodes.
+  //  Remarks: The btree owns the overflow nodes of a blob once it is inserted. An
+  //    overflow blob that is not inserted, say because a unique btree already has its
+  //    key, should be passed to free_blob().
+
+  void          read_blob(const blob& b, void* target) const;
+  //  Effects: Copies the b.size() bytes of b's value to target.
+
+  void          free_blob(const blob& b);
+  //  Effects: If b.is_overflow(), frees its overflow nodes.
+
   //  The following element access functions are not provided. Returning references is
   //  far too dangerous, since the memory pointed to would be in a node buffer that can
   //  overwritten by other activity, including calls to const functions. Access via
@@ -554,11 +634,24 @@ public:
   //iterator insert(const_iterator position, P&&);
   //void insert(initializer_list<value_type>);
 
+  //  Hinted insert and emplace_hint() are provided by the container classes. The hint
+  //  is used as by lower_bound(hint, k) below, and has no effect on the result.
+
   const_iterator     erase(const_iterator position);
   size_type          erase(const key_type& k);
   const_iterator     erase(const_iterator first, const_iterator last);
   void               clear();
 
+  void               compact(unsigned fill_percent = 100);
+  //  Requires: is_open() && !read_only(), and 1 <= fill_percent <= 100
+  //  Effects: Rebuilds the btree so that nodes other than the last at each level are
+  //    filled to fill_percent, with branches at the front of the file, top level
+  //    first, followed by the leaves in key order. The file is rewritten via two
+  //    temporary files in the same directory, path + ".load" and path + ".compact",
+  //    and then reopened; free nodes are not carried over, so the file shrinks.
+  //  Postcondition: Iterators are invalidated. max_cache_size() and min_fill() are
+  //    unchanged.
+
   // observers:
 
   key_compare        key_comp() const       { return m_comp; }
@@ -572,9 +665,38 @@ public:
   const_iterator     lower_bound(const key_type& k) const;
   const_iterator     upper_bound(const key_type& k) const;
 
+  const_iterator     lower_bound(const_iterator hint, const key_type& k) const;
+  //  Returns: lower_bound(k)
+  //  Remarks: If k belongs on hint's leaf, or on a leaf near it, the search starts
+  //    there rather than at the root, provided no branch node has changed since hint's
+  //    path from the root was established. Searches for ascending keys, each hinted by
+  //    the prior result, then usually read only the leaf level.
+
   const_iterator_range  equal_range(const key_type& k) const
                             { return std::make_pair(lower_bound(k), upper_bound(k)); }
 
+  //  Batch lookups: the keys are searched in sorted order, and each search climbs only
+  //  as far up the previous search's path as needed rather than starting at the root,
+  //  so searches for nearby keys share their branch nodes. Once a search reaches a
+  //  leaf, the next read_ahead() leaves under the same parent that later searches need
+  //  are read as one batch; see buffer_manager::read_many(). Results are written in the
+  //  order of [first, last). Each result iterator holds its leaf node in memory until
+  //  the iterator is destroyed.
+
+  template <class ForwardIterator, class OutputIterator>
+  OutputIterator     lower_bound_many(ForwardIterator first, ForwardIterator last,
+                       OutputIterator result) const;
+  //  Requires: ForwardIterator's reference type is const key_type& or key_type&
+  //  Effects: *result++ = lower_bound(k) for each k in [first, last)
+  //  Returns: result
+
+  template <class ForwardIterator, class OutputIterator>
+  OutputIterator     find_many(ForwardIterator first, ForwardIterator last,
+                       OutputIterator result) const;
+  //  Requires: ForwardIterator's reference type is const key_type& or key_type&
+  //  Effects: *result++ = find(k) for each k in [first, last)
+  //  Returns: result
+
 //--------------------------------------------------------------------------------------//
 //                                private data members                                  //
 //--------------------------------------------------------------------------------------//
@@ -600,7 +722,41 @@ private:
   std::size_t        m_max_branch_size;
 
   bool               m_read_only;
-  bool               m_ok_to_pack;  // true while all inserts ordered and no erases
+  flags::bitmask     m_open_flags;  // as passed to m_open()
+
+  unsigned           m_min_fill;      // see min_fill()
+  unsigned           m_read_ahead;    // see read_ahead()
+  std::size_t        m_overflow_threshold;  // 0 for the default; see overflow_threshold()
+  boost::uint32_t    m_node_merges;
+  boost::uint32_t    m_node_borrows;
+
+  //  bulk load state; see m_bulk_begin()
+  std::vector<btree_node_ptr>
+                     m_bulk_path;        // rightmost node at each level, leaf first
+  leaf_iterator      m_bulk_last;        // element most recently pushed
+  std::size_t        m_bulk_leaf_limit;  // leaf bytes to fill before starting a new leaf
+  std::size_t        m_bulk_branch_limit;
+  std::size_t        m_bulk_new_nodes;   // nodes created since the last flush
+
+  std::vector<char>  m_separator_buf;    // see m_separator()
+
+  //  free space map; see m_new_node()
+  std::set<boost::uint32_t>
+                     m_free_ids;         // ids of free nodes
+  bool               m_free_map_changed; // m_free_ids differs from the file
+
+  boost::uint32_t    m_branch_version;   // incremented by every change to a branch
+                                         // node; see m_hint_start()
+
+  //  flags::concurrent_write state; see m_concurrent_insert()
+  bool               m_concurrent_write;
+  mutable rw_latch   m_tree_latch;
+  boost::atomic<btree_node*>
+                     m_optimistic_root;  // m_root.get(); see m_optimistic_leaf()
+  boost::atomic<boost::uint32_t>
+                     m_optimistic_root_id;  // m_root->node_id()
+  boost::atomic<boost::uint64_t>
+                     m_element_count;    // see m_element_count_add()
                                                
 
 //--------------------------------------------------------------------------------------//
@@ -703,14 +859,26 @@ private:
   class btree_node : public buffer
   {
   public:
-    btree_node() : buffer() {}
+    btree_node() : buffer(), m_parent_version(0), m_run_id(0), m_run_end(0),
+      m_hinted_id(0) {}
     btree_node(buffer::buffer_id_type id, buffer_manager& mgr)
-      : buffer(id, mgr) {}
+      : buffer(id, mgr), m_parent_version(0), m_run_id(0), m_run_end(0),
+        m_hinted_id(0) {}
 
     node_id_type       node_id() const                 {return node_id_type(buffer_id());}
 
     btree_node*        parent()                          {return m_parent.get();}
-    void               parent(btree_node_ptr p)          {m_parent = p;}
+    void               parent(btree_node_ptr p)
+    {
+      m_parent = p;
+      m_parent_version = static_cast<const btree_base*>(manager()->owner())
+        ->m_branch_version;
+      if (p)
+        p->retain(true);  // hint to the cache: parents are branches, which are hot
+    }
+    //  the m_branch_version when parent() was set; if it is still current, parent() and
+    //  parent_element() are still valid
+    boost::uint32_t    parent_version() const            {return m_parent_version;}
     branch_iterator    parent_element()                  {return m_parent_element;}
     void               parent_element(branch_iterator p) {m_parent_element = p;}
 #   ifndef NDEBUG
@@ -718,6 +886,41 @@ private:
     void               parent_node_id(node_id_type id)   {m_parent_node_id = id;}
 #   endif
 
+    void               parent(btree_node_ptr p, branch_iterator e)
+    //  sets parent() and parent_element() as a node is reached from its parent p. With
+    //  flags::concurrent_read or concurrent_write, threads share the links of a node in
+    //  memory; they are set by the first thread to reach the node since the branches
+    //  last changed, as counted by m_branch_version, and then used by all threads.
+    {
+      m_hinted_id.store(0, boost::memory_order_relaxed);  // next_node() sets it again
+      if (manager()->concurrent())
+      {
+        parent(p, e, static_cast<const btree_base*>(manager()->owner())
+          ->m_branch_version);
+        return;
+      }
+      parent(p);
+      parent_element(e);
+#     ifndef NDEBUG
+      parent_node_id(p ? p->node_id() : node_id_type(0));
+#     endif
+    }
+
+    void               parent(btree_node_ptr p, branch_iterator e,
+                         boost::uint32_t version)
+    //  as above, when concurrent, with the m_branch_version that p and e were read at
+    {
+      if (!links_begin(version))
+        return;
+      m_parent = p;
+      m_parent_element = e;
+      m_parent_version = version;
+#     ifndef NDEBUG
+      m_parent_node_id = p ? p->node_id() : node_id_type(0);
+#     endif
+      links_end(version);
+    }
+
     leaf_data&         leaf()       {return *reinterpret_cast<leaf_data*>(buffer::data());}
     const leaf_data&   leaf() const {return *reinterpret_cast<const leaf_data*>(buffer::data());}
     branch_data&       branch()     {return *reinterpret_cast<branch_data*>(buffer::data());}
@@ -729,6 +932,15 @@ private:
     void               size(std::size_t sz)  {leaf().m_size = sz;}    // ditto
     bool               empty() const         {return leaf().m_size == 0;}
 
+    //  Ascending run detection: run_end() records the offset just past the most
+    //  recent insert into this node, and continues_run(off) is true if an insert at
+    //  off would go immediately after it. Not on disk; kept with the node id, so it
+    //  lapses when the buffer is reused for another node.
+    bool               continues_run(std::size_t off) const
+                                 {return m_run_id == buffer_id() && m_run_end == off;}
+    void               run_end(std::size_t off) {m_run_id = buffer_id(); m_run_end = off;}
+    void               clear_run()           {m_run_id = 0;}
+
     btree_node_ptr     next_node()  // return next node at current level
     {
       if (!parent())              // if this is the root, there is no next node
@@ -749,12 +961,13 @@ private:
         par_element = par->branch().begin();
       }
 
+      bool stepped = par_element != par->branch().begin();  // from e-1 in par
+      if (is_leaf())
+        m_hint_next_leaves(par.get(), par_element, stepped);
       btree_node_ptr np(manager()->read(par_element->node_id()));
-      np->parent(par);
-      np->parent_element(par_element);
-#     ifndef NDEBUG
-      np->parent_node_id(par->node_id());
-#     endif
+      np->parent(par, par_element);
+      if (is_leaf())
+        np->m_hinted_id.store(np->buffer_id(), boost::memory_order_relaxed);
       return np;
     }
 
@@ -768,7 +981,8 @@ private:
 
       if (par_element != par->branch().begin())
       {
-        --par_element;
+        par_element = btree_base::m_node_prior(par.get(), par->branch().begin(),
+          par_element);
       }
       else
       {
@@ -779,21 +993,53 @@ private:
       }
 
       btree_node_ptr np(manager()->read(par_element->node_id()));
-      np->parent(par);
-      np->parent_element(par_element);
-#     ifndef NDEBUG
-      np->parent_node_id(par->node_id());
-#     endif
+      np->parent(par, par_element);
       return np;
     }
 
   private:
+    void               m_hint_next_leaves(btree_node* par, branch_iterator e,
+                         bool stepped)
+    //  e is the element of par for the leaf next_node() is about to read, and stepped
+    //  is true if this leaf is at e-1. If this leaf was itself read by next_node(), the
+    //  leaves after e up to e+n-1 have been hinted already, so only e+n is; otherwise,
+    //  as when a scan starts at a leaf found by a search, the read_ahead() leaves after
+    //  e all are. Each leaf of a scan is thus hinted once. See btree_base::read_ahead().
+    {
+      unsigned n = static_cast<const btree_base*>(manager()->owner())->m_read_ahead;
+      bool first = !stepped
+        || m_hinted_id.load(boost::memory_order_relaxed) != buffer_id();
+      buffer::buffer_id_type ids[16];
+      std::size_t count = 0;
+      for (unsigned i = 1; i <= n && e != par->branch().end(); ++i)
+      {
+        ++e;
+        if (first || i == n)
+        {
+          ids[count++] = e->node_id();
+          if (count == sizeof(ids) / sizeof(ids[0]))
+          {
+            manager()->prefetch(ids, count);
+            count = 0;
+          }
+        }
+      }
+      if (count)
+        manager()->prefetch(ids, count);
+    }
+
     btree_node_ptr     m_parent;          // by definition, the parent is a branch node.
     branch_iterator    m_parent_element;
 # ifndef NDEBUG
     node_id_type       m_parent_node_id;  // allows assert that m_parent has not been
                                           // overwritten by faultylogic
 # endif
+    boost::uint32_t    m_parent_version;  // see parent_version()
+    buffer::buffer_id_type m_run_id;      // see continues_run()
+    std::size_t        m_run_end;
+    boost::atomic<buffer::buffer_id_type>
+                       m_hinted_id;       // buffer_id() if read by next_node(), hence
+                                          // the leaves after it have been hinted
   };
 
   //-------------------------------  btree_node_ptr  -----------------------------------//
@@ -875,16 +1121,56 @@ private:
 protected:
 
   std::pair<const_iterator, bool>
-    m_insert_unique(const key_type& k, const mapped_type& mv);
+    m_insert_unique(const key_type& k, const mapped_type& mv)
+      { return m_insert_unique(end(), k, mv); }
 
   const_iterator
-    m_insert_non_unique(const key_type& k, const mapped_type& mv);
+    m_insert_non_unique(const key_type& k, const mapped_type& mv)
+      { return m_insert_non_unique(end(), k, mv); }
   // Remark: Insert after any elements with equivalent keys, per C++ standard
 
+  std::pair<const_iterator, bool>
+    m_insert_unique(const_iterator hint, const key_type& k, const mapped_type& mv);
+
+  const_iterator
+    m_insert_non_unique(const_iterator hint, const key_type& k, const mapped_type& mv);
+  // Remark: As above; hint only affects where the search for the insertion point
+  //   starts. See lower_bound(hint, k).
+
   iterator m_update(iterator itr, const mapped_type& mv);
+  // Remark: If the new mapped value's dynamic size differs from the old one's, the
+  //   element is removed and reinserted at the same position, splitting the leaf if
+  //   necessary. Other iterators to the leaf are then invalidated.
+
+  std::pair<const_iterator, bool>
+    m_insert_or_assign(const_iterator hint, const key_type& k, const mapped_type& mv);
+  // effects: if an element with a key equivalent to k exists, updates the first such
+  //   element's mapped value to mv, otherwise inserts k, mv. One search either way.
+  // returns: an iterator to the updated or inserted element, and true if inserted
+
+  //  Bulk load: builds the tree bottom-up from elements pushed in key order. Leaves are
+  //  appended left to right, and each new node's first key is posted to the rightmost
+  //  node of the level above, so every level is built in the same single pass and node
+  //  ids are allocated sequentially. The tree is valid after each m_bulk_push().
+
+  void m_bulk_begin(unsigned fill_percent);
+  // requires: is_open() && !read_only() && empty()
+
+  bool m_bulk_push(const key_type& k, const mapped_type& mv);
+  // requires: m_bulk_begin() has been called, and k is not less than the key of the
+  //   prior element pushed; throws std::runtime_error if k is less
+  // returns: false if the tree is unique and k is equivalent to the prior key, in
+  //   which case the element is not inserted, otherwise true
+
+  void m_bulk_end();
 
   void m_open(const boost::filesystem::path& p, flags::bitmask flgs, std::size_t node_sz);
 
+  void m_relocate(const boost::filesystem::path& p, const btree_base& overflow_src);
+  // effects: writes a copy of the btree to file p, with node ids reassigned so that the
+  //   branches come first, top level first, followed by the leaves in key order, and
+  //   then by the overflow nodes of blob values, read from overflow_src
+
 //--------------------------------------------------------------------------------------//
 //                              private member functions                                //
 //--------------------------------------------------------------------------------------//
@@ -895,30 +1181,454 @@ private:
 
   void m_read_header()
   {
-    m_mgr.seek(0);
-    m_mgr.binary_file::read(m_hdr, sizeof(btree::header_page));
+    m_mgr.binary_file::read_at(0, m_hdr, sizeof(btree::header_page));
     m_hdr.endian_flip_if_needed();
   }
 
   void m_write_header()
   {
-    m_mgr.seek(0);
+    m_hdr.element_count(m_element_count.load(boost::memory_order_relaxed));
     m_hdr.endian_flip_if_needed();
-    m_mgr.binary_file::write(&m_hdr, sizeof(btree::header_page));
+    m_mgr.binary_file::write_at(0, &m_hdr, sizeof(btree::header_page));
     m_hdr.endian_flip_if_needed();
   }
 
-  iterator m_special_lower_bound(const key_type& k) const;
+  iterator m_special_lower_bound(const key_type& k) const
+    { return m_special_lower_bound(m_root, k); }
   // returned iterator::m_element is the insertion point, and thus may be the 
   // past-the-end leaf_iterator for iterator::m_node
   // postcondition: parent pointers are set, all the way up the chain to the root
 
-  iterator m_special_upper_bound(const key_type& k) const;
+  iterator m_special_lower_bound(btree_node_ptr np, const key_type& k) const;
+  // as above, but the search starts at np rather than the root
+  // requires: np is m_root, or np's parent pointers are set and np's subtree contains
+  //   the search path for k
+
+  btree_node_ptr m_climb(btree_node_ptr np, const key_type& k) const;
+  // requires: np's parent pointers are set, and np's subtree contains the search path
+  //   for some key not greater than k
+  // returns: the lowest node on np's parent chain whose subtree contains the search
+  //   path for k; m_root if there is no such lower node
+
+  const_iterator m_to_lower_bound(const_iterator low) const;
+  // requires: low was returned by m_special_lower_bound()
+  // returns: the lower_bound() result corresponding to low
+
+  template <class ForwardIterator>
+  void m_lower_bound_many(ForwardIterator first, ForwardIterator last,
+    std::vector<const key_type*>& keys, std::vector<const_iterator>& bounds) const;
+
+  void m_read_leaves(btree_node_ptr np, std::vector<std::size_t>::const_iterator next,
+    std::vector<std::size_t>::const_iterator last,
+    const std::vector<const key_type*>& keys, std::vector<buffer_ptr>& held) const;
+  // requires: np is the leaf reached by m_lower_bound_many()'s search for the key
+  //   before *next, and has a parent
+  // effects: replaces held with the leaves after np under np's parent that the searches
+  //   for *keys[*next], ... *keys[*(last-1)] will reach, up to read_ahead() of them,
+  //   read by a single m_mgr.read_many()
+
+  class probe_compare  // orders indexes into a vector of key pointers by key
+  {
+  public:
+    probe_compare(const std::vector<const key_type*>& keys, Comp comp)
+      : m_keys(keys), m_comp(comp) {}
+    bool operator()(std::size_t x, std::size_t y) const
+      { return m_comp(*m_keys[x], *m_keys[y]); }
+  private:
+    const std::vector<const key_type*>& m_keys;
+    Comp m_comp;
+  };
+
+  iterator m_special_upper_bound(const key_type& k) const
+    { return m_special_upper_bound(m_root, k); }
   // returned iterator::m_element is the insertion point, and thus may be the 
   // past-the-end leaf_iterator for iterator::m_node
   // postcondition: parent pointers are set, all the way up the chain to the root
 
-  btree_node_ptr m_new_node(boost::uint16_t lv);
+  iterator m_special_upper_bound(btree_node_ptr np, const key_type& k) const;
+  // as above, but the search starts at np rather than the root
+  // requires: as for m_special_lower_bound(np, k)
+
+  btree_node_ptr m_lower_bound_leaf(btree_node_ptr np, const key_type& k) const;
+  btree_node_ptr m_upper_bound_leaf(btree_node_ptr np, const key_type& k) const;
+  // returns: the leaf searched by m_special_lower_bound(np, k) and
+  //   m_special_upper_bound(np, k) respectively; the leaf's elements are not read
+
+  branch_iterator m_lower_bound_child(btree_node* np, const key_type& k) const;
+  // requires: np is a branch
+  // returns: the element of np whose child m_lower_bound_leaf() descends to for k
+
+  //  flags::concurrent_write: m_tree_latch covers the branch nodes. Operations that stay
+  //  within one leaf hold it shared, and latch that leaf: exclusive to insert or erase,
+  //  shared to search. An insert or erase that would split or merge nodes, or free
+  //  overflow nodes, instead holds m_tree_latch exclusive, and runs as when single
+  //  threaded. A writer never holds more than one leaf latch, and a reader only takes a
+  //  leaf's right neighbor while holding it, so latches can't deadlock.
+  std::pair<const_iterator, bool>
+    m_concurrent_insert(const key_type& k, const mapped_type& mv, bool unique);
+  size_type m_concurrent_erase(const key_type& k);
+  const_iterator m_concurrent_find(const key_type& k) const;
+  size_type m_concurrent_count(const key_type& k) const;
+
+  //  find() and count() first search optimistically, writing neither m_tree_latch nor
+  //  the leaf latch: they read the latches' versions, search, and retry if either was
+  //  held exclusive meanwhile. Reads that race with a change must stay within the node
+  //  buffers, so this is only done when elements have a fixed size and the leaves have
+  //  no key column, since otherwise a search may follow offsets or build aux() storage
+  //  from the changing node. What is read is first copied by racy_copy. The optimistic
+  //  search never sets parent links, since a writer may be changing them, so a find()
+  //  whose path's links are not yet set for the current branches repeats the search
+  //  with the latches, which sets them.
+  static const bool optimistic_reads = !leaf_iterator_selector::value
+    && !detail::has_leaf_key_column<Traits>::value;
+  static const int optimistic_tries = 3;  // before falling back to the latches
+
+  template <class T>
+  class racy_copy
+  //  a copy, made by optimistic_copy(), of a T on a node that a writer may be changing
+  {
+  public:
+    explicit racy_copy(const T& x)  { optimistic_copy(&m_storage, &x, sizeof(T)); }
+    const T& get() const            { return *reinterpret_cast<const T*>(&m_storage); }
+  private:
+    typename boost::aligned_storage<sizeof(T), boost::alignment_of<T>::value>::type
+                     m_storage;
+  };
+
+  template <class Iterator>
+  std::size_t m_optimistic_lower_bound(Iterator first, std::size_t n,
+    const key_type& k) const
+  // returns: the offset, in elements, of the first of the n elements at first whose key
+  //   is not less than k, comparing racy copies of the keys
+  {
+    std::size_t low = 0;
+    while (n)  // as in std::lower_bound
+    {
+      std::size_t half = n / 2;
+      if (key_comp()(racy_copy<key_type>(m_element_key(*(first + (low + half)))).get(),
+        k))
+      {
+        low += half + 1;
+        n -= half + 1;
+      }
+      else
+        n = half;
+    }
+    return low;
+  }
+
+  bool m_optimistic_find(const key_type&, const_iterator&, false_type) const
+    {return false;}
+  bool m_optimistic_find(const key_type& k, const_iterator& result, true_type) const;
+  bool m_optimistic_count(const key_type&, size_type&, false_type) const
+    {return false;}
+  bool m_optimistic_count(const key_type& k, size_type& count, true_type) const;
+  // returns: true if the optimistic search settled the result, false if the search is
+  //   to be made with the latches
+
+  btree_node_ptr m_optimistic_leaf(const key_type& k, boost::uint32_t& version,
+    bool& links_current) const;
+  // returns: the leaf m_lower_bound_leaf(m_root, k) would return, or a null pointer if
+  //   the branches changed during the search; version is set to the m_tree_latch
+  //   version the search was made under
+  // postcondition: links_current is true if the parent links of the nodes on the
+  //   path were all set for the current branches, so that the leaf may be iterated
+  //   from; the search itself never sets them, since a writer may be changing them
+
+  void m_element_count_add(int n)
+  //  size() reads m_element_count, and m_write_header() copies it to the header. With
+  //  flags::concurrent_write, inserts and erases on different leaves run at once, so
+  //  header().element_count() is only updated when the header is written.
+  {
+    boost::uint64_t count
+      = m_element_count.fetch_add(n, boost::memory_order_relaxed) + n;
+    if (!m_concurrent_write)
+      m_hdr.element_count(count);
+  }
+
+  bool m_chain_current(btree_node* np) const;
+  // returns: true if no branch node has changed since np's parent chain was set, so the
+  //   chain up to the root is still valid
+
+  btree_node_ptr m_hint_start(const_iterator hint, const key_type& k, bool upper) const;
+  // returns: the lowest node on hint's parent chain whose subtree contains the search
+  //   path for k, where equal keys go to the right subtree if upper or the tree is
+  //   unique, as for m_special_upper_bound() and m_special_lower_bound() respectively;
+  //   m_root if hint is end() or its parent chain may be stale
+
+  const key_type& m_last_key(btree_node* np) const
+  {
+    BOOST_ASSERT(np->is_leaf() && !np->empty());
+    return key(*m_node_prior(np, np->leaf().begin(), np->leaf().end()));
+  }
+
+  //---------------------------------- slot directory ----------------------------------//
+
+  //  Elements with dynamic size can only be walked one at a time, so std::lower_bound()
+  //  on a node is linear in the node size, and so is each decrement. For such nodes a
+  //  slot directory, the offsets of the node's elements, is kept in the node buffer's
+  //  aux() storage. It is built on first use, and rebuilt after the node changes.
+  //  Searches and decrements use it to take logarithmic time.
+
+  typedef boost::uint16_t slot_type;  // element offset; node sizes fit in 16 bits
+
+  template <class Iterator>
+  static const slot_type* m_slots(btree_node* np, Iterator first, Iterator last)
+  // returns: pointer to the count of slots, followed by the slots
+  {
+    if (np->aux_begin())
+    {
+      std::size_t n = 0;
+      for (Iterator it = first; it != last; ++it)
+        ++n;
+      slot_type* slots = reinterpret_cast<slot_type*>(np->aux((n + 1) * sizeof(slot_type)));
+      slots[0] = static_cast<slot_type>(n);
+      ++slots;
+      const char* base = reinterpret_cast<const char*>(&*first);
+      for (Iterator it = first; it != last; ++it)
+        *slots++ = static_cast<slot_type>(reinterpret_cast<const char*>(&*it) - base);
+      np->aux_valid(true);
+    }
+    return reinterpret_cast<const slot_type*>(np->aux());
+  }
+
+  //  elements of fixed size are searched by the detail::node_search kernels if the
+  //  key is an integer compared by btree::less, and otherwise by the std algorithms
+
+  typedef detail::fast_search<Key, Comp>  fast_search;
+
+  static const Key& m_element_key(const Key& k)  { return k; }
+  template <class T>
+  static const Key& m_element_key(const T& v)    { return v.key(); }
+
+  //  with the leaf_key_column traits option, leaves are searched via a packed column of
+  //  their keys in native form, kept in the node's aux() storage
+
+  static const bool key_column = detail::has_leaf_key_column<Traits>::value;
+
+  template <class T>
+  static const char* m_key_column(btree_node* np,
+    detail::pointer_iterator<T> first, std::size_t n, std::size_t stride)
+  {
+    typedef typename fast_search::native_type native_type;
+    if (np->aux_begin())
+    {
+      native_type* keys = reinterpret_cast<native_type*>(
+        np->aux((n ? n : 1) * sizeof(native_type)));
+      const char* p = reinterpret_cast<const char*>(&m_element_key(*first));
+      for (std::size_t i = 0; i < n; ++i, p += stride)
+        keys[i] = fast_search::load(p);
+      np->aux_valid(true);
+    }
+    return np->aux();
+  }
+
+  template <class T, class K, class Compare>
+  static detail::pointer_iterator<T> m_node_lower_bound(btree_node* np,
+    detail::pointer_iterator<T> first, detail::pointer_iterator<T> last,
+    const K& k, Compare comp)
+  {
+    return m_node_lower_bound(np, first, last, k, comp,
+      integral_constant<bool, fast_search::value && is_same<K, Key>::value>());
+  }
+
+  template <class T, class K, class Compare>
+  static detail::pointer_iterator<T> m_node_lower_bound(btree_node*,
+    detail::pointer_iterator<T> first, detail::pointer_iterator<T> last,
+    const K& k, Compare comp, false_type)
+  {
+    return std::lower_bound(first, last, k, comp);
+  }
+
+  template <class T, class K, class Compare>
+  static detail::pointer_iterator<T> m_node_lower_bound(btree_node* np,
+    detail::pointer_iterator<T> first, detail::pointer_iterator<T> last,
+    const K& k, Compare, true_type)
+  {
+    typedef typename fast_search::native_type native_type;
+    if (first == last)
+      return first;
+    std::size_t stride = btree::dynamic_size(*first);
+    std::size_t n = (reinterpret_cast<const char*>(&*last)
+      - reinterpret_cast<const char*>(&*first)) / stride;
+    if (key_column && np->is_leaf())
+      return first + detail::node_lower_bound<
+        detail::fast_search<native_type, btree::less<native_type> > >(
+        m_key_column(np, first, n, stride),
+        sizeof(native_type), n, k);
+    return first + detail::node_lower_bound<fast_search>(
+      reinterpret_cast<const char*>(&m_element_key(*first)), stride, n, k);
+  }
+
+  template <class T, class K, class Compare>
+  static detail::dynamic_iterator<T> m_node_lower_bound(btree_node* np,
+    detail::dynamic_iterator<T> first, detail::dynamic_iterator<T> last,
+    const K& k, Compare comp)
+  {
+    const slot_type* slots = m_slots(np, first, last);
+    std::size_t n = *slots++;
+    const slot_type* low = slots;
+    while (n)  // binary search of the slots, as in std::lower_bound
+    {
+      std::size_t half = n / 2;
+      if (comp(*detail::dynamic_iterator<T>(&*first, low[half]), k))
+      {
+        low += half + 1;
+        n -= half + 1;
+      }
+      else
+        n = half;
+    }
+    return low == slots + slots[-1] ? last : detail::dynamic_iterator<T>(&*first, *low);
+  }
+
+  template <class T, class K, class Compare>
+  static detail::pointer_iterator<T> m_node_upper_bound(btree_node* np,
+    detail::pointer_iterator<T> first, detail::pointer_iterator<T> last,
+    const K& k, Compare comp)
+  {
+    return m_node_upper_bound(np, first, last, k, comp,
+      integral_constant<bool, fast_search::value && is_same<K, Key>::value>());
+  }
+
+  template <class T, class K, class Compare>
+  static detail::pointer_iterator<T> m_node_upper_bound(btree_node*,
+    detail::pointer_iterator<T> first, detail::pointer_iterator<T> last,
+    const K& k, Compare comp, false_type)
+  {
+    return std::upper_bound(first, last, k, comp);
+  }
+
+  template <class T, class K, class Compare>
+  static detail::pointer_iterator<T> m_node_upper_bound(btree_node* np,
+    detail::pointer_iterator<T> first, detail::pointer_iterator<T> last,
+    const K& k, Compare, true_type)
+  {
+    typedef typename fast_search::native_type native_type;
+    if (first == last)
+      return first;
+    std::size_t stride = btree::dynamic_size(*first);
+    std::size_t n = (reinterpret_cast<const char*>(&*last)
+      - reinterpret_cast<const char*>(&*first)) / stride;
+    if (key_column && np->is_leaf())
+      return first + detail::node_upper_bound<
+        detail::fast_search<native_type, btree::less<native_type> > >(
+        m_key_column(np, first, n, stride),
+        sizeof(native_type), n, k);
+    return first + detail::node_upper_bound<fast_search>(
+      reinterpret_cast<const char*>(&m_element_key(*first)), stride, n, k);
+  }
+
+  template <class T, class K, class Compare>
+  static detail::dynamic_iterator<T> m_node_upper_bound(btree_node* np,
+    detail::dynamic_iterator<T> first, detail::dynamic_iterator<T> last,
+    const K& k, Compare comp)
+  {
+    const slot_type* slots = m_slots(np, first, last);
+    std::size_t n = *slots++;
+    const slot_type* up = slots;
+    while (n)  // binary search of the slots, as in std::upper_bound
+    {
+      std::size_t half = n / 2;
+      if (!comp(k, *detail::dynamic_iterator<T>(&*first, up[half])))
+      {
+        up += half + 1;
+        n -= half + 1;
+      }
+      else
+        n = half;
+    }
+    return up == slots + slots[-1] ? last : detail::dynamic_iterator<T>(&*first, *up);
+  }
+
+  template <class T>
+  static detail::pointer_iterator<T> m_node_prior(btree_node*,
+    detail::pointer_iterator<T>, detail::pointer_iterator<T> it)
+  {
+    return --it;
+  }
+
+  template <class T>
+  static detail::dynamic_iterator<T> m_node_prior(btree_node* np,
+    detail::dynamic_iterator<T> first, detail::dynamic_iterator<T> it)
+  // requires: first is the node's begin(), and it != first
+  {
+    BOOST_ASSERT(it != first);
+    const slot_type* slots = m_slots(np, first,
+      detail::dynamic_iterator<T>(&*first, np->size()));
+    std::size_t n = *slots++;
+    slot_type offset = static_cast<slot_type>(
+      reinterpret_cast<const char*>(&*it) - reinterpret_cast<const char*>(&*first));
+    const slot_type* cur = std::lower_bound(slots, slots + n, offset);
+    BOOST_ASSERT(cur != slots);
+    return detail::dynamic_iterator<T>(&*first, *--cur);
+  }
+
+  const key_type& m_separator(const key_type& lo, const key_type& hi)
+  // requires: lo is the last key of a leaf, and hi is the first key of the next leaf
+  // returns: the key to insert in the parent branch to separate the two leaves; either
+  //   hi or a shorter key computed by shortest_separator() and valid until the next call
+  {
+    if (!boost::btree::has_dynamic_size<key_type>::value)
+      return hi;
+    shortest_separator(lo, hi, &m_separator_buf[0]);
+    const key_type& sep = *reinterpret_cast<const key_type*>(&m_separator_buf[0]);
+    return key_comp()(lo, sep) && !key_comp()(hi, sep) ? sep : hi;
+  }
+
+  btree_node_ptr m_new_node(boost::uint16_t lv, boost::uint32_t near_id);
+  // returns: a node for level lv, reusing the free node with the id closest to near_id
+  //   if there is one, otherwise appending a node to the file
+
+  //  Free nodes are tracked in memory by m_free_ids. The file holds the same set as a
+  //  chain of free map nodes, themselves free, headed by
+  //  header().free_node_list_head_id(). A free map node's elements are the id of the
+  //  next free map node, or 0, followed by size() ids of other free nodes. The chain is
+  //  read by m_open() and rewritten by flush() when m_free_ids has changed.
+
+  static const boost::uint16_t free_node_level = 0xFFFE;
+  static const boost::uint16_t free_map_level = 0xFFFD;
+
+  node_id_type* m_free_map_ids(btree_node* np)
+  {
+    return reinterpret_cast<node_id_type*>(np->data() + branch_data::value_offset());
+  }
+  std::size_t m_free_map_capacity() const  // free ids per free map node
+  {
+    return (m_hdr.node_size() - branch_data::value_offset()) / sizeof(node_id_type) - 1;
+  }
+  void  m_read_free_map();
+  void  m_write_free_map();
+
+  //  An overflow node's elements are the id of the next node of the chain, or 0,
+  //  followed by size() bytes of the value.
+
+  static const boost::uint16_t overflow_level = 0xFFFC;
+
+  static node_id_type* m_overflow_next(btree_node* np)
+  {
+    return reinterpret_cast<node_id_type*>(np->data() + branch_data::value_offset());
+  }
+  static char* m_overflow_data(btree_node* np)
+  {
+    return np->data() + branch_data::value_offset() + sizeof(node_id_type);
+  }
+  std::size_t m_overflow_capacity() const  // value bytes per overflow node
+  {
+    return m_hdr.node_size() - branch_data::value_offset() - sizeof(node_id_type);
+  }
+  void  m_free_overflow(boost::uint32_t id);
+
+  //  the first overflow node of a mapped value, or 0 for values other than blobs
+  static boost::uint32_t m_overflow_id(const blob& b)  { return b.overflow_id(); }
+  template <class T>
+  static boost::uint32_t m_overflow_id(const T&)       { return 0; }
+  static void m_overflow_id(blob& b, boost::uint32_t id)
+    { b = blob::overflow(id, b.size()); }
+  template <class T>
+  static void m_overflow_id(T&, boost::uint32_t)       {}
+
+  void  m_bulk_post(std::size_t lv, const key_type& k, node_id_type id);
   void  m_new_root();
   const_iterator m_leaf_insert(iterator insert_iter, const key_type& key,
     const mapped_type& mapped_value);
@@ -927,13 +1637,41 @@ private:
 
 iterator m_sub_tree_begin(node_id_type id);
 iterator m_erase_branch_value(btree_node* np, branch_iterator value, node_id_type erasee);
+  bool  m_underfull(btree_node* np) const
+  {
+    return m_min_fill && np->node_id() != m_root->node_id()
+      && np->size() * 100
+        < (np->is_leaf() ? m_max_leaf_size : m_max_branch_size) * m_min_fill;
+  }
+  const_iterator m_leaf_underflow(btree_node_ptr np, std::size_t offset);
+  bool  m_leaf_borrow(btree_node* left, btree_node* right, branch_iterator left_element,
+          btree_node* par)
+  {
+    return m_leaf_borrow(left, right, left_element, par,
+      typename boost::btree::has_dynamic_size<key_type>::type());
+  }
+  bool  m_leaf_borrow(btree_node*, btree_node*, branch_iterator, btree_node*, true_type)
+    {return false;}
+  bool  m_leaf_borrow(btree_node* left, btree_node* right, branch_iterator left_element,
+          btree_node* par, false_type);
+  void  m_branch_underflow(btree_node* np);
+  const_iterator m_reseat(btree_node_ptr np, std::size_t offset) const;
+  void  m_root_changed()  // after m_root is set; see m_optimistic_leaf()
+  {
+    m_optimistic_root_id.store(m_root->node_id(), boost::memory_order_relaxed);
+    m_optimistic_root.store(m_root.get(), boost::memory_order_release);
+  }
   void  m_free_node(btree_node* np)
   {
+    ++m_branch_version;
+    if (m_concurrent_write && np->is_branch())
+      m_mgr.unpin(np->node_id());  // see m_optimistic_leaf()
     np->needs_write(true);
-    np->level(0xFFFE);
+    np->retain(false);
+    np->level(free_node_level);
     np->size(0);
-    np->branch().begin()->node_id() = node_id_type(m_hdr.free_node_list_head_id());
-    m_hdr.free_node_list_head_id(np->node_id());
+    m_free_ids.insert(np->node_id());
+    m_free_map_changed = true;
   }
 
   //-------------------------------- branch_compare ------------------------------------//
@@ -998,7 +1736,9 @@ std::ostream& operator<<(std::ostream& os,
 
 template <class Key, class Base, class Traits, class Comp>
 btree_base<Key,Base,Traits,Comp>::btree_base(const Comp& comp)
-  : m_mgr(m_node_alloc), m_comp(comp), m_value_comp(comp), m_branch_comp(comp)
+  : m_mgr(m_node_alloc), m_min_fill(0), m_read_ahead(btree::default_read_ahead_nodes),
+    m_overflow_threshold(0), m_element_count(0), m_comp(comp), m_value_comp(comp),
+    m_branch_comp(comp)
 { 
   m_mgr.owner(this);
 
@@ -1012,7 +1752,9 @@ btree_base<Key,Base,Traits,Comp>::btree_base(const Comp& comp)
 template <class Key, class Base, class Traits, class Comp>
 btree_base<Key,Base,Traits,Comp>::btree_base(const boost::filesystem::path& p,
   flags::bitmask flgs, std::size_t node_sz, const Comp& comp)
-  : m_mgr(m_node_alloc), m_comp(comp), m_value_comp(comp), m_branch_comp(comp)
+  : m_mgr(m_node_alloc), m_min_fill(0), m_read_ahead(btree::default_read_ahead_nodes),
+    m_overflow_threshold(0), m_element_count(0), m_comp(comp), m_value_comp(comp),
+    m_branch_comp(comp)
 { 
   m_mgr.owner(this);
 
@@ -1040,6 +1782,7 @@ void btree_base<Key,Base,Traits,Comp>::close()
 {
   if (is_open())
   {
+    m_bulk_path.clear();
     flush();
     m_mgr.close();
   }
@@ -1062,27 +1805,72 @@ btree_base<Key,Base,Traits,Comp>::m_open(const boost::filesystem::path& p,
     open_flags |= oflag::out | oflag::truncate;
   if (flgs & flags::preload)
     open_flags |= oflag::preload;
+  if (flgs & flags::mapped)
+  {
+    if (open_flags & oflag::out)
+      BOOST_BTREE_THROW(std::runtime_error(p.string()
+        + ": flags::mapped requires flags::read_only"));
+    open_flags |= oflag::mapped;
+  }
+  if (flgs & flags::async_io)
+    open_flags |= oflag::async_io;
+  if (flgs & flags::concurrent_read)
+  {
+    if (open_flags & oflag::out)
+      BOOST_BTREE_THROW(std::runtime_error(p.string()
+        + ": flags::concurrent_read requires flags::read_only"));
+    open_flags |= oflag::concurrent;
+  }
+  if (flgs & flags::concurrent_write)
+  {
+    if (!(open_flags & oflag::out))
+      BOOST_BTREE_THROW(std::runtime_error(p.string()
+        + ": flags::concurrent_write requires flags::read_write or flags::truncate"));
+    open_flags |= oflag::concurrent;
+  }
 
   m_read_only = (open_flags & oflag::out) == 0;
-  m_ok_to_pack = true;
+  m_concurrent_write = (flgs & flags::concurrent_write) != 0;
+  m_open_flags = flgs;
+  m_node_merges = m_node_borrows = 0;
+  m_free_ids.clear();
+  m_free_map_changed = false;
+  m_branch_version = 0;
   m_max_leaf_size = node_sz - leaf_data::value_offset();
   m_max_branch_size = node_sz - branch_data::value_offset();
 
+  m_mgr.replacement((flgs & flags::scan_resistant) ? buffer_manager::two_queue
+                                                   : buffer_manager::lru);
+
   if (m_mgr.open(p, open_flags, btree::default_max_cache_nodes, node_sz))
   { // existing non-truncated file
     m_read_header();
+    m_element_count = m_hdr.element_count();
     if (!m_hdr.marker_ok())
       BOOST_BTREE_THROW(std::runtime_error(file_path().string()+" isn't a btree"));
     if (m_hdr.big_endian() != (Traits::header_endianness == integer::endianness::big))
       BOOST_BTREE_THROW(std::runtime_error(file_path().string()+" has wrong endianness"));
+    if (m_hdr.major_version() != btree::major_version
+      || m_hdr.minor_version() > btree::minor_version)
+      BOOST_BTREE_THROW(std::runtime_error(file_path().string()
+        +" has an unsupported file format version"));
     m_mgr.data_size(m_hdr.node_size());
+    m_max_leaf_size = m_hdr.node_size() - leaf_data::value_offset();
+    m_max_branch_size = m_hdr.node_size() - branch_data::value_offset();
     m_root = m_mgr.read(m_hdr.root_node_id());
+    m_root->parent(btree_node_ptr(), branch_iterator());
+    m_root_changed();
+    if (!m_read_only)
+      m_read_free_map();
   }
   else
   { // new or truncated file
     m_hdr.clear();
+    m_element_count = 0;
     m_hdr.big_endian(Traits::header_endianness == integer::endianness::big);
-    m_hdr.flags(flgs & ~(btree::flags::read_write | btree::flags::truncate));
+    m_hdr.flags(flgs & ~(btree::flags::read_write | btree::flags::truncate
+      | btree::flags::scan_resistant | btree::flags::mapped | btree::flags::async_io
+      | btree::flags::concurrent_read | btree::flags::concurrent_write));
     m_hdr.splash_c_str("boost.org btree");
     m_hdr.user_c_str("");
     m_hdr.node_size(node_sz);
@@ -1095,6 +1883,7 @@ btree_base<Key,Base,Traits,Comp>::m_open(const boost::filesystem::path& p,
     // set up an empty leaf as the initial root
     m_root = m_mgr.new_buffer();
     m_root->needs_write(true);
+    m_root_changed();
     m_hdr.increment_node_count();
     BOOST_ASSERT(m_root->node_id() == 1);
     m_hdr.root_node_id(m_root->node_id());
@@ -1103,6 +1892,7 @@ btree_base<Key,Base,Traits,Comp>::m_open(const boost::filesystem::path& p,
     m_root->level(0);
     m_root->size(0);
   }
+  m_separator_buf.resize(m_hdr.node_size());
 //  m_set_max_cache_nodes();
 }
 
@@ -1116,12 +1906,15 @@ btree_base<Key,Base,Traits,Comp>::clear()
 
   manager().clear_write_needed();
   m_hdr.element_count(0);
+  m_element_count = 0;
   m_hdr.root_node_id(1);
   m_hdr.first_node_id(1);
   m_hdr.last_node_id(1);
   m_hdr.root_level(0);
   m_hdr.node_count(0);
   m_hdr.free_node_list_head_id(0);
+  m_free_ids.clear();
+  m_free_map_changed = false;
 
   m_mgr.close();
 
@@ -1143,11 +1936,7 @@ btree_base<Key,Base,Traits,Comp>::begin() const
   {
     // create the child->parent list
     btree_node_ptr child_np = m_mgr.read(np->branch().begin()->node_id());
-    child_np->parent(np);
-    child_np->parent_element(np->branch().begin());
-#   ifndef NDEBUG
-    child_np->parent_node_id(np->node_id());
-#   endif
+    child_np->parent(np, np->branch().begin());
 
     np = child_np;
   }
@@ -1164,24 +1953,41 @@ btree_base<Key,Base,Traits,Comp>::last() const
   BOOST_ASSERT_MSG(is_open(), "last() on unopen btree");
   if (empty())
     return end();
-  BOOST_ASSERT(header().last_node_id());
-  btree_node_ptr np(m_mgr.read(header().last_node_id()));
-  BOOST_ASSERT(np->is_leaf());
-  return const_iterator(np, np->leaf().end()-1);
+  btree_node_ptr np = m_root;
+
+  // work down the tree along the last children, so that the leaf's parent links are
+  // set for decrements past its first element
+  while (np->is_branch())
+  {
+    btree_node_ptr child_np = m_mgr.read(np->branch().end()->node_id());
+    child_np->parent(np, np->branch().end());
+
+    np = child_np;
+  }
+
+  BOOST_ASSERT(np->node_id() == header().last_node_id());
+  return const_iterator(np, m_node_prior(np.get(), np->leaf().begin(), np->leaf().end()));
 }
 
 //---------------------------------- m_new_node() --------------------------------------//
 
 template <class Key, class Base, class Traits, class Comp>   
 typename btree_base<Key,Base,Traits,Comp>::btree_node_ptr 
-btree_base<Key,Base,Traits,Comp>::m_new_node(boost::uint16_t lv)
+btree_base<Key,Base,Traits,Comp>::m_new_node(boost::uint16_t lv,
+  boost::uint32_t near_id)
 {
   btree_node_ptr np;
-  if (m_hdr.free_node_list_head_id())
+  if (!m_free_ids.empty())
   {
-    np = m_mgr.read(m_hdr.free_node_list_head_id());
-    BOOST_ASSERT(np->level() == 0xFFFE);  // free node list entry
-    m_hdr.free_node_list_head_id(np->branch().begin()->node_id());
+    //  take the free id closest to near_id, so that a node split off from near_id
+    //  lands near it in the file; the old contents aren't needed, so aren't read
+    std::set<boost::uint32_t>::iterator it = m_free_ids.lower_bound(near_id);
+    if (it == m_free_ids.end()
+      || (it != m_free_ids.begin() && near_id - *boost::prior(it) < *it - near_id))
+      --it;
+    np = m_mgr.reuse(*it);
+    m_free_ids.erase(it);
+    m_free_map_changed = true;
   }
   else
   {
@@ -1193,9 +1999,158 @@ btree_base<Key,Base,Traits,Comp>::m_new_node(boost::uint16_t lv)
   np->needs_write(true);
   np->level(lv);
   np->size(0);
+  np->clear_run();
   return np;
 }
 
+//-------------------------------- m_read_free_map() -----------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+void
+btree_base<Key,Base,Traits,Comp>::m_read_free_map()
+{
+  for (boost::uint32_t id = m_hdr.free_node_list_head_id(); id;)
+  {
+    btree_node_ptr np = m_mgr.read(id);
+    m_free_ids.insert(id);
+    if (np->level() == free_map_level)
+    {
+      node_id_type* ids = m_free_map_ids(np.get());
+      for (std::size_t i = 1; i <= np->size(); ++i)
+        m_free_ids.insert(ids[i]);
+      id = ids[0];
+    }
+    else
+    {
+      //  a file written before free map nodes were introduced chains every free node;
+      //  the chain is replaced by free map nodes at the next flush
+      BOOST_ASSERT(np->level() == free_node_level);
+      id = np->branch().begin()->node_id();
+      m_free_map_changed = true;
+    }
+  }
+}
+
+//-------------------------------- m_write_free_map() ----------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+void
+btree_base<Key,Base,Traits,Comp>::m_write_free_map()
+{
+  //  the free ids are written in ascending order, with the first of each run of
+  //  m_free_map_capacity() + 1 ids serving as the free map node for the rest of the run
+  std::size_t capacity = m_free_map_capacity();
+  m_hdr.minor_version(btree::minor_version);  // a version 1 file is now version 2
+  m_hdr.free_node_list_head_id(m_free_ids.empty() ? 0 : *m_free_ids.begin());
+  std::set<boost::uint32_t>::const_iterator it = m_free_ids.begin();
+  while (it != m_free_ids.end())
+  {
+    btree_node_ptr np = m_mgr.reuse(*it++);
+    node_id_type* ids = m_free_map_ids(np.get());
+    std::size_t n = 0;
+    for (; n < capacity && it != m_free_ids.end(); ++n)
+      ids[n + 1] = *it++;
+    ids[0] = it == m_free_ids.end() ? 0 : *it;
+    np->level(free_map_level);
+    np->size(n);
+    np->retain(false);
+  }
+  m_free_map_changed = false;
+}
+
+//----------------------------------- make_blob() -------------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+blob
+btree_base<Key,Base,Traits,Comp>::make_blob(const void* p, std::size_t sz)
+{
+  BOOST_ASSERT_MSG(is_open(), "make_blob() on unopen btree");
+  BOOST_ASSERT_MSG(!read_only(), "make_blob() on read only btree");
+  if (sz <= overflow_threshold())
+    return blob(p, sz);
+  rw_latch::guard tree(m_tree_latch, m_concurrent_write);  // allocates nodes
+
+  //  the chain is placed toward the end of the file, each node near its predecessor,
+  //  keeping overflow nodes away from the leaves they are referenced by
+  const char* cp = static_cast<const char*>(p);
+  std::size_t capacity = m_overflow_capacity();
+  boost::uint32_t first_id = 0;
+  btree_node_ptr prior;
+  for (std::size_t remaining = sz; remaining;)
+  {
+    btree_node_ptr np = m_new_node(overflow_level,
+      prior ? prior->node_id() : m_hdr.node_count());
+    std::size_t n = std::min(remaining, capacity);
+    std::memcpy(m_overflow_data(np.get()), cp, n);
+    np->size(n);
+    *m_overflow_next(np.get()) = 0;
+    if (prior)
+      *m_overflow_next(prior.get()) = np->node_id();
+    else
+      first_id = np->node_id();
+    prior = np;
+    cp += n;
+    remaining -= n;
+  }
+  return blob::overflow(first_id, sz);
+}
+
+//----------------------------------- read_blob() -------------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+void
+btree_base<Key,Base,Traits,Comp>::read_blob(const blob& b, void* target) const
+{
+  BOOST_ASSERT_MSG(is_open(), "read_blob() on unopen btree");
+  if (!b.is_overflow())
+  {
+    std::memcpy(target, b.data(), b.size());
+    return;
+  }
+  char* cp = static_cast<char*>(target);
+  for (boost::uint32_t id = b.overflow_id(); id;)
+  {
+    btree_node_ptr np = m_mgr.read(id);
+    BOOST_ASSERT(np->level() == overflow_level);
+    std::memcpy(cp, m_overflow_data(np.get()), np->size());
+    cp += np->size();
+    id = *m_overflow_next(np.get());
+  }
+  BOOST_ASSERT(static_cast<std::size_t>(cp - static_cast<char*>(target)) == b.size());
+}
+
+//----------------------------------- free_blob() -------------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+void
+btree_base<Key,Base,Traits,Comp>::free_blob(const blob& b)
+{
+  BOOST_ASSERT_MSG(is_open(), "free_blob() on unopen btree");
+  BOOST_ASSERT_MSG(!read_only(), "free_blob() on read only btree");
+  if (b.is_overflow())
+  {
+    rw_latch::guard tree(m_tree_latch, m_concurrent_write);
+    m_free_overflow(b.overflow_id());
+  }
+}
+
+//-------------------------------- m_free_overflow() -----------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+void
+btree_base<Key,Base,Traits,Comp>::m_free_overflow(boost::uint32_t id)
+{
+  boost::uint32_t version = m_branch_version;
+  while (id)
+  {
+    btree_node_ptr np = m_mgr.read(id);
+    BOOST_ASSERT(np->level() == overflow_level);
+    id = *m_overflow_next(np.get());
+    m_free_node(np.get());
+  }
+  m_branch_version = version;  // overflow nodes are not on any search path
+}
+
 //----------------------------------- m_new_root() -------------------------------------//
 
 template <class Key, class Base, class Traits, class Comp>   
@@ -1203,11 +2158,13 @@ void
 btree_base<Key,Base,Traits,Comp>::m_new_root()
 { 
   // create a new root containing only the P0 pseudo-element
+  ++m_branch_version;
   btree_node_ptr old_root = m_root;
   node_id_type old_root_id(m_root->node_id());
   m_hdr.increment_root_level();
 //  m_set_max_cache_nodes();
-  m_root = m_new_node(m_hdr.root_level());
+  m_root = m_new_node(m_hdr.root_level(), old_root_id);
+  m_root_changed();
   m_hdr.root_node_id(m_root->node_id());
   m_root->branch().begin()->node_id() = old_root_id;
   m_root->size(0);  // the end pseudo-element doesn't count as an element
@@ -1241,7 +2198,7 @@ btree_base<Key,Base,Traits,Comp>::m_leaf_insert(iterator insert_iter,
   BOOST_ASSERT_MSG(np->is_leaf(), "internal error");
   BOOST_ASSERT_MSG(np->size() <= m_max_leaf_size, "internal error");
 
-  m_hdr.increment_element_count();
+  m_element_count_add(1);
   np->needs_write(true);
 
   if (np->size() + value_size > m_max_leaf_size)  // no room on node?
@@ -1251,33 +2208,40 @@ btree_base<Key,Base,Traits,Comp>::m_leaf_insert(iterator insert_iter,
     if (np->level() == m_hdr.root_level()) // splitting the root?
       m_new_root();  // create a new root
     
-    np2 = m_new_node(np->level());  // create the new node 
-
-    // ck pack conditions now, since leaf seq list update may chg header().last_node_id()
-    if (m_ok_to_pack
-        && (insert_begin != np->leaf().end() || np->node_id() != header().last_node_id()))
-      m_ok_to_pack = false;  // conditions for pack optimization not met
+    np2 = m_new_node(np->level(), np->node_id());  // create the new node 
 
     if (np->node_id() == header().last_node_id())
       m_hdr.last_node_id(np2->node_id());
 
-    // apply pack optimization if applicable
-    if (m_ok_to_pack)  // have all inserts been ordered and no erases occurred?
+    // apply pack optimization if the insert continues an ascending run on np, such as
+    // appends at the end of the tree, or at the end of any one key range within it
+    bool in_run = np->continues_run(char_distance(&*np->leaf().begin(), &*insert_begin));
+    if (in_run && insert_begin == np->leaf().end())
     {
       // pack optimization: instead of splitting np, just put value alone on np2
       m_memcpy_value(&*np2->leaf().begin(), &key_, key_size, &mapped_value_, mapped_size);  // insert value
       np2->size(value_size);
+      np2->run_end(value_size);
       BOOST_ASSERT(np->parent()->node_id() == np->parent_node_id()); // max_cache_size logic OK?
       m_branch_insert(np->parent(), np->parent_element(),
-        key(*np2->leaf().begin()), np2->node_id());
+        m_separator(m_last_key(np.get()), key(*np2->leaf().begin())),
+        np2->node_id());
       return const_iterator(np2, np2->leaf().begin());
     }
 
-    // split node np by moving half the elements, by size, to node p2
+    // split node np by moving half the elements, by size, to node p2, or, if the insert
+    // continues a run ending within np, the elements after the insert point, so that
+    // the run fills np
     leaf_iterator split_begin(np->leaf().begin());
-    split_begin.advance_by_size(np->leaf().size() / 2);
-    ++split_begin; // for leaves, prefer more aggressive split begin
-    std::size_t split_sz = char_distance(&*split_begin, &*np->leaf().end());
+    std::size_t split_sz = char_distance(&*insert_begin, &*np->leaf().end());
+    if (in_run && np->size() - split_sz + value_size <= m_max_leaf_size)
+      split_begin = insert_begin;
+    else
+    {
+      split_begin.advance_by_size(np->leaf().size() / 2);
+      ++split_begin; // for leaves, prefer more aggressive split begin
+      split_sz = char_distance(&*split_begin, &*np->leaf().end());
+    }
 
     // TODO: if the insert point will fall on the new node, it would be faster to
     // copy the portion before the insert point, copy the value being inserted, and
@@ -1308,6 +2272,7 @@ btree_base<Key,Base,Traits,Comp>::m_leaf_insert(iterator insert_iter,
 //          << std::endl;
   BOOST_ASSERT(&*insert_begin >= &*np->leaf().begin());
   BOOST_ASSERT(&*insert_begin <= &*np->leaf().end());
+  np->run_end(char_distance(&*np->leaf().begin(), &*insert_begin) + value_size);
   std::memmove(char_ptr(&*insert_begin) + value_size,
     &*insert_begin, char_distance(&*insert_begin, &*np->leaf().end()));  // make room
   m_memcpy_value(&*insert_begin, &key_, key_size, &mapped_value_, mapped_size);  // insert value
@@ -1321,7 +2286,8 @@ btree_base<Key,Base,Traits,Comp>::m_leaf_insert(iterator insert_iter,
       == insert_iter.m_node->parent_node_id()); // max_cache_size logic OK?
     m_branch_insert(insert_iter.m_node->parent(),
       insert_iter.m_node->parent_element(),
-      key(*np2->leaf().begin()), np2->node_id());
+      m_separator(m_last_key(insert_iter.m_node.get()), key(*np2->leaf().begin())),
+      np2->node_id());
   }
 
 //std::cout << "***insert done" << std::endl;
@@ -1353,6 +2319,7 @@ btree_base<Key,Base,Traits,Comp>::m_branch_insert(
   BOOST_ASSERT(np->is_branch());
   BOOST_ASSERT(np->size() <= m_max_branch_size);
 
+  ++m_branch_version;
   np->needs_write(true);
 
   if (np->size() + insert_size
@@ -1366,16 +2333,31 @@ btree_base<Key,Base,Traits,Comp>::m_branch_insert(
     if (np->level() == m_hdr.root_level()) // splitting the root?
       m_new_root();  // create a new root
     
-    np2 = m_new_node(np->level());  // create the new node
+    np2 = m_new_node(np->level(), np->node_id());  // create the new node
 
-    // split node np by moving half the elements, by size, to node p2
+    // split node np by moving half the elements, by size, to node p2, or, if the
+    // insert continues an ascending run on np, the elements after the insert point,
+    // so that the run fills np. At the end, only the end pseudo-element is left to
+    // move, so the insert goes on p2 instead.
 
     branch_iterator unsplit_end(np->branch().begin());
-    unsplit_end.advance_by_size(np->branch().size() / 2);
+    bool in_run = np->continues_run(char_distance(&*np->branch().begin(), insert_begin));
+    if (in_run && element == np->branch().end())
+    {
+      for (branch_iterator nxt = boost::next(unsplit_end); nxt != np->branch().end();
+        ++nxt)
+        unsplit_end = nxt;
+    }
+    else if (in_run
+      && char_distance(&*np->branch().begin(), insert_begin) + insert_size
+           + sizeof(node_id_type) <= m_max_branch_size)
+      unsplit_end = element;
+    else
+      unsplit_end.advance_by_size(np->branch().size() / 2);
     branch_iterator split_begin(unsplit_end+1);
     std::size_t split_sz = char_distance(&*split_begin, char_ptr(&*np->branch().end()) 
       + sizeof(node_id_type));  // include the end pseudo-element node_id
-    BOOST_ASSERT(split_sz > sizeof(node_id_type));
+    BOOST_ASSERT(split_sz >= sizeof(node_id_type));
 
     // TODO: if the insert point will fall on the new node, it would be faster to
     // copy the portion before the insert point, copy the value being inserted, and
@@ -1432,6 +2414,7 @@ btree_base<Key,Base,Traits,Comp>::m_branch_insert(
 //          << std::endl;
   BOOST_ASSERT(insert_begin >= &np->branch().begin()->key());
   BOOST_ASSERT(insert_begin <= &np->branch().end()->key());
+  np->run_end(char_distance(&*np->branch().begin(), insert_begin) + insert_size);
   BOOST_ASSERT(char_ptr(insert_begin) + insert_size            // start of memmove
     + char_distance(insert_begin, &np->branch().end()->key())  // + size of memmove
     <= char_ptr(&*np->branch().begin()) + m_max_branch_size);
@@ -1472,9 +2455,10 @@ btree_base<Key,Base,Traits,Comp>::erase(const_iterator pos)
   BOOST_ASSERT(&*pos.m_element < &*pos.m_node->leaf().end());
   BOOST_ASSERT(&*pos.m_element >= &*pos.m_node->leaf().begin());
 
-  m_ok_to_pack = false;  // TODO: is this too conservative?
+  if (boost::uint32_t overflow_id = m_overflow_id(this->mapped(*pos)))
+    m_free_overflow(overflow_id);
   pos.m_node->needs_write(true);
-  m_hdr.decrement_element_count();
+  m_element_count_add(-1);
 
   //key_type nxt_key;  // save next key to be able to find() iterator to be returned
   //const_iterator nxt(pos);
@@ -1503,10 +2487,14 @@ btree_base<Key,Base,Traits,Comp>::erase(const_iterator pos)
       m_hdr.last_node_id(prr_node->node_id());
     }
 
+    boost::uint32_t merges = m_node_merges;
     const_iterator nxt = m_erase_branch_value(pos.m_node->parent(),
       pos.m_node->parent_element(), pos.m_node->node_id());
 
     m_free_node(pos.m_node.get());  // add node to free node list
+    if (m_node_merges != merges && nxt != end())  // nxt's parents may have been merged
+      nxt = m_reseat(nxt.m_node,
+        char_distance(&*nxt.m_node->leaf().begin(), &*nxt.m_element));
     return nxt;
   }
   else
@@ -1523,6 +2511,10 @@ btree_base<Key,Base,Traits,Comp>::erase(const_iterator pos)
     pos.m_node->size(pos.m_node->size() - erase_sz);
     std::memset(&*pos.m_node->leaf().end(), 0, erase_sz);
 
+    if (m_underfull(pos.m_node.get()))
+      return m_leaf_underflow(pos.m_node,
+        char_distance(&*pos.m_node->leaf().begin(), &*pos.m_element));
+
     if (pos.m_element != pos.m_node->leaf().end())
       return pos;
     btree_node_ptr next_node(pos.m_node->next_node());
@@ -1530,6 +2522,135 @@ btree_base<Key,Base,Traits,Comp>::erase(const_iterator pos)
   }
 }
 
+//------------------------------------ compact() ---------------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>
+void btree_base<Key,Base,Traits,Comp>::compact(unsigned fill_percent)
+{
+  BOOST_ASSERT_MSG(is_open(), "compact() on unopen btree");
+  BOOST_ASSERT_MSG(!read_only(), "compact() on read only btree");
+  BOOST_ASSERT_MSG(fill_percent >= 1 && fill_percent <= 100,
+    "compact() fill_percent must be 1 to 100");
+
+  boost::filesystem::path p(file_path());
+  boost::filesystem::path load_p(p.string() + ".load");
+  boost::filesystem::path compact_p(p.string() + ".compact");
+  std::size_t node_sz = node_size();
+  std::size_t cache_sz = max_cache_size();
+
+  {
+    //  bulk load a copy at the target fill factor, then relocate its nodes
+    btree_base tmp(load_p, flags::bitmask(header().flags() | flags::truncate), node_sz,
+      key_comp());
+    tmp.max_cache_size(cache_sz);
+    tmp.m_bulk_begin(fill_percent);
+    for (const_iterator it = begin(); it != end(); ++it)
+      tmp.m_bulk_push(key(*it), mapped(*it));
+    tmp.m_bulk_end();
+    tmp.m_relocate(compact_p, *this);  // blobs still refer to this btree's nodes
+  }
+
+  close();
+  boost::filesystem::remove(load_p);
+  boost::filesystem::rename(compact_p, p);
+  m_open(p, flags::bitmask((m_open_flags & ~flags::truncate) | flags::read_write),
+    node_sz);
+  max_cache_size(cache_sz);
+}
+
+//------------------------------------ m_relocate() ------------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>
+void btree_base<Key,Base,Traits,Comp>::m_relocate(const boost::filesystem::path& p,
+  const btree_base& overflow_src)
+{
+  flush();
+  std::size_t node_sz = node_size();
+
+  //  order holds the current node ids, in the order they will be written: breadth
+  //  first from the root, which puts the leaves last and in key order
+
+  std::vector<boost::uint32_t> order(1, m_hdr.root_node_id());
+  std::size_t level_begin = 0;
+  for (unsigned lv = m_hdr.root_level(); lv > 0; --lv)
+  {
+    std::size_t level_end = order.size();
+    for (std::size_t i = level_begin; i < level_end; ++i)
+    {
+      btree_node_ptr np = m_mgr.read(order[i]);
+      BOOST_ASSERT(np->level() == lv);
+      for (branch_iterator it = np->branch().begin();; ++it)
+      {
+        order.push_back(it->node_id());
+        if (it == np->branch().end())
+          break;
+      }
+    }
+    level_begin = level_end;
+  }
+
+  std::vector<boost::uint32_t> new_id(m_hdr.node_count(), 0);
+  for (std::size_t i = 0; i < order.size(); ++i)
+    new_id[order[i]] = i + 1;  // node 0 is the header
+
+  binary_file out(p, oflag::in | oflag::out | oflag::truncate);
+  std::vector<char> node(node_sz);
+  std::vector<char> overflow_node(node_sz);
+  boost::uint32_t next_overflow_id = order.size() + 1;  // overflow chains follow the tree
+  for (std::size_t i = 0; i < order.size(); ++i)
+  {
+    btree_node_ptr np = m_mgr.read(order[i]);
+    std::memcpy(&node[0], np->data(), node_sz);
+    if (np->is_branch())
+    {
+      branch_data& copy = *reinterpret_cast<branch_data*>(&node[0]);
+      for (branch_iterator it = copy.begin();; ++it)
+      {
+        it->node_id() = node_id_type(new_id[it->node_id()]);
+        if (it == copy.end())
+          break;
+      }
+    }
+    else if (boost::btree::has_dynamic_size<mapped_type>::value)
+    {
+      //  copy each overflow chain, renumbering it to follow those already copied
+      leaf_data& copy = *reinterpret_cast<leaf_data*>(&node[0]);
+      for (leaf_iterator it = copy.begin(); it != copy.end(); ++it)
+      {
+        boost::uint32_t id = m_overflow_id(this->mapped(*it));
+        if (!id)
+          continue;
+        m_overflow_id(const_cast<mapped_type&>(this->mapped(*it)), next_overflow_id);
+        for (; id; ++next_overflow_id)
+        {
+          btree_node_ptr op = overflow_src.m_mgr.read(id);
+          BOOST_ASSERT(op->level() == overflow_level);
+          id = *m_overflow_next(op.get());
+          std::memcpy(&overflow_node[0], op->data(), node_sz);
+          *reinterpret_cast<node_id_type*>(&overflow_node[branch_data::value_offset()])
+            = id ? next_overflow_id + 1 : 0;
+          out.write_at(static_cast<binary_file::offset_type>(next_overflow_id) * node_sz,
+            &overflow_node[0], node_sz);
+        }
+      }
+    }
+    out.write_at(static_cast<binary_file::offset_type>(i + 1) * node_sz,
+      &node[0], node_sz);
+  }
+
+  btree::header_page hdr(m_hdr);
+  hdr.root_node_id(1);
+  hdr.first_node_id(new_id[m_hdr.first_node_id()]);
+  hdr.last_node_id(new_id[m_hdr.last_node_id()]);
+  hdr.node_count(next_overflow_id);
+  hdr.free_node_list_head_id(0);
+  hdr.endian_flip_if_needed();
+  std::fill(node.begin(), node.end(), 0);
+  std::memcpy(&node[0], &hdr, sizeof(btree::header_page));
+  out.write_at(0, &node[0], node_sz);
+  out.close();
+}
+
 //----------------------------------- m_sub_tree_begin() -------------------------------//
 
 template <class Key, class Base, class Traits, class Comp>
@@ -1545,11 +2666,7 @@ btree_base<Key,Base,Traits,Comp>::m_sub_tree_begin(node_id_type id)
   {
     // create the child->parent list
     btree_node_ptr child_np = m_mgr.read(np->branch().begin()->node_id());
-    child_np->parent(np);
-    child_np->parent_element(np->branch().begin());
-#   ifndef NDEBUG
-    child_np->parent_node_id(np->node_id());
-#   endif
+    child_np->parent(np, np->branch().begin());
 
     np = child_np;
   }
@@ -1569,6 +2686,7 @@ btree_base<Key,Base,Traits,Comp>::m_erase_branch_value(
   BOOST_ASSERT(&*element <= &*np->branch().end());  // equal to end if pseudo-element only
   BOOST_ASSERT(erasee == element->node_id());
 
+  ++m_branch_version;
   if (np->empty()) // end pseudo-element only element on node?
                    // i.e. after the erase, the entire sub-tree will be empty
   {
@@ -1622,20 +2740,248 @@ btree_base<Key,Base,Traits,Comp>::m_erase_branch_value(
       m_hdr.decrement_root_level();
       m_root = m_mgr.read(header().root_node_id());
       m_root->parent(btree_node_ptr());
+      m_root_changed();
       m_root->parent_element(branch_iterator());
       m_free_node(np); // move node to free node list
       np = m_root.get();
     }
+
+    if (m_underfull(np))
+      m_branch_underflow(np);
     return next_itr;
   }
 }
 
+//-------------------------------- m_leaf_underflow() ----------------------------------//
+
+//  Merges underfull leaf np with an adjacent sibling having the same parent, or if they
+//  will not both fit on one node, moves elements from the sibling to even them out.
+//  Returns an iterator to the element that was at offset on np, or the element after
+//  the last element of np if offset is np's size.
+
+template <class Key, class Base, class Traits, class Comp>
+typename btree_base<Key,Base,Traits,Comp>::const_iterator
+btree_base<Key,Base,Traits,Comp>::m_leaf_underflow(btree_node_ptr np, std::size_t offset)
+{
+  BOOST_ASSERT(np->is_leaf());
+  BOOST_ASSERT(np->parent()->node_id() == np->parent_node_id()); // max_cache_size logic OK?
+
+  ++m_branch_version;
+  btree_node_ptr   par(*np->parent());
+  branch_iterator  left_element;  // par element pointing to the left node
+  btree_node_ptr   left, right;
+
+  if (np->parent_element() != par->branch().end())
+  {
+    left = np;
+    left_element = np->parent_element();
+    right = m_mgr.read(boost::next(left_element)->node_id());
+    right->parent(par);
+    right->parent_element(boost::next(left_element));
+#   ifndef NDEBUG
+    right->parent_node_id(par->node_id());
+#   endif
+  }
+  else if (np->parent_element() != par->branch().begin())
+  {
+    right = np;
+    left_element = m_node_prior(par.get(), par->branch().begin(), np->parent_element());
+    left = m_mgr.read(left_element->node_id());
+    left->parent(par);
+    left->parent_element(left_element);
+#   ifndef NDEBUG
+    left->parent_node_id(par->node_id());
+#   endif
+    offset += left->size();  // offset is now relative to the merged sequence
+  }
+  else  // np is the only child
+    return m_reseat(np, offset);
+  std::size_t np_offset = np.get() == left.get() ? offset : offset - left->size();
+
+  std::size_t left_sz = left->size();
+  std::size_t right_sz = right->size();
+
+  if (left_sz + right_sz <= m_max_leaf_size)
+  {
+    //  merge right into left, then remove right from the tree
+
+    node_id_type next_id(0);
+    if (right->node_id() != header().last_node_id())
+      next_id = right->next_node()->node_id();
+    else
+      m_hdr.last_node_id(left->node_id());
+
+    std::memcpy(&*left->leaf().end(), &*right->leaf().begin(), right_sz);
+    left->size(left_sz + right_sz);
+    left->needs_write(true);
+    ++m_node_merges;
+
+    m_erase_branch_value(par.get(), boost::next(left_element), right->node_id());
+    m_free_node(right.get());
+
+    if (offset < left->size())
+      return m_reseat(left, offset);
+    return next_id ? m_reseat(m_mgr.read(next_id), 0) : end();
+  }
+
+  if (!m_leaf_borrow(left.get(), right.get(), left_element, par.get()))
+    return m_reseat(np, np_offset);
+
+  return offset < left->size() ? m_reseat(left, offset)
+                               : m_reseat(right, offset - left->size());
+}
+
+//---------------------------------- m_leaf_borrow() -----------------------------------//
+
+//  Moves elements from the fuller of adjacent leaves left and right, whose parent par
+//  points to left at left_element, so the two are about the same size, then replaces
+//  the separator. Returns false if no elements were moved. Keys of dynamic size are not
+//  borrowed, since the new separator might not fit in par; those leaves are only merged.
+
+template <class Key, class Base, class Traits, class Comp>
+bool btree_base<Key,Base,Traits,Comp>::m_leaf_borrow(btree_node* left, btree_node* right,
+  branch_iterator left_element, btree_node* par, false_type)
+{
+  std::size_t left_sz = left->size();
+  std::size_t right_sz = right->size();
+
+  if (left_sz < right_sz)
+  {
+    leaf_iterator split(right->leaf().begin());
+    split.advance_by_size((right_sz - left_sz) / 2);
+    std::size_t move_sz = char_distance(&*right->leaf().begin(), &*split);
+    if (!move_sz)
+      return false;
+    std::memcpy(&*left->leaf().end(), &*right->leaf().begin(), move_sz);
+    std::memmove(&*right->leaf().begin(), &*split, right_sz - move_sz);
+    std::memset(char_ptr(&*right->leaf().begin()) + right_sz - move_sz, 0, move_sz);
+    left->size(left_sz + move_sz);
+    right->size(right_sz - move_sz);
+  }
+  else
+  {
+    leaf_iterator split(left->leaf().begin());
+    split.advance_by_size((left_sz + right_sz) / 2);
+    if (split == left->leaf().begin())
+      ++split;  // left must keep at least one element
+    std::size_t move_sz = char_distance(&*split, &*left->leaf().end());
+    if (!move_sz)
+      return false;
+    std::memmove(char_ptr(&*right->leaf().begin()) + move_sz, &*right->leaf().begin(),
+      right_sz);
+    std::memcpy(&*right->leaf().begin(), &*split, move_sz);
+    std::memset(&*split, 0, move_sz);
+    left->size(left_sz - move_sz);
+    right->size(right_sz + move_sz);
+  }
+  left->needs_write(true);
+  right->needs_write(true);
+  ++m_node_borrows;
+
+  left_element->key() = key(*right->leaf().begin());
+  par->needs_write(true);
+
+  return true;
+}
+
+//------------------------------- m_branch_underflow() ---------------------------------//
+
+//  Merges underfull branch np with an adjacent sibling having the same parent, if the
+//  two and the separator between them will fit on one node. The branch node format
+//  makes the separator the key between the left node's end pseudo-element and the
+//  right node's first element.
+
+template <class Key, class Base, class Traits, class Comp>
+void btree_base<Key,Base,Traits,Comp>::m_branch_underflow(btree_node* np)
+{
+  BOOST_ASSERT(np->is_branch());
+  BOOST_ASSERT(np->parent()->node_id() == np->parent_node_id()); // max_cache_size logic OK?
+
+  ++m_branch_version;
+  btree_node_ptr   par(*np->parent());
+  branch_iterator  left_element;
+  btree_node_ptr   left, right;
+
+  if (np->parent_element() != par->branch().end())
+  {
+    left = btree_node_ptr(*np);
+    left_element = np->parent_element();
+    right = m_mgr.read(boost::next(left_element)->node_id());
+  }
+  else if (np->parent_element() != par->branch().begin())
+  {
+    right = btree_node_ptr(*np);
+    left_element = m_node_prior(par.get(), par->branch().begin(), np->parent_element());
+    left = m_mgr.read(left_element->node_id());
+  }
+  else  // np is the only child
+    return;
+
+  const key_type& sep = left_element->key();
+  std::size_t sep_sz = dynamic_size(sep);
+  std::size_t merged_sz = left->size() + sizeof(node_id_type) + sep_sz + right->size();
+  if (merged_sz + sizeof(node_id_type) > m_max_branch_size)
+    return;
+
+  //  append the separator and right's elements, including its end pseudo-element
+  char* dest = char_ptr(&*left->branch().end()) + sizeof(node_id_type);
+  std::memcpy(dest, &sep, sep_sz);
+  std::memcpy(dest + sep_sz, &*right->branch().begin(), right->size() + sizeof(node_id_type));
+  left->size(merged_sz);
+  left->needs_write(true);
+  ++m_node_merges;
+
+  left->parent(par);
+  left->parent_element(left_element);
+# ifndef NDEBUG
+  left->parent_node_id(par->node_id());
+# endif
+  m_erase_branch_value(par.get(), boost::next(left_element), right->node_id());
+  m_free_node(right.get());
+}
+
+//------------------------------------ m_reseat() --------------------------------------//
+
+//  Returns an iterator to the element at offset on leaf np, or end() if offset is np's
+//  size and np is the last leaf. Parent information cached in the nodes may be stale
+//  after nodes are merged, so the iterator is found by searching from the root.
+
+template <class Key, class Base, class Traits, class Comp>
+typename btree_base<Key,Base,Traits,Comp>::const_iterator
+btree_base<Key,Base,Traits,Comp>::m_reseat(btree_node_ptr np, std::size_t offset) const
+{
+  BOOST_ASSERT(np->is_leaf());
+  if (offset == np->size())
+  {
+    if (np->node_id() == header().last_node_id())
+      return end();
+    //  the successor is the first element of the next leaf; find it via the last
+    //  element of np
+    BOOST_ASSERT(!np->empty());
+    const_iterator it = m_reseat(np,
+      offset - dynamic_size(*m_node_prior(np.get(), np->leaf().begin(),
+        np->leaf().end())));
+    return ++it;
+  }
+
+  leaf_iterator element(&*np->leaf().begin(), offset);
+  const_iterator it = lower_bound(key(*element));
+  while (it.m_node->node_id() != np->node_id() || &*it.m_element != &*element)
+  {
+    BOOST_ASSERT(it != end());
+    ++it;
+  }
+  return it;
+}
+
 template <class Key, class Base, class Traits, class Comp>   
 typename btree_base<Key,Base,Traits,Comp>::size_type
 btree_base<Key,Base,Traits,Comp>::erase(const key_type& k)
 {
   BOOST_ASSERT_MSG(is_open(), "erase() on unopen btree");
   BOOST_ASSERT_MSG(!read_only(), "erase() on read only btree");
+  if (m_concurrent_write)
+    return m_concurrent_erase(k);
   size_type count = 0;
   const_iterator it = lower_bound(k);
     
@@ -1653,6 +2999,14 @@ btree_base<Key,Base,Traits,Comp>::erase(const_iterator first, const_iterator las
 {
   BOOST_ASSERT_MSG(is_open(), "erase() on unopen btree");
   BOOST_ASSERT_MSG(!read_only(), "erase() on read only btree");
+  if (m_min_fill)
+  {
+    // merges and borrows move elements between nodes, so last may not stay valid
+    for (std::ptrdiff_t n = std::distance(first, last); n; --n)
+      first = erase(first);
+    return first;
+  }
+
   // caution: last must be revalidated when on the same node as first
   while (first != last)
   {
@@ -1670,14 +3024,16 @@ btree_base<Key,Base,Traits,Comp>::erase(const_iterator first, const_iterator las
 
 template <class Key, class Base, class Traits, class Comp>   
 std::pair<typename btree_base<Key,Base,Traits,Comp>::const_iterator, bool>
-btree_base<Key,Base,Traits,Comp>::m_insert_unique(const key_type& k,
-  const mapped_type& mv)
+btree_base<Key,Base,Traits,Comp>::m_insert_unique(const_iterator hint,
+  const key_type& k, const mapped_type& mv)
 {
   BOOST_ASSERT_MSG(is_open(), "insert() on unopen btree");
   BOOST_ASSERT_MSG(!read_only(), "insert() on read only btree");
   //BOOST_ASSERT_MSG(dynamic_size(k) + (&k != &mv ? dynamic_size(mv) : 0)
   //  < node_size()/3, "insert() value size too large for node size");
-  iterator insert_point = m_special_lower_bound(k);
+  if (m_concurrent_write)
+    return m_concurrent_insert(k, mv, true);  // hint is ignored
+  iterator insert_point = m_special_lower_bound(m_hint_start(hint, k, false), k);
 
   bool is_unique = insert_point.m_element == insert_point.m_node->leaf().end()
                 || key_comp()(k, key(*insert_point))
@@ -1694,17 +3050,305 @@ btree_base<Key,Base,Traits,Comp>::m_insert_unique(const key_type& k,
 
 template <class Key, class Base, class Traits, class Comp>   
 inline typename btree_base<Key,Base,Traits,Comp>::const_iterator
-btree_base<Key,Base,Traits,Comp>::m_insert_non_unique(const key_type& k,
-  const mapped_type& mv)
+btree_base<Key,Base,Traits,Comp>::m_insert_non_unique(const_iterator hint,
+  const key_type& k, const mapped_type& mv)
 {
   BOOST_ASSERT_MSG(is_open(), "insert() on unopen btree");
   BOOST_ASSERT_MSG(!read_only(), "insert() on read only btree");
   //BOOST_ASSERT_MSG(dynamic_size(k) + (&k != &mv ? dynamic_size(mv) : 0)
   //  < node_size()/3, "insert() value size too large for node size");
-  iterator insert_point = m_special_upper_bound(k);
+  if (m_concurrent_write)
+    return m_concurrent_insert(k, mv, false).first;  // hint is ignored
+  iterator insert_point = m_special_upper_bound(m_hint_start(hint, k, true), k);
   return m_leaf_insert(insert_point, k, mv);
 }
 
+//------------------------------- m_concurrent_insert() --------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+std::pair<typename btree_base<Key,Base,Traits,Comp>::const_iterator, bool>
+btree_base<Key,Base,Traits,Comp>::m_concurrent_insert(const key_type& k,
+  const mapped_type& mv, bool unique)
+{
+  std::size_t value_size = dynamic_size(k)
+    + ((header().flags() & btree::flags::key_only) ? 0 : dynamic_size(mv));
+  {
+    rw_latch::shared_guard tree(m_tree_latch);
+    btree_node_ptr np = unique ? m_lower_bound_leaf(m_root, k)
+                               : m_upper_bound_leaf(m_root, k);
+    rw_latch::guard leaf(np->latch());
+    leaf_iterator pos = unique
+      ? m_node_lower_bound(np.get(), np->leaf().begin(), np->leaf().end(), k,
+          value_comp())
+      : m_node_upper_bound(np.get(), np->leaf().begin(), np->leaf().end(), k,
+          value_comp());
+
+    if (unique && pos != np->leaf().end() && !key_comp()(k, key(*pos)))
+      return std::pair<const_iterator, bool>(const_iterator(np, pos), false);
+    if (np->size() + value_size <= m_max_leaf_size)  // no split, so only np changes
+      return std::pair<const_iterator, bool>(m_leaf_insert(iterator(np, pos), k, mv),
+        true);
+  }
+
+  rw_latch::guard tree(m_tree_latch);
+  iterator insert_point = unique ? m_special_lower_bound(k) : m_special_upper_bound(k);
+  if (unique && insert_point.m_element != insert_point.m_node->leaf().end()
+    && !key_comp()(k, key(*insert_point)))
+    return std::pair<const_iterator, bool>(
+      const_iterator(insert_point.m_node, insert_point.m_element), false);
+  return std::pair<const_iterator, bool>(m_leaf_insert(insert_point, k, mv), true);
+}
+
+//------------------------------- m_concurrent_erase() ---------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+typename btree_base<Key,Base,Traits,Comp>::size_type
+btree_base<Key,Base,Traits,Comp>::m_concurrent_erase(const key_type& k)
+{
+  const bool unique = (header().flags() & btree::flags::unique) != 0;
+  {
+    rw_latch::shared_guard tree(m_tree_latch);
+    btree_node_ptr np = m_lower_bound_leaf(m_root, k);
+    rw_latch::guard leaf(np->latch());
+    leaf_iterator first = m_node_lower_bound(np.get(),
+      np->leaf().begin(), np->leaf().end(), k, value_comp());
+
+    size_type count = 0;
+    std::size_t erase_sz = 0;
+    bool overflow = false;
+    leaf_iterator last = first;
+    for (; last != np->leaf().end() && !key_comp()(k, key(*last)); ++last)
+    {
+      ++count;
+      erase_sz += dynamic_size(*last);
+      overflow = overflow || m_overflow_id(this->mapped(*last)) != 0;
+    }
+
+    //  the erase stays within np unless equal keys may continue on the next leaf, or
+    //  np would be left empty or underfull, or overflow nodes would be freed
+    std::size_t remaining = np->size() - erase_sz;
+    bool is_root = np->node_id() == m_root->node_id();
+    if ((last != np->leaf().end() || unique)
+      && !overflow
+      && (is_root || (remaining && !(m_min_fill
+            && remaining * 100 < m_max_leaf_size * m_min_fill))))
+    {
+      for (size_type i = 0; i < count; ++i)
+        erase(const_iterator(np, first));
+      return count;
+    }
+  }
+
+  rw_latch::guard tree(m_tree_latch);
+  size_type count = 0;
+  const_iterator it = lower_bound(k);
+  while (it != end() && !key_comp()(k, key(*it)))
+  {
+    ++count;
+    it = erase(it);
+  }
+  return count;
+}
+
+//-------------------------------- m_concurrent_find() ---------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+typename btree_base<Key,Base,Traits,Comp>::const_iterator
+btree_base<Key,Base,Traits,Comp>::m_concurrent_find(const key_type& k) const
+{
+  const_iterator result;
+  if (m_optimistic_find(k, result, integral_constant<bool, optimistic_reads>()))
+    return result;
+
+  rw_latch::shared_guard tree(m_tree_latch);
+  btree_node_ptr np = m_lower_bound_leaf(m_root, k);
+  rw_latch::shared_guard leaf(np->latch());
+  leaf_iterator low = m_node_lower_bound(np.get(),
+    np->leaf().begin(), np->leaf().end(), k, value_comp());
+  if (low != np->leaf().end())
+    return !key_comp()(k, key(*low)) ? const_iterator(np, low) : end();
+  if (header().flags() & btree::flags::unique)
+    return end();
+
+  //  in a non-unique tree, equal keys may begin on the next leaf
+  btree_node_ptr nxt = np->next_node();
+  if (!nxt)
+    return end();
+  rw_latch::shared_guard nxt_leaf(nxt->latch());
+  return !nxt->empty() && !key_comp()(k, key(*nxt->leaf().begin()))
+    ? const_iterator(nxt, nxt->leaf().begin())
+    : end();
+}
+
+//-------------------------------- m_concurrent_count() --------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+typename btree_base<Key,Base,Traits,Comp>::size_type
+btree_base<Key,Base,Traits,Comp>::m_concurrent_count(const key_type& k) const
+{
+  size_type count = 0;
+  if (m_optimistic_count(k, count, integral_constant<bool, optimistic_reads>()))
+    return count;
+
+  rw_latch::shared_guard tree(m_tree_latch);
+  count = 0;
+  btree_node_ptr np = m_lower_bound_leaf(m_root, k);
+  for (bool first_leaf = true; np; first_leaf = false)
+  {
+    {
+      rw_latch::shared_guard leaf(np->latch());
+      leaf_iterator it = first_leaf
+        ? m_node_lower_bound(np.get(), np->leaf().begin(), np->leaf().end(), k,
+            value_comp())
+        : np->leaf().begin();
+      for (; it != np->leaf().end() && !key_comp()(k, key(*it)); ++it)
+        ++count;
+      if (it != np->leaf().end())
+        break;
+    }
+    np = np->next_node();
+  }
+  return count;
+}
+
+//---------------------------------- m_bulk_begin() ------------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+void
+btree_base<Key,Base,Traits,Comp>::m_bulk_begin(unsigned fill_percent)
+{
+  BOOST_ASSERT_MSG(is_open(), "bulk_load() on unopen btree");
+  BOOST_ASSERT_MSG(!read_only(), "bulk_load() on read only btree");
+  BOOST_ASSERT_MSG(empty(), "bulk_load() requires an empty btree");
+  BOOST_ASSERT_MSG(fill_percent > 0 && fill_percent <= 100,
+    "bulk_load() fill percent must be 1 to 100");
+  BOOST_ASSERT(m_root->is_leaf());
+
+  m_bulk_leaf_limit = m_max_leaf_size * fill_percent / 100;
+  m_bulk_branch_limit = m_max_branch_size * fill_percent / 100;
+  m_bulk_new_nodes = 0;
+
+  // the empty root leaf becomes the first leaf
+  m_bulk_path.clear();
+  m_bulk_path.push_back(m_root);
+  m_bulk_last = leaf_iterator();
+}
+
+//---------------------------------- m_bulk_push() -------------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+bool
+btree_base<Key,Base,Traits,Comp>::m_bulk_push(const key_type& k, const mapped_type& mv)
+{
+  BOOST_ASSERT_MSG(!m_bulk_path.empty(), "m_bulk_push() without m_bulk_begin()");
+
+  btree_node_ptr np = m_bulk_path.front();
+
+  if (!np->empty())
+  {
+    const key_type& prior_key = key(*m_bulk_last);
+    if (key_comp()(k, prior_key))
+      BOOST_BTREE_THROW(std::runtime_error(file_path().string()
+        + ": bulk_load() input not in key order"));
+    if ((m_hdr.flags() & btree::flags::unique) && !key_comp()(prior_key, k))
+      return false;  // duplicate key
+  }
+
+  std::size_t key_size = dynamic_size(k);
+  std::size_t mapped_size = (header().flags() & btree::flags::key_only)
+    ? 0
+    : dynamic_size(mv);
+  std::size_t value_size = key_size + mapped_size;
+
+  m_element_count_add(1);
+
+  if (!np->empty() && np->size() + value_size > m_bulk_leaf_limit)
+  {
+    // start a new leaf, and post the separator between it and the prior leaf to the
+    // level above
+    np = m_new_node(0, np->node_id());
+    if (++m_bulk_new_nodes >= m_mgr.max_cache_size() / 2)
+    {
+      // write full nodes as large sequential writes rather than one at a time as
+      // the cache evicts them
+      m_mgr.flush();
+      m_bulk_new_nodes = 0;
+    }
+    m_hdr.last_node_id(np->node_id());
+    m_memcpy_value(&*np->leaf().begin(), &k, key_size, &mv, mapped_size);
+    np->size(value_size);
+    const key_type& separator = m_separator(key(*m_bulk_last), key(*np->leaf().begin()));
+    m_bulk_path.front() = np;  // the prior leaf, and thus m_bulk_last, may now go away
+    m_bulk_last = np->leaf().begin();
+    m_bulk_post(1, separator, np->node_id());
+    return true;
+  }
+
+  np->needs_write(true);
+  m_bulk_last = np->leaf().end();
+  m_memcpy_value(&*m_bulk_last, &k, key_size, &mv, mapped_size);
+  np->size(np->size() + value_size);
+  return true;
+}
+
+//---------------------------------- m_bulk_post() -------------------------------------//
+
+//  Append k and the node id it separates to the rightmost node at level lv
+
+template <class Key, class Base, class Traits, class Comp>   
+void
+btree_base<Key,Base,Traits,Comp>::m_bulk_post(std::size_t lv, const key_type& k,
+  node_id_type id)
+{
+  ++m_branch_version;
+  if (lv > m_hdr.root_level())
+  {
+    // the root at level lv-1 has a new sibling, so the tree grows a level; the
+    // new root's P0 is the old root
+    m_new_root();
+    m_bulk_path.push_back(m_root);
+  }
+  BOOST_ASSERT(lv < m_bulk_path.size());
+
+  btree_node_ptr np = m_bulk_path[lv];
+  std::size_t k_size = dynamic_size(k);
+
+  BOOST_ASSERT(np->is_branch());
+
+  if (!np->empty()
+    && np->size() + k_size + sizeof(node_id_type)
+       + sizeof(node_id_type)  // NOTE WELL: size() doesn't include
+                               // size of the end pseudo-element node_id
+      > m_bulk_branch_limit)
+  {
+    // start a new branch whose P0 is id; k moves up to separate it from np
+    np = m_new_node(lv, np->node_id());
+    ++m_bulk_new_nodes;
+    np->branch().begin()->node_id() = id;
+    m_bulk_path[lv] = np;
+    m_bulk_post(lv+1, k, np->node_id());
+    return;
+  }
+
+  //  k goes in the end pseudo-element's key position, and id becomes the new
+  //  end pseudo-element
+  np->needs_write(true);
+  std::memcpy(&np->branch().end()->key(), &k, k_size);
+  np->size(np->size() + sizeof(node_id_type) + k_size);
+  np->branch().end()->node_id() = id;
+}
+
+//----------------------------------- m_bulk_end() -------------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+void
+btree_base<Key,Base,Traits,Comp>::m_bulk_end()
+{
+  m_bulk_path.clear();
+  m_bulk_last = leaf_iterator();
+  flush();
+}
+
 //----------------------------------- m_update() ---------------------------------------//
 
 template <class Key, class Base, class Traits, class Comp>   
@@ -1714,19 +3358,73 @@ btree_base<Key,Base,Traits,Comp>::m_update(iterator itr,
 {
   BOOST_ASSERT_MSG(is_open(), "update() on unopen btree");
   BOOST_ASSERT_MSG(!read_only(), "update() on read only btree");
-  BOOST_ASSERT_MSG(dynamic_size(new_mapped_value) == dynamic_size(itr->mapped_value()),
-    "update() size of the new mapped value not equal size of the old mapped value");
+  BOOST_ASSERT_MSG(!(header().flags() & btree::flags::key_only),
+    "update() on a set");
+  std::size_t new_size = dynamic_size(new_mapped_value);
+  std::size_t old_size = dynamic_size(itr->mapped_value());
+  boost::uint32_t old_overflow_id = m_overflow_id(itr->mapped_value());
+  if (old_overflow_id && old_overflow_id != m_overflow_id(new_mapped_value))
+    m_free_overflow(old_overflow_id);
   itr.m_node->needs_write(true);
-  std::memcpy(const_cast<mapped_type*>(&itr->mapped_value()),
-    &new_mapped_value, dynamic_size(new_mapped_value));
-  return itr;
+  if (new_size == old_size)
+  {
+    std::memcpy(const_cast<mapped_type*>(&itr->mapped_value()),
+      &new_mapped_value, new_size);
+    return itr;
+  }
+
+  //  The size differs, so remove the element and insert it again at the same position,
+  //  letting m_leaf_insert() split the leaf if the new value doesn't fit. A split uses
+  //  the leaf's parent chain, which must be re-established if it may be stale.
+  std::size_t offset = char_distance(&*itr.m_node->leaf().begin(), &*itr.m_element);
+  if (itr.m_node->size() - old_size + new_size > m_max_leaf_size
+    && !m_chain_current(itr.m_node.get()))
+    itr = m_reseat(itr.m_node, offset);
+
+  btree_node_ptr np = itr.m_node;
+  std::size_t value_size = dynamic_size(*itr.m_element);
+  std::vector<char> key_copy(dynamic_size(key(*itr)));  // the key is about to move
+  std::memcpy(&key_copy[0], &key(*itr), key_copy.size());
+  char* element = char_ptr(&*itr.m_element);
+  std::memmove(element, element + value_size,
+    np->size() - offset - value_size);
+  np->size(np->size() - value_size);
+  m_element_count_add(-1);  // m_leaf_insert() increments it
+
+  return m_leaf_insert(iterator(np, leaf_iterator(&*np->leaf().begin(), offset)),
+    *reinterpret_cast<const key_type*>(&key_copy[0]), new_mapped_value);
+}
+
+//------------------------------- m_insert_or_assign() ---------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+std::pair<typename btree_base<Key,Base,Traits,Comp>::const_iterator, bool>
+btree_base<Key,Base,Traits,Comp>::m_insert_or_assign(const_iterator hint,
+  const key_type& k, const mapped_type& mv)
+{
+  BOOST_ASSERT_MSG(is_open(), "insert_or_assign() on unopen btree");
+  BOOST_ASSERT_MSG(!read_only(), "insert_or_assign() on read only btree");
+  iterator insert_point = m_special_lower_bound(m_hint_start(hint, k, false), k);
+
+  //  for unique containers an equivalent element can only be at insert_point; for
+  //  non-unique containers the first one may begin the next leaf
+  const_iterator low = (header().flags() & btree::flags::unique)
+    || insert_point.m_element != insert_point.m_node->leaf().end()
+      ? insert_point
+      : m_to_lower_bound(insert_point);
+  if (low != end() && low.m_element != low.m_node->leaf().end()
+    && !key_comp()(k, key(*low)))
+    return std::pair<const_iterator, bool>(m_update(low, mv), false);
+
+  return std::pair<const_iterator, bool>(m_leaf_insert(insert_point, k, mv), true);
 }
 
 //----------------------------- m_special_lower_bound() --------------------------------//
 
 template <class Key, class Base, class Traits, class Comp>   
 typename btree_base<Key,Base,Traits,Comp>::iterator
-btree_base<Key,Base,Traits,Comp>::m_special_lower_bound(const key_type& k) const
+btree_base<Key,Base,Traits,Comp>::m_special_lower_bound(btree_node_ptr np,
+  const key_type& k) const
 //  m_special_lower_bound() differs from lower_bound() in that if the search key is not
 //  present and the first key greater than the search key is the first key on a leaf
 //  other than the first leaf, the returned iterator points to the end element of
@@ -1749,36 +3447,187 @@ btree_base<Key,Base,Traits,Comp>::m_special_lower_bound(const key_type& k) const
 //   parent_element
 //  Child node:  P0 P1 P1 P2 P2 P3 P3
 {
-  btree_node_ptr np = m_root;
+  np = m_lower_bound_leaf(np, k);
+
+  //  search leaf
+  leaf_iterator low = m_node_lower_bound(np.get(),
+    np->leaf().begin(), np->leaf().end(), k, value_comp());
+
+  return iterator(np, low);
+}
+
+//------------------------------- m_lower_bound_child() --------------------------------//
 
+template <class Key, class Base, class Traits, class Comp>   
+typename btree_base<Key,Base,Traits,Comp>::branch_iterator
+btree_base<Key,Base,Traits,Comp>::m_lower_bound_child(btree_node* np,
+  const key_type& k) const
+{
+  branch_iterator low = m_node_lower_bound(np,
+    np->branch().begin(), np->branch().end(), k, branch_comp());
+
+  if ((header().flags() & btree::flags::unique)
+    && low != np->branch().end()
+    && !key_comp()(k, low->key())) // if k isn't less that low->key(), it is equal
+    ++low;                         // and so must be incremented; this follows from
+                                   // the branch node invariant for unique containers
+  return low;
+}
+
+//------------------------------- m_lower_bound_leaf() ---------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+typename btree_base<Key,Base,Traits,Comp>::btree_node_ptr
+btree_base<Key,Base,Traits,Comp>::m_lower_bound_leaf(btree_node_ptr np,
+  const key_type& k) const
+{
   // search branches down the tree until a leaf is reached
   while (np->is_branch())
   {
-    branch_iterator low
-      = std::lower_bound(np->branch().begin(), np->branch().end(), k, branch_comp());
-
-    if ((header().flags() & btree::flags::unique)
-      && low != np->branch().end()
-      && !key_comp()(k, low->key())) // if k isn't less that low->key(), it is equal
-      ++low;                         // and so must be incremented; this follows from
-                                     // the branch node invariant for unique containers
+    branch_iterator low = m_lower_bound_child(np.get(), k);
 
     // create the child->parent list
     btree_node_ptr child_np = m_mgr.read(low->node_id());
-    child_np->parent(np);
-    child_np->parent_element(low);
-#   ifndef NDEBUG
-    child_np->parent_node_id(np->node_id());
-#   endif
+    child_np->parent(np, low);
 
     np = child_np;
   }
+  return np;
+}
 
-  //  search leaf
-  leaf_iterator low
-    = std::lower_bound(np->leaf().begin(), np->leaf().end(), k, value_comp());
+//------------------------------- m_optimistic_find() ----------------------------------//
 
-  return iterator(np, low);
+template <class Key, class Base, class Traits, class Comp>   
+bool btree_base<Key,Base,Traits,Comp>::m_optimistic_find(const key_type& k,
+  const_iterator& result, true_type) const
+{
+  for (int i = 0; i < optimistic_tries; ++i)
+  {
+    boost::uint32_t version;
+    bool links_current;
+    btree_node_ptr np = m_optimistic_leaf(k, version, links_current);
+    if (!np)
+      continue;
+    boost::uint32_t leaf_version = np->latch().version_begin();
+    std::size_t sz = racy_copy<btree_data>(np->leaf()).get().size();
+    leaf_iterator first = np->leaf().begin();
+    std::size_t n = std::min(sz, m_max_leaf_size) / dynamic_size(*first);
+    std::size_t low = m_optimistic_lower_bound(first, n, k);
+    bool at_end = low == n;
+    bool found = !at_end
+      && !key_comp()(k, racy_copy<key_type>(m_element_key(*(first + low))).get());
+    if (!np->latch().version_valid(leaf_version) || !m_tree_latch.version_valid(version))
+      continue;
+    if (found && !links_current)
+      break;  // the iterator needs parent links, which the latched search sets
+    if (found)
+      result = const_iterator(np, first + low);
+    else if (!at_end || (header().flags() & btree::flags::unique))
+      result = end();
+    else
+      break;  // equal keys may begin on the next leaf, so take the latches
+    return true;
+  }
+  return false;
+}
+
+//------------------------------- m_optimistic_count() ---------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+bool btree_base<Key,Base,Traits,Comp>::m_optimistic_count(const key_type& k,
+  size_type& count, true_type) const
+{
+  for (int i = 0; i < optimistic_tries; ++i)
+  {
+    boost::uint32_t version;
+    bool links_current;  // not needed, since no iterator is returned
+    btree_node_ptr np = m_optimistic_leaf(k, version, links_current);
+    if (!np)
+      continue;
+    boost::uint32_t leaf_version = np->latch().version_begin();
+    std::size_t sz = racy_copy<btree_data>(np->leaf()).get().size();
+    leaf_iterator first = np->leaf().begin();
+    std::size_t n = std::min(sz, m_max_leaf_size) / dynamic_size(*first);
+    std::size_t pos = m_optimistic_lower_bound(first, n, k);
+    count = 0;
+    for (; pos != n
+      && !key_comp()(k, racy_copy<key_type>(m_element_key(*(first + pos))).get()); ++pos)
+      ++count;
+    bool at_end = pos == n;
+    if (!np->latch().version_valid(leaf_version) || !m_tree_latch.version_valid(version))
+      continue;
+    if (!at_end || (header().flags() & btree::flags::unique))
+      return true;
+    break;  // equal keys may continue on the next leaf, so take the latches
+  }
+  return false;
+}
+
+//------------------------------- m_optimistic_leaf() ----------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+typename btree_base<Key,Base,Traits,Comp>::btree_node_ptr
+btree_base<Key,Base,Traits,Comp>::m_optimistic_leaf(const key_type& k,
+  boost::uint32_t& version, bool& links_current) const
+{
+  //  a structural change may be in progress, so what is read of a node is copied
+  //  first, and a node id is only followed once validated. The root, held by m_root,
+  //  and the branches pinned in the cache are reached without the cache's mutexes and
+  //  use counts; a branch not yet pinned is read through the cache and pinned, and
+  //  m_free_node() unpins it. Only the leaf, which is returned, is always read through
+  //  the cache. A node freed and reused meanwhile stays valid memory until close(), and
+  //  reading it fails the validation.
+  version = m_tree_latch.version_begin();
+  boost::uint32_t branch_version = racy_copy<boost::uint32_t>(m_branch_version).get();
+  btree_node* np = m_optimistic_root.load(boost::memory_order_acquire);
+  btree_node_ptr held;  // np, if read through the cache
+  links_current = true;
+
+  for (;;)
+  {
+    racy_copy<btree_data> data(np->leaf());
+    unsigned level = data.get().level();
+    std::size_t sz = data.get().size();
+    if (!level)  // the root is a leaf
+    {
+      boost::uint32_t id = m_optimistic_root_id.load(boost::memory_order_relaxed);
+      if (!m_tree_latch.version_valid(version))
+        return btree_node_ptr();
+      return m_mgr.read(id);
+    }
+    if (!data.get().is_branch() || sz + sizeof(node_id_type) > m_max_branch_size)
+      return btree_node_ptr();  // torn; the validation would fail
+
+    branch_iterator first = np->branch().begin();
+    std::size_t n = sz / dynamic_size(*first);
+    std::size_t low = m_optimistic_lower_bound(first, n, k);
+    if ((header().flags() & btree::flags::unique)
+      && low != n
+      && !key_comp()(k, racy_copy<key_type>((first + low)->key()).get()))
+      ++low;
+    node_id_type id = racy_copy<node_id_type>((first + low)->node_id()).get();
+    if (!m_tree_latch.version_valid(version))
+      return btree_node_ptr();
+
+    if (level == 1)
+      held = m_mgr.read(id);
+    else if (btree_node* pinned = static_cast<btree_node*>(m_mgr.pinned(id)))
+    {
+      held.reset();
+      np = pinned;
+    }
+    else
+    {
+      held = m_mgr.read(id);
+      m_mgr.pin(*held);
+    }
+    if (held)
+      np = held.get();
+    if (!np->links_current(branch_version))
+      links_current = false;
+    if (level == 1)
+      return held;
+  }
 }
 
 //---------------------------------- lower_bound() -------------------------------------//
@@ -1788,9 +3637,26 @@ typename btree_base<Key,Base,Traits,Comp>::const_iterator
 btree_base<Key,Base,Traits,Comp>::lower_bound(const key_type& k) const
 {
   BOOST_ASSERT_MSG(is_open(), "lower_bound() on unopen btree");
+  return m_to_lower_bound(m_special_lower_bound(k));
+}
 
-  const_iterator low = m_special_lower_bound(k);
+//------------------------------- lower_bound(hint, k) ---------------------------------//
 
+template <class Key, class Base, class Traits, class Comp>   
+typename btree_base<Key,Base,Traits,Comp>::const_iterator
+btree_base<Key,Base,Traits,Comp>::lower_bound(const_iterator hint,
+  const key_type& k) const
+{
+  BOOST_ASSERT_MSG(is_open(), "lower_bound() on unopen btree");
+  return m_to_lower_bound(m_special_lower_bound(m_hint_start(hint, k, false), k));
+}
+
+//--------------------------------- m_to_lower_bound() ---------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+typename btree_base<Key,Base,Traits,Comp>::const_iterator
+btree_base<Key,Base,Traits,Comp>::m_to_lower_bound(const_iterator low) const
+{
   if (low.m_element != low.m_node->leaf().end())
     return low;
 
@@ -1805,36 +3671,235 @@ btree_base<Key,Base,Traits,Comp>::lower_bound(const key_type& k) const
   return np ? const_iterator(np, np->leaf().begin()) : end();
 }
 
+//---------------------------------- m_chain_current() ---------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+bool
+btree_base<Key,Base,Traits,Comp>::m_chain_current(btree_node* np) const
+{
+  for (; np->parent(); np = np->parent())
+    if (np->parent_version() != m_branch_version)
+      return false;
+  return np->node_id() == m_root->node_id();
+}
+
+//----------------------------------- m_hint_start() -----------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+typename btree_base<Key,Base,Traits,Comp>::btree_node_ptr
+btree_base<Key,Base,Traits,Comp>::m_hint_start(const_iterator hint, const key_type& k,
+  bool upper) const
+{
+  if (!hint.m_node || hint == end())
+    return m_root;
+
+  if (!m_chain_current(hint.m_node.get()))
+    return m_root;
+
+  //  Climb until a node's key range is known to contain k. The range of a node is
+  //  bounded by the keys on either side of its parent element; on a side without
+  //  such a key, the bound is the parent's, so is checked on the next level up.
+  const bool right = upper || (header().flags() & btree::flags::unique);
+  btree_node_ptr start(hint.m_node);
+  bool need_low = true;
+  bool need_high = true;
+  for (btree_node* np = hint.m_node.get(); np->parent() && (need_low || need_high);
+    np = np->parent())
+  {
+    btree_node* par = np->parent();
+    branch_iterator pe = np->parent_element();
+    bool ok = true;
+    if (need_high && pe != par->branch().end())
+    {
+      ok = right ? key_comp()(k, pe->key()) : !key_comp()(pe->key(), k);
+      need_high = false;
+    }
+    if (ok && need_low && pe != par->branch().begin())
+    {
+      branch_iterator prior = m_node_prior(par, par->branch().begin(), pe);
+      ok = right ? !key_comp()(k, prior->key()) : key_comp()(prior->key(), k);
+      need_low = false;
+    }
+    if (!ok)  // k is outside np's range, so start no lower than par
+    {
+      start = btree_node_ptr(*par);
+      need_low = need_high = true;
+    }
+  }
+  return start;
+}
+
+//------------------------------------- m_climb() --------------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+typename btree_base<Key,Base,Traits,Comp>::btree_node_ptr
+btree_base<Key,Base,Traits,Comp>::m_climb(btree_node_ptr np, const key_type& k) const
+{
+  //  Since k is not less than a key whose search path passes through np, k's search
+  //  path also passes through np unless k is beyond np's upper limit. That limit is the
+  //  key of np's parent element; the end pseudo-element has no key, so np then shares
+  //  its parent's upper limit. For unique containers m_special_lower_bound() moves
+  //  past a branch key equal to k, so the limit is exclusive; otherwise it is inclusive.
+  const bool unique = (header().flags() & btree::flags::unique) != 0;
+  while (np->parent())
+  {
+    branch_iterator pe = np->parent_element();
+    if (pe != np->parent()->branch().end()
+      && (unique ? key_comp()(k, pe->key()) : !key_comp()(pe->key(), k)))
+      break;
+    np = btree_node_ptr(*np->parent());
+  }
+  return np;
+}
+
+//------------------------------ m_lower_bound_many() ----------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+template <class ForwardIterator>
+void btree_base<Key,Base,Traits,Comp>::m_lower_bound_many(ForwardIterator first,
+  ForwardIterator last, std::vector<const key_type*>& keys,
+  std::vector<const_iterator>& bounds) const
+{
+  for (; first != last; ++first)
+    keys.push_back(&*first);
+
+  std::vector<std::size_t> order(keys.size());
+  for (std::size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), probe_compare(keys, key_comp()));
+
+  bounds.resize(keys.size(), end());
+  btree_node_ptr np;  // leaf reached by the prior search
+  std::vector<buffer_ptr> held;  // leaves read ahead by m_read_leaves()
+  buffer::buffer_id_type read_from  // the leaf whose search last called m_read_leaves()
+    = static_cast<buffer::buffer_id_type>(-1);
+  for (std::vector<std::size_t>::const_iterator it = order.begin();
+    it != order.end(); ++it)
+  {
+    const key_type& k = *keys[*it];
+    iterator low = m_special_lower_bound(np ? m_climb(np, k) : m_root, k);
+    np = low.m_node;
+    bounds[*it] = m_to_lower_bound(low);
+
+    //  once the search passes the last leaf read ahead, or reaches a leaf that wasn't,
+    //  read the next leaves the remaining searches need as one batch
+    if (!m_read_ahead || !np->parent() || np->node_id() == read_from)
+      continue;
+    std::size_t i = 0;
+    while (i < held.size() && held[i]->buffer_id() != np->node_id())
+      ++i;
+    if (i + 1 >= held.size())
+    {
+      read_from = np->node_id();
+      m_read_leaves(np, it + 1, order.end(), keys, held);
+    }
+  }
+}
+
+//---------------------------------- m_read_leaves() -----------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+void btree_base<Key,Base,Traits,Comp>::m_read_leaves(btree_node_ptr np,
+  std::vector<std::size_t>::const_iterator next,
+  std::vector<std::size_t>::const_iterator last,
+  const std::vector<const key_type*>& keys, std::vector<buffer_ptr>& held) const
+{
+  //  the keys are sorted, so their leaves under np's parent come in element order, and
+  //  the first key whose search climbs above the parent ends them
+  btree_node* par = np->parent();
+  std::size_t limit = std::min<std::size_t>(m_read_ahead, m_mgr.max_cache_size() / 2);
+  std::vector<buffer::buffer_id_type> ids;
+  buffer::buffer_id_type prior = np->node_id();
+  for (; next != last && ids.size() < limit; ++next)
+  {
+    const key_type& k = *keys[*next];
+    btree_node* start = m_climb(np, k).get();
+    if (start == np.get())
+      continue;
+    if (start != par)
+      break;
+    buffer::buffer_id_type id = m_lower_bound_child(par, k)->node_id();
+    if (id != prior)
+      ids.push_back(prior = id);
+  }
+
+  held.clear();  // the prior batch is done with, so its leaves may be reused
+  if (ids.empty())
+    return;
+  held.resize(ids.size());
+  m_mgr.read_many(&ids[0], ids.size(), &held[0]);
+}
+
+//-------------------------------- lower_bound_many() ----------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+template <class ForwardIterator, class OutputIterator>
+OutputIterator
+btree_base<Key,Base,Traits,Comp>::lower_bound_many(ForwardIterator first,
+  ForwardIterator last, OutputIterator result) const
+{
+  BOOST_ASSERT_MSG(is_open(), "lower_bound_many() on unopen btree");
+  std::vector<const key_type*> keys;
+  std::vector<const_iterator> bounds;
+  m_lower_bound_many(first, last, keys, bounds);
+  return std::copy(bounds.begin(), bounds.end(), result);
+}
+
+//----------------------------------- find_many() --------------------------------------//
+
+template <class Key, class Base, class Traits, class Comp>   
+template <class ForwardIterator, class OutputIterator>
+OutputIterator
+btree_base<Key,Base,Traits,Comp>::find_many(ForwardIterator first,
+  ForwardIterator last, OutputIterator result) const
+{
+  BOOST_ASSERT_MSG(is_open(), "find_many() on unopen btree");
+  std::vector<const key_type*> keys;
+  std::vector<const_iterator> bounds;
+  m_lower_bound_many(first, last, keys, bounds);
+  for (std::size_t i = 0; i < bounds.size(); ++i, ++result)
+    *result = (bounds[i] != end() && !key_comp()(*keys[i], key(*bounds[i])))
+      ? bounds[i]
+      : end();
+  return result;
+}
+
 //------------------------------ m_special_upper_bound() -------------------------------//
 
 template <class Key, class Base, class Traits, class Comp>   
 typename btree_base<Key,Base,Traits,Comp>::iterator
-btree_base<Key,Base,Traits,Comp>::m_special_upper_bound(const key_type& k) const
+btree_base<Key,Base,Traits,Comp>::m_special_upper_bound(btree_node_ptr np,
+  const key_type& k) const
 {
-  btree_node_ptr np = m_root;
+  np = m_upper_bound_leaf(np, k);
+
+  //  search leaf
+  leaf_iterator up = m_node_upper_bound(np.get(),
+    np->leaf().begin(), np->leaf().end(), k, value_comp());
+
+  return iterator(np, up);
+}
+
+//------------------------------- m_upper_bound_leaf() ---------------------------------//
 
+template <class Key, class Base, class Traits, class Comp>   
+typename btree_base<Key,Base,Traits,Comp>::btree_node_ptr
+btree_base<Key,Base,Traits,Comp>::m_upper_bound_leaf(btree_node_ptr np,
+  const key_type& k) const
+{
   // search branches down the tree until a leaf is reached
   while (np->is_branch())
   {
-    branch_iterator up
-      = std::upper_bound(np->branch().begin(), np->branch().end(), k, branch_comp());
+    branch_iterator up = m_node_upper_bound(np.get(),
+      np->branch().begin(), np->branch().end(), k, branch_comp());
 
     // create the child->parent list
     btree_node_ptr child_np = m_mgr.read(up->node_id());
-    child_np->parent(np);
-    child_np->parent_element(up);
-#   ifndef NDEBUG
-    child_np->parent_node_id(np->node_id());
-#   endif
+    child_np->parent(np, up);
 
     np = child_np;
   }
-
-  //  search leaf
-  leaf_iterator up
-    = std::upper_bound(np->leaf().begin(), np->leaf().end(), k, value_comp());
-
-  return iterator(np, up);
+  return np;
 }
 
 //---------------------------------- upper_bound() -------------------------------------//
@@ -1862,6 +3927,8 @@ typename btree_base<Key,Base,Traits,Comp>::const_iterator
 btree_base<Key,Base,Traits,Comp>::find(const key_type& k) const
 {
   BOOST_ASSERT_MSG(is_open(), "find() on unopen btree");
+  if (m_concurrent_write)
+    return m_concurrent_find(k);
   const_iterator low = lower_bound(k);
   return (low != end() && !key_comp()(k, key(*low)))
     ? low
@@ -1875,6 +3942,8 @@ typename btree_base<Key,Base,Traits,Comp>::size_type
 btree_base<Key,Base,Traits,Comp>::count(const key_type& k) const
 {
   BOOST_ASSERT_MSG(is_open(), "lower_bound() on unopen btree");
+  if (m_concurrent_write)
+    return m_concurrent_count(k);
   size_type count = 0;
 
   for (const_iterator it = lower_bound(k);
@@ -2005,7 +4074,7 @@ btree_base<Key,Base,Traits,Comp>::iterator_type<T>::decrement()
     *this = reinterpret_cast<btree_base<Key,Base,Traits,Comp>*>
         (m_node->manager()->owner())->last();
   else if (m_element != m_node->leaf().begin())
-    --m_element;
+    m_element = btree_base::m_node_prior(m_node.get(), m_node->leaf().begin(), m_element);
   else
   {
     btree_node_ptr np(m_node);
@@ -2013,9 +4082,9 @@ btree_base<Key,Base,Traits,Comp>::iterator_type<T>::decrement()
 
     if (m_node)
     {  
-      m_element = m_node->leaf().end();
-      BOOST_ASSERT(m_element != m_node->leaf().begin());
-      --m_element;
+      BOOST_ASSERT(!m_node->empty());
+      m_element = btree_base::m_node_prior(m_node.get(), m_node->leaf().begin(),
+        m_node->leaf().end());
     }
     else // end() reached
     {
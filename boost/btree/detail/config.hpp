@@ -28,6 +28,24 @@
 
 #define BOOST_BTREE_THROW(EX) throw EX
 
+//  io_uring  --------------------------------------------------------------------------//
+//
+//  Define BOOST_BTREE_IO_URING when building the library on Linux to enable an
+//  io_uring based engine for binary_file's batched transfers (read_batch_at,
+//  write_batch_at). The engine uses the raw system calls, so liburing is not needed.
+//  It is only used for files opened with oflag::async_io, and binary_file falls back
+//  to synchronous I/O if the running kernel does not support io_uring.
+
+#if defined(BOOST_BTREE_IO_URING) && !defined(__linux__)
+# undef BOOST_BTREE_IO_URING
+#endif
+
+//  SIMD node search  ------------------------------------------------------------------//
+//
+//  Searches of nodes with 32 or 64 bit integer keys use SSE2, SSE4.2, or AVX2 compares
+//  when the compiler targets those instruction sets (see detail/node_search.hpp).
+//  Define BOOST_BTREE_NO_SIMD to restrict them to the portable branchless search.
+
 //  enable dynamic linking -------------------------------------------------------------//
 
 #if defined(BOOST_ALL_DYN_LINK) || defined(BOOST_BTREE_DYN_LINK)
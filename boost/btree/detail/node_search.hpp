@@ -0,0 +1,382 @@
+//  boost/btree/detail/node_search.hpp  ------------------------------------------------//
+
+//  Copyright Boost.Btree contributors 2026
+
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+//  Library home page: http://www.boost.org/libs/btree
+
+//--------------------------------------------------------------------------------------//
+
+#ifndef BOOST_BTREE_NODE_SEARCH_HPP
+#define BOOST_BTREE_NODE_SEARCH_HPP
+
+#include <boost/btree/detail/config.hpp>
+#include <boost/integer/endian.hpp>
+#include <boost/mpl/has_xxx.hpp>
+#include <boost/type_traits/integral_constant.hpp>
+#include <boost/type_traits/is_integral.hpp>
+#include <boost/type_traits/is_signed.hpp>
+#include <cstddef>
+#include <cstring>
+
+#if !defined(BOOST_BTREE_NO_SIMD)
+# if defined(__AVX2__)
+#   define BOOST_BTREE_SIMD_AVX2
+#   include <immintrin.h>
+# elif defined(__SSE4_2__)
+#   define BOOST_BTREE_SIMD_SSE4_2
+#   include <nmmintrin.h>
+# elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define BOOST_BTREE_SIMD_SSE2
+#   include <emmintrin.h>
+# endif
+#endif
+
+/*
+
+  In-node search kernels for integer keys compared with btree::less.
+
+  The generic node search is std::lower_bound/upper_bound through value_comp() or
+  branch_comp(), which mispredicts about half of its branches. For 32 and 64 bit integer
+  keys, and for integer::endian keys, the kernels below replace it with a branchless
+  binary search over the node's elements, which are a fixed stride apart. When the keys
+  are native integers packed with no other data between them, as on the leaves of a
+  btree_set, the last few probes are replaced by a SIMD compare of the whole remaining
+  block.
+
+  The instruction set is chosen at compile time from the compiler's target macros:
+  AVX2 (-mavx2) or SSE4.2 (-msse4.2) handle 32 and 64 bit keys; SSE2 alone handles 32
+  bit keys. Define BOOST_BTREE_NO_SIMD to use only the portable branchless search.
+
+*/
+
+namespace boost
+{
+namespace btree
+{
+template <class T> struct less;
+
+namespace detail
+{
+  //  fast_search<Key, Comp>::value is true if the kernels apply to a btree with the
+  //  given key_type and key_compare. native_type is the type the keys are compared as.
+
+  template <class Key, class Comp, bool Integral = is_integral<Key>::value>
+  struct fast_search : public false_type {};
+
+  template <class Key>
+  struct fast_search<Key, btree::less<Key>, true>
+    : public integral_constant<bool, sizeof(Key) == 4 || sizeof(Key) == 8>
+  {
+    typedef Key native_type;
+    static const bool packed = true;  // stored in native form, so SIMD is usable
+
+    static native_type load(const char* p)
+    {
+      native_type k;
+      std::memcpy(&k, p, sizeof(native_type));  // elements need not be aligned
+      return k;
+    }
+  };
+
+  template <BOOST_SCOPED_ENUM(integer::endianness) E, class T, std::size_t n_bits,
+    BOOST_SCOPED_ENUM(integer::alignment) A>
+  struct fast_search<integer::endian<E, T, n_bits, A>,
+    btree::less<integer::endian<E, T, n_bits, A> >, false>
+    : public is_integral<T>
+  {
+    typedef T native_type;
+    static const bool packed = false;
+
+    static native_type load(const char* p)
+    {
+      return *reinterpret_cast<const integer::endian<E, T, n_bits, A>*>(p);
+    }
+  };
+
+  //  has_leaf_key_column<Traits>::value is true if Traits selects the leaf key column
+  //  option; see key_column_traits in header.hpp
+
+  BOOST_MPL_HAS_XXX_TRAIT_DEF(leaf_key_column)
+
+  //--------------------------------- simd kernels -------------------------------------//
+
+  //  simd_count<T>::less(keys, n, k) returns the number of the n keys less than k, and
+  //  simd_count<T>::greater(keys, n, k) the number greater than k. The keys need not be
+  //  aligned. available is false if there is no kernel for T on this target.
+
+  template <class T, std::size_t Size = sizeof(T)>
+  struct simd_count
+  {
+    static const bool available = false;
+    static std::size_t less(const T*, std::size_t, T)     { return 0; }
+    static std::size_t greater(const T*, std::size_t, T)  { return 0; }
+  };
+
+#if defined(BOOST_BTREE_SIMD_AVX2) || defined(BOOST_BTREE_SIMD_SSE4_2) \
+  || defined(BOOST_BTREE_SIMD_SSE2)
+
+  //  number of bits set in a movemask result
+  inline std::size_t mask_count(unsigned m)
+  {
+# if defined(__GNUC__)
+    return __builtin_popcount(m);
+# else
+    m = m - ((m >> 1) & 0x55555555u);
+    m = (m & 0x33333333u) + ((m >> 2) & 0x33333333u);
+    return (((m + (m >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24;
+# endif
+  }
+
+  //  The SSE and AVX compares are signed, so unsigned keys have their sign bits
+  //  flipped first, which maps unsigned order onto signed order.
+
+  template <class T>
+  struct simd_count<T, 4>
+  {
+    static const bool available = true;
+
+# if defined(BOOST_BTREE_SIMD_AVX2)
+    static __m256i bias()
+      { return _mm256_set1_epi32(is_signed<T>::value ? 0 : int(0x80000000u)); }
+
+    static std::size_t less(const T* keys, std::size_t n, T k)
+    {
+      const __m256i b = bias();
+      const __m256i kv = _mm256_xor_si256(_mm256_set1_epi32(int(k)), b);
+      std::size_t count = 0, i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        __m256i v = _mm256_xor_si256(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), b);
+        count += mask_count(
+          _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(kv, v))));
+      }
+      for (; i < n; ++i)
+        count += keys[i] < k;
+      return count;
+    }
+
+    static std::size_t greater(const T* keys, std::size_t n, T k)
+    {
+      const __m256i b = bias();
+      const __m256i kv = _mm256_xor_si256(_mm256_set1_epi32(int(k)), b);
+      std::size_t count = 0, i = 0;
+      for (; i + 8 <= n; i += 8)
+      {
+        __m256i v = _mm256_xor_si256(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), b);
+        count += mask_count(
+          _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, kv))));
+      }
+      for (; i < n; ++i)
+        count += k < keys[i];
+      return count;
+    }
+# else
+    static __m128i bias()
+      { return _mm_set1_epi32(is_signed<T>::value ? 0 : int(0x80000000u)); }
+
+    static std::size_t less(const T* keys, std::size_t n, T k)
+    {
+      const __m128i b = bias();
+      const __m128i kv = _mm_xor_si128(_mm_set1_epi32(int(k)), b);
+      std::size_t count = 0, i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        __m128i v = _mm_xor_si128(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), b);
+        count += mask_count(
+          _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(kv, v))));
+      }
+      for (; i < n; ++i)
+        count += keys[i] < k;
+      return count;
+    }
+
+    static std::size_t greater(const T* keys, std::size_t n, T k)
+    {
+      const __m128i b = bias();
+      const __m128i kv = _mm_xor_si128(_mm_set1_epi32(int(k)), b);
+      std::size_t count = 0, i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        __m128i v = _mm_xor_si128(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), b);
+        count += mask_count(
+          _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, kv))));
+      }
+      for (; i < n; ++i)
+        count += k < keys[i];
+      return count;
+    }
+# endif
+  };
+#endif
+
+#if defined(BOOST_BTREE_SIMD_AVX2) || defined(BOOST_BTREE_SIMD_SSE4_2)
+
+  template <class T>
+  struct simd_count<T, 8>
+  {
+    static const bool available = true;
+
+# if defined(BOOST_BTREE_SIMD_AVX2)
+    static __m256i bias()
+    {
+      return _mm256_set1_epi64x(is_signed<T>::value
+        ? 0 : static_cast<long long>(0x8000000000000000ULL));
+    }
+
+    static std::size_t less(const T* keys, std::size_t n, T k)
+    {
+      const __m256i b = bias();
+      const __m256i kv = _mm256_xor_si256(_mm256_set1_epi64x((long long)(k)), b);
+      std::size_t count = 0, i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        __m256i v = _mm256_xor_si256(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), b);
+        count += mask_count(
+          _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(kv, v))));
+      }
+      for (; i < n; ++i)
+        count += keys[i] < k;
+      return count;
+    }
+
+    static std::size_t greater(const T* keys, std::size_t n, T k)
+    {
+      const __m256i b = bias();
+      const __m256i kv = _mm256_xor_si256(_mm256_set1_epi64x((long long)(k)), b);
+      std::size_t count = 0, i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        __m256i v = _mm256_xor_si256(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), b);
+        count += mask_count(
+          _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, kv))));
+      }
+      for (; i < n; ++i)
+        count += k < keys[i];
+      return count;
+    }
+# else
+    static __m128i bias()
+    {
+      return _mm_set1_epi64x(is_signed<T>::value
+        ? 0 : static_cast<long long>(0x8000000000000000ULL));
+    }
+
+    static std::size_t less(const T* keys, std::size_t n, T k)
+    {
+      const __m128i b = bias();
+      const __m128i kv = _mm_xor_si128(_mm_set1_epi64x((long long)(k)), b);
+      std::size_t count = 0, i = 0;
+      for (; i + 2 <= n; i += 2)
+      {
+        __m128i v = _mm_xor_si128(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), b);
+        count += mask_count(
+          _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(kv, v))));
+      }
+      for (; i < n; ++i)
+        count += keys[i] < k;
+      return count;
+    }
+
+    static std::size_t greater(const T* keys, std::size_t n, T k)
+    {
+      const __m128i b = bias();
+      const __m128i kv = _mm_xor_si128(_mm_set1_epi64x((long long)(k)), b);
+      std::size_t count = 0, i = 0;
+      for (; i + 2 <= n; i += 2)
+      {
+        __m128i v = _mm_xor_si128(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), b);
+        count += mask_count(
+          _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(v, kv))));
+      }
+      for (; i < n; ++i)
+        count += k < keys[i];
+      return count;
+    }
+# endif
+  };
+#endif
+
+  //------------------------------- search functions -----------------------------------//
+
+  //  The keys are at base, base + stride, ... base + (n-1) * stride.
+  //  The searches return the index of the lower or upper bound, in the range [0, n].
+
+  //  Below this many remaining keys, a packed search switches to a SIMD linear count
+  const std::size_t simd_search_block = 16;
+
+  template <class Search>
+  std::size_t node_lower_bound(const char* base, std::size_t stride, std::size_t n,
+    typename Search::native_type k)
+  {
+    typedef typename Search::native_type native_type;
+    const bool simd = Search::packed && simd_count<native_type>::available
+      && stride == sizeof(native_type);
+    std::size_t low = 0;
+    if (simd)
+    {
+      while (n > simd_search_block)
+      {
+        std::size_t half = n / 2;
+        low += half * (Search::load(base + (low + half - 1) * stride) < k);
+        n -= half;
+      }
+      return low + simd_count<native_type>::less(
+        reinterpret_cast<const native_type*>(base) + low, n, k);
+    }
+    if (!n)
+      return 0;
+    while (n > 1)  // invariant: the lower bound is in [low, low + n]
+    {
+      std::size_t half = n / 2;
+      low += half * (Search::load(base + (low + half - 1) * stride) < k);
+      n -= half;
+    }
+    return low + (Search::load(base + low * stride) < k);
+  }
+
+  template <class Search>
+  std::size_t node_upper_bound(const char* base, std::size_t stride, std::size_t n,
+    typename Search::native_type k)
+  {
+    typedef typename Search::native_type native_type;
+    const bool simd = Search::packed && simd_count<native_type>::available
+      && stride == sizeof(native_type);
+    std::size_t up = 0;
+    if (simd)
+    {
+      while (n > simd_search_block)
+      {
+        std::size_t half = n / 2;
+        up += half * !(k < Search::load(base + (up + half - 1) * stride));
+        n -= half;
+      }
+      return up + n - simd_count<native_type>::greater(
+        reinterpret_cast<const native_type*>(base) + up, n, k);
+    }
+    if (!n)
+      return 0;
+    while (n > 1)  // invariant: the upper bound is in [up, up + n]
+    {
+      std::size_t half = n / 2;
+      up += half * !(k < Search::load(base + (up + half - 1) * stride));
+      n -= half;
+    }
+    return up + !(k < Search::load(base + up * stride));
+  }
+
+}  // namespace detail
+}  // namespace btree
+}  // namespace boost
+
+#endif  // BOOST_BTREE_NODE_SEARCH_HPP
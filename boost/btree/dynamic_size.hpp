@@ -11,6 +11,7 @@
 #define BOOST_BTREE_DYNAMIC_SIZE_HPP
 
 #include <boost/type_traits/integral_constant.hpp>
+#include <cstring>
 
 namespace boost
 { 
@@ -26,6 +27,24 @@ namespace boost
 
     template <class T>
     struct has_dynamic_size : public false_type{};
+
+    //  May be overloaded for types with dynamic size to shorten the keys stored in
+    //  branch nodes. When a leaf splits, the branch key separating the two leaves need
+    //  only satisfy lo < key && key <= hi, where lo is the last key of the left leaf and
+    //  hi is the first key of the right leaf, so a short prefix of hi often suffices.
+    //  Requires: lo < hi; target has room for dynamic_size(hi) bytes
+    //  Effects: Places at target a key s such that lo < s && s <= hi
+    //  Returns: dynamic_size(s)
+    //  Remarks: The btree verifies the result with its key_compare, and uses hi if the
+    //    result does not satisfy the requirements, so an overload that assumes operator<
+    //    is harmless for btrees with other orderings.
+
+    template <class T>
+    inline std::size_t shortest_separator(const T&, const T& hi, void* target)
+    {
+      std::memcpy(target, &hi, dynamic_size(hi));
+      return dynamic_size(hi);
+    }
   }
 }
 
@@ -80,7 +80,21 @@ namespace boost
         = integer::endianness::big;
     };
 
-
+    //  key_column_traits<Traits> is Traits plus the leaf_key_column option. With the
+    //  option, each leaf of a btree whose key is an integer or integer::endian type
+    //  compared by btree::less, and whose mapped type is not dynamic size, keeps an
+    //  in-memory column of its keys in native form, packed together. Leaf searches then
+    //  stream only key bytes, and can use SIMD compares, instead of touching every
+    //  element's cache lines. The column is rebuilt the first time a leaf is searched
+    //  after it changes, so the option pays off when leaves are searched repeatedly
+    //  while cached, as with large mapped types or in-cache point lookups. The file
+    //  format is unchanged.
+
+    template <class Traits>
+    struct key_column_traits : public Traits
+    {
+      typedef void leaf_key_column;
+    };
 
     namespace flags
     {
@@ -93,6 +107,16 @@ namespace boost
 
         // bitmasks set by user:
         preload     = 0x10, // existing file read to preload O/S file cache
+        scan_resistant = 0x20, // scan resistant cache replacement; keeps branch nodes
+                               // resident during large scans
+        mapped      = 0x40, // read_only only; nodes are accessed via a memory mapping of
+                            // the file rather than read into node buffers
+        async_io    = 0x80, // batched node I/O uses an asynchronous I/O engine, if
+                            // available; see BOOST_BTREE_IO_URING
+        concurrent_read = 0x100, // read_only only; several threads may search and
+                                 // iterate the btree at once
+        concurrent_write = 0x200, // read_write or truncate only; several threads may
+                                  // insert, erase, find, and count at once
 
         // bitmasks set by implemenation, ignored if passed in by user:
         unique      = 4,    // multimap or multiset; non-uniqueness allowed
@@ -101,14 +125,19 @@ namespace boost
 
       BOOST_BITMASK(bitmask);
 
-      bitmask user(bitmask m) {return m & (read_write|truncate|preload); }
+      bitmask user(bitmask m)
+        {return m & (read_write|truncate|preload|scan_resistant|mapped|async_io
+          |concurrent_read|concurrent_write); }
     }
 
     static const boost::uint8_t major_version = 0;  // version identification
-    static const boost::uint8_t minor_version = 1;
+    static const boost::uint8_t minor_version = 2;
+    //  minor version 2: the free node list is a chain of free map nodes, each listing
+    //  many free node ids; readers of version 1 can only follow a chain of free nodes
 
     static const std::size_t default_node_size = 4096;
     static const std::size_t default_max_cache_nodes = 32;
+    static const unsigned    default_read_ahead_nodes = 8;
 
     namespace flags
     {
@@ -93,16 +93,54 @@ namespace boost
           value->key(), value->mapped_value());
       }
 
+      typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::const_iterator
+      insert(typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::const_iterator hint,
+        const map_value<Key, T>& value)
+      {
+        return btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_insert_unique(
+          hint, value.key(), value.mapped_value()).first;
+      }
+
+      typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::const_iterator
+      emplace_hint(typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::const_iterator hint,
+        const Key& key, const T& mapped_value)
+      {
+        return btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_insert_unique(
+          hint, key, mapped_value).first;
+      }
+
+      //  Each insert is hinted by the prior one, so sorted input usually only
+      //  touches the leaf level; see lower_bound(hint, k)
       template <class InputIterator>
       void insert(InputIterator begin, InputIterator end)
-      { 
-        for (; begin != end; ++begin) 
+      {
+        typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::const_iterator
+          hint = this->end();
+        for (; begin != end; ++begin)
         {
-          btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_insert_unique(
+          hint = btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_insert_unique(
+            hint, begin->key(), begin->mapped_value()).first;
+        }
+      }
+
+      //  Requires: empty(), and [begin, end) is sorted by key
+      //  Effects: Builds the tree bottom-up from [begin, end), filling each node to
+      //    fill_percent of its capacity. Much faster than insert() of the same elements.
+      //    Elements with keys equivalent to the prior element's key are ignored.
+      template <class InputIterator>
+      void bulk_load(InputIterator begin, InputIterator end, unsigned fill_percent = 100)
+      {
+        btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_bulk_begin(fill_percent);
+        for (; begin != end; ++begin)
+        {
+          btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_bulk_push(
             begin->key(), begin->mapped_value());
         }
+        btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_bulk_end();
       }
 
+      //  Effects: Replaces itr's mapped value. The new value may differ in size from the
+      //    old one, but if so, other iterators into itr's node are invalidated.
       typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::iterator
       update(typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::iterator itr,
         const T& mapped_value)
@@ -111,6 +149,25 @@ namespace boost
           itr, mapped_value);
       }
 
+      //  Effects: If an element with a key equivalent to key exists, its mapped value is
+      //    updated as if by update(), otherwise key, mapped_value is inserted. Either
+      //    way the tree is searched once.
+      //  Returns: An iterator to the updated or inserted element, and true if inserted.
+      std::pair<typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::const_iterator, bool>
+      insert_or_assign(const Key& key, const T& mapped_value)
+      {
+        return btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_insert_or_assign(
+          this->end(), key, mapped_value);
+      }
+
+      typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::const_iterator
+      insert_or_assign(typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::const_iterator hint,
+        const Key& key, const T& mapped_value)
+      {
+        return btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_insert_or_assign(
+          hint, key, mapped_value).first;
+      }
+
      };
 
 //--------------------------------------------------------------------------------------//
@@ -177,16 +234,53 @@ namespace boost
           value->key(), value->mapped_value());
       }
 
+      typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::const_iterator
+      insert(typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::const_iterator hint,
+        const map_value<Key, T>& value)
+      {
+        return btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_insert_non_unique(
+          hint, value.key(), value.mapped_value());
+      }
+
+      typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::const_iterator
+      emplace_hint(typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::const_iterator hint,
+        const Key& key, const T& mapped_value)
+      {
+        return btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_insert_non_unique(
+          hint, key, mapped_value);
+      }
+
+      //  Each insert is hinted by the prior one, so sorted input usually only
+      //  touches the leaf level; see lower_bound(hint, k)
       template <class InputIterator>
       void insert(InputIterator begin, InputIterator end)
       {
+        typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::const_iterator
+          hint = this->end();
         for (; begin != end; ++begin)
         {
-          btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_insert_non_unique(
+          hint = btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_insert_non_unique(
+            hint, begin->key(), begin->mapped_value());
+        }
+      }
+
+      //  Requires: empty(), and [begin, end) is sorted by key
+      //  Effects: Builds the tree bottom-up from [begin, end), filling each node to
+      //    fill_percent of its capacity. Much faster than insert() of the same elements.
+      template <class InputIterator>
+      void bulk_load(InputIterator begin, InputIterator end, unsigned fill_percent = 100)
+      {
+        btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_bulk_begin(fill_percent);
+        for (; begin != end; ++begin)
+        {
+          btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_bulk_push(
             begin->key(), begin->mapped_value());
         }
+        btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_bulk_end();
       }
 
+      //  Effects: Replaces itr's mapped value. The new value may differ in size from the
+      //    old one, but if so, other iterators into itr's node are invalidated.
       typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::iterator
       update(typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::iterator itr,
         const T& mapped_value)
@@ -194,6 +288,25 @@ namespace boost
         return btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_update(
           itr, mapped_value);
       }
+
+      //  Effects: If the first element with a key equivalent to key exists, its mapped value is
+      //    updated as if by update(), otherwise key, mapped_value is inserted. Either
+      //    way the tree is searched once.
+      //  Returns: An iterator to the updated or inserted element, and true if inserted.
+      std::pair<typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::const_iterator, bool>
+      insert_or_assign(const Key& key, const T& mapped_value)
+      {
+        return btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_insert_or_assign(
+          this->end(), key, mapped_value);
+      }
+
+      typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::const_iterator
+      insert_or_assign(typename btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::const_iterator hint,
+        const Key& key, const T& mapped_value)
+      {
+        return btree_base<Key,btree_map_base<Key,T,Comp>,Traits,Comp>::m_insert_or_assign(
+          hint, key, mapped_value).first;
+      }
     };
 
 
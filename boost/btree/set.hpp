@@ -92,14 +92,50 @@ namespace boost
           value, value);
       }
 
+      typename btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::const_iterator
+      insert(typename btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::const_iterator hint,
+        const typename btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::value_type& value)
+      {
+        return btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::m_insert_unique(
+          hint, value, value).first;
+      }
+
+      typename btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::const_iterator
+      emplace_hint(typename btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::const_iterator hint,
+        const typename btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::value_type& value)
+      {
+        return btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::m_insert_unique(
+          hint, value, value).first;
+      }
+
+      //  Each insert is hinted by the prior one, so sorted input usually only
+      //  touches the leaf level; see lower_bound(hint, k)
       template <class InputIterator>
       void insert(InputIterator begin, InputIterator end)
       {
+        typename btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::const_iterator
+          hint = this->end();
         for (; begin != end; ++begin)
         {
-          btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::m_insert_unique(
+          hint = btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::m_insert_unique(
+            hint, *begin, *begin).first;
+        }
+      }
+
+      //  Requires: empty(), and [begin, end) is sorted by key
+      //  Effects: Builds the tree bottom-up from [begin, end), filling each node to
+      //    fill_percent of its capacity. Much faster than insert() of the same elements.
+      //    Elements with keys equivalent to the prior element's key are ignored.
+      template <class InputIterator>
+      void bulk_load(InputIterator begin, InputIterator end, unsigned fill_percent = 100)
+      {
+        btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::m_bulk_begin(fill_percent);
+        for (; begin != end; ++begin)
+        {
+          btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::m_bulk_push(
             *begin, *begin);
         }
+        btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::m_bulk_end();
       }
     };
 
@@ -166,14 +202,49 @@ namespace boost
           value, value);
       }
 
+      typename btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::const_iterator
+      insert(typename btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::const_iterator hint,
+        const typename btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::value_type& value)
+      {
+        return btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::m_insert_non_unique(
+          hint, value, value);
+      }
+
+      typename btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::const_iterator
+      emplace_hint(typename btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::const_iterator hint,
+        const typename btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::value_type& value)
+      {
+        return btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::m_insert_non_unique(
+          hint, value, value);
+      }
+
+      //  Each insert is hinted by the prior one, so sorted input usually only
+      //  touches the leaf level; see lower_bound(hint, k)
       template <class InputIterator>
       void insert(InputIterator begin, InputIterator end)
       {
-        for (; begin != end; ++begin) 
+        typename btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::const_iterator
+          hint = this->end();
+        for (; begin != end; ++begin)
         {
-          btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::m_insert_non_unique(
+          hint = btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::m_insert_non_unique(
+            hint, *begin, *begin);
+        }
+      }
+
+      //  Requires: empty(), and [begin, end) is sorted by key
+      //  Effects: Builds the tree bottom-up from [begin, end), filling each node to
+      //    fill_percent of its capacity. Much faster than insert() of the same elements.
+      template <class InputIterator>
+      void bulk_load(InputIterator begin, InputIterator end, unsigned fill_percent = 100)
+      {
+        btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::m_bulk_begin(fill_percent);
+        for (; begin != end; ++begin)
+        {
+          btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::m_bulk_push(
             *begin, *begin);
         }
+        btree_base<Key,btree_set_base<Key,Comp>,Traits,Comp>::m_bulk_end();
       }
     };
 
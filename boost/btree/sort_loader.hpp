@@ -0,0 +1,383 @@
+//  boost/btree/sort_loader.hpp  -------------------------------------------------------//
+
+//  Copyright Boost.Btree contributors 2026
+
+//  Distributed under the Boost Software License, Version 1.0.
+//  http://www.boost.org/LICENSE_1_0.txt
+
+//  See http://www.boost.org/libs/btree for documentation.
+
+#ifndef BOOST_BTREE_SORT_LOADER_HPP
+#define BOOST_BTREE_SORT_LOADER_HPP
+
+#define BOOST_FILESYSTEM_VERSION 3
+
+#include <boost/config.hpp>
+#include <boost/btree/dynamic_size.hpp>
+#include <boost/btree/detail/binary_file.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/iterator/iterator_facade.hpp>
+#include <boost/type_traits/is_same.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/assert.hpp>
+#include <cstring>
+#include <vector>
+#include <queue>
+#include <algorithm>
+
+/*
+
+  sort_loader loads unsorted elements into an empty btree without a random-position
+  insert per element. Elements are accumulated in memory up to a budget, sorted, and
+  spilled as a sorted run to a temporary file. finish() k-way merges the runs and feeds
+  the merged stream to the btree's bulk_load(), so the tree is built bottom-up with
+  sequential I/O. If all elements fit within the budget, nothing is spilled.
+
+  The merge is a single pass; each run gets an equal share of the memory budget as its
+  read buffer. The sort is stable and ties between runs go to the earlier run, so for
+  non-unique btrees elements with equivalent keys keep their insertion order, and for
+  unique btrees the first of several equivalent elements is the one loaded, just as
+  with insert().
+
+  Elements are held and spilled as fixed-size copies, so key_type and mapped_type must
+  not have dynamic size; strbuf, c_str_proxy, and blob btrees are rejected at compile
+  time. Load those with insert(), or with bulk_load() from an already sorted sequence.
+
+*/
+
+namespace boost
+{
+namespace btree
+{
+
+//--------------------------------------------------------------------------------------//
+//                                 class sort_loader                                    //
+//--------------------------------------------------------------------------------------//
+
+template <class Btree>
+class sort_loader : private noncopyable
+{
+public:
+  typedef Btree                           btree_type;
+  typedef typename Btree::key_type        key_type;
+  typedef typename Btree::mapped_type     mapped_type;
+  typedef typename Btree::value_type      value_type;
+  typedef typename Btree::size_type       size_type;
+
+  BOOST_STATIC_ASSERT_MSG(!has_dynamic_size<key_type>::value
+    && !has_dynamic_size<mapped_type>::value,
+    "sort_loader requires key_type and mapped_type without dynamic size");
+
+  static const std::size_t default_memory_budget = 64 * 1024 * 1024;
+
+  explicit sort_loader(Btree& bt,
+    std::size_t memory_budget = default_memory_budget,
+    const filesystem::path& temp_dir = filesystem::temp_directory_path())
+    : m_bt(bt), m_temp_dir(temp_dir), m_size(0), m_run_end(0), m_queue(0), m_current(0)
+  {
+    m_max_records = memory_budget / sizeof(record);
+    if (m_max_records < 2)
+      m_max_records = 2;
+  }
+
+  ~sort_loader()
+  {
+    try { m_remove_temp(); }
+    catch (...) {}
+  }
+
+  void emplace(const key_type& k, const mapped_type& mv)
+  {
+    m_reserve();
+    m_records.push_back(record());
+    std::memcpy(m_records.back().m_data, &k, sizeof(key_type));
+    if (!is_set)
+      std::memcpy(m_records.back().m_data + sizeof(key_type), &mv, sizeof(mapped_type));
+    m_pushed();
+  }
+
+  void insert(const value_type& v)
+  {
+    m_reserve();
+    m_records.push_back(record());
+    std::memcpy(m_records.back().m_data, &v, sizeof(record));
+    m_pushed();
+  }
+
+  template <class InputIterator>
+  void insert(InputIterator first, InputIterator last)
+  {
+    for (; first != last; ++first)
+      insert(*first);
+  }
+
+  void finish(unsigned fill_percent = 100);
+  //  Requires: The btree is open, not read only, and empty
+  //  Effects: Sorts the elements not yet spilled, merges them with the spilled runs,
+  //    and bulk loads the result into the btree. Removes the temporary file.
+  //  Postcondition: size() == 0 && runs() == 0
+
+  size_type    size() const     { return m_size; }  // elements inserted but not loaded
+  std::size_t  runs() const     { return m_runs.size(); }  // runs spilled so far
+  const filesystem::path&
+               temp_path() const { return m_temp.file_path(); }
+
+private:
+  static const bool is_set = boost::is_same<key_type, value_type>::value;
+
+  //  a record has the same layout as the value_type stored on a leaf
+  struct record
+  {
+    char m_data[sizeof(key_type) + (is_set ? 0 : sizeof(mapped_type))];
+    const value_type& value() const
+      { return *reinterpret_cast<const value_type*>(m_data); }
+  };
+
+  class record_compare
+  {
+  public:
+    record_compare(const typename Btree::value_compare& comp) : m_comp(comp) {}
+    bool operator()(const record& x, const record& y) const
+      { return m_comp(x.value(), y.value()); }
+  private:
+    typename Btree::value_compare m_comp;
+  };
+
+  typedef binary_file::offset_type offset_type;
+
+  struct run
+  {
+    offset_type  next;   // file offset of the next record to read
+    offset_type  end;
+    record*      block;  // read buffer
+    std::size_t  block_size;
+    std::size_t  pos;
+    std::size_t  count;
+  };
+
+  //  orders run indexes so that the top of a priority_queue is the run with the
+  //  lowest current record, with ties going to the earlier run
+  class run_compare
+  {
+  public:
+    run_compare(const std::vector<run>& runs, const typename Btree::value_compare& comp)
+      : m_runs(&runs), m_comp(comp) {}
+    bool operator()(std::size_t x, std::size_t y) const
+    {
+      const value_type& xv = (*m_runs)[x].block[(*m_runs)[x].pos].value();
+      const value_type& yv = (*m_runs)[y].block[(*m_runs)[y].pos].value();
+      return m_comp(yv, xv) || (!m_comp(xv, yv) && y < x);
+    }
+  private:
+    const std::vector<run>* m_runs;
+    typename Btree::value_compare m_comp;
+  };
+
+  typedef std::priority_queue<std::size_t, std::vector<std::size_t>, run_compare>
+    queue_type;
+
+  //  single pass input iterator over the merged runs, as required by bulk_load()
+  class merge_iterator
+    : public boost::iterator_facade<merge_iterator, const value_type,
+        boost::single_pass_traversal_tag>
+  {
+  public:
+    merge_iterator() : m_loader(0) {}
+    explicit merge_iterator(sort_loader* loader)
+      : m_loader(loader->m_current ? loader : 0) {}
+  private:
+    friend class boost::iterator_core_access;
+    sort_loader* m_loader;
+    const value_type& dereference() const  { return m_loader->m_current->value(); }
+    bool equal(const merge_iterator& rhs) const  { return m_loader == rhs.m_loader; }
+    void increment()
+    {
+      m_loader->m_next();
+      if (!m_loader->m_current)
+        m_loader = 0;
+    }
+  };
+  friend class merge_iterator;
+
+  Btree&               m_bt;
+  filesystem::path     m_temp_dir;
+  binary_file          m_temp;
+  std::vector<record>  m_records;
+  std::size_t          m_max_records;
+  size_type            m_size;
+  offset_type          m_run_end;     // end of the last run in the temporary file
+  std::vector<run>     m_runs;
+  queue_type*          m_queue;       // only valid during finish()
+  const record*        m_current;     // current merged record; 0 at end
+
+  void m_reserve()
+  {
+    if (m_records.empty())
+      m_records.reserve(m_max_records);  // avoid growing past the budget
+  }
+
+  void m_pushed()
+  {
+    ++m_size;
+    if (m_records.size() >= m_max_records)
+      m_spill();
+  }
+
+  void m_sort()
+  {
+    std::stable_sort(m_records.begin(), m_records.end(),
+      record_compare(m_bt.value_comp()));
+  }
+
+  void m_spill();
+  bool m_fill(run& r);
+  void m_next();
+  void m_remove_temp();
+};
+
+//--------------------------------------------------------------------------------------//
+//                           class sort_loader implementation                           //
+//--------------------------------------------------------------------------------------//
+
+//----------------------------------- m_spill() ----------------------------------------//
+
+template <class Btree>
+void sort_loader<Btree>::m_spill()
+{
+  if (m_records.empty())
+    return;
+  if (!m_temp.is_open())
+  {
+    m_temp.open(filesystem::unique_path(
+      m_temp_dir / "btree-sort-%%%%-%%%%-%%%%-%%%%.tmp"),
+      oflag::in | oflag::out | oflag::truncate);
+    m_run_end = 0;
+  }
+  m_sort();
+
+  run r;
+  r.next = m_run_end;
+  r.end = m_run_end + m_records.size() * sizeof(record);
+  r.block = 0;
+  r.block_size = r.pos = r.count = 0;
+  m_temp.write_at(m_run_end, &m_records[0], m_records.size() * sizeof(record));
+  m_runs.push_back(r);
+  m_run_end = r.end;
+  m_records.clear();
+}
+
+//------------------------------------ m_fill() ----------------------------------------//
+
+//  Read the next block of run r; returns false if the run is exhausted
+
+template <class Btree>
+bool sort_loader<Btree>::m_fill(run& r)
+{
+  r.pos = 0;
+  r.count = static_cast<std::size_t>((r.end - r.next) / sizeof(record));
+  if (r.count > r.block_size)
+    r.count = r.block_size;
+  if (!r.count)
+    return false;
+  m_temp.read_at(r.next, *r.block, r.count * sizeof(record));
+  r.next += r.count * sizeof(record);
+  return true;
+}
+
+//------------------------------------ m_next() ----------------------------------------//
+
+template <class Btree>
+void sort_loader<Btree>::m_next()
+{
+  if (m_current)  // advance the run the current record came from
+  {
+    std::size_t i = m_queue->top();
+    m_queue->pop();
+    if (++m_runs[i].pos < m_runs[i].count || m_fill(m_runs[i]))
+      m_queue->push(i);
+  }
+  m_current = m_queue->empty()
+    ? 0
+    : &m_runs[m_queue->top()].block[m_runs[m_queue->top()].pos];
+}
+
+//------------------------------------ finish() ----------------------------------------//
+
+template <class Btree>
+void sort_loader<Btree>::finish(unsigned fill_percent)
+{
+  if (m_runs.empty())
+  {
+    // everything fit in memory, so the one run is the record buffer itself
+    m_sort();
+    run r;
+    r.next = r.end = 0;
+    r.block = m_records.empty() ? 0 : &m_records[0];
+    r.block_size = r.count = m_records.size();
+    r.pos = 0;
+    m_runs.push_back(r);
+  }
+  else
+  {
+    // spill the remainder, then divide the record buffer among the runs
+    m_spill();
+    m_records.resize(m_max_records);
+    std::size_t block_size = m_max_records / m_runs.size();
+    if (!block_size)
+      block_size = 1;  // budget too small for a single pass merge; correct but slow
+    if (block_size * m_runs.size() > m_records.size())
+      m_records.resize(block_size * m_runs.size());
+    for (std::size_t i = 0; i < m_runs.size(); ++i)
+    {
+      m_runs[i].block = &m_records[i * block_size];
+      m_runs[i].block_size = block_size;
+      m_fill(m_runs[i]);
+    }
+  }
+
+  queue_type queue(run_compare(m_runs, m_bt.value_comp()));
+  for (std::size_t i = 0; i < m_runs.size(); ++i)
+    if (m_runs[i].count)
+      queue.push(i);
+  m_queue = &queue;
+  m_current = 0;
+  try
+  {
+    m_next();
+    m_bt.bulk_load(merge_iterator(this), merge_iterator(), fill_percent);
+  }
+  catch (...)
+  {
+    m_queue = 0;
+    m_current = 0;
+    throw;
+  }
+
+  m_queue = 0;
+  m_current = 0;
+  m_runs.clear();
+  std::vector<record>().swap(m_records);
+  m_size = 0;
+  m_remove_temp();
+}
+
+//--------------------------------- m_remove_temp() ------------------------------------//
+
+template <class Btree>
+void sort_loader<Btree>::m_remove_temp()
+{
+  if (m_temp.is_open())
+  {
+    filesystem::path p(m_temp.file_path());
+    m_temp.close();
+    system::error_code ec;
+    filesystem::remove(p, ec);
+  }
+}
+
+}  // namespace btree
+}  // namespace boost
+
+#endif  // BOOST_BTREE_SORT_LOADER_HPP
@@ -41,6 +41,23 @@ namespace boost
 
     template<> struct has_dynamic_size<c_str_proxy> : public true_type{};
 
+    inline std::size_t shortest_separator(const c_str_proxy& lo, const c_str_proxy& hi,
+      void* target)
+    {
+      // the shortest prefix of hi that is greater than lo
+      const char* l = lo.c_str();
+      const char* h = hi.c_str();
+      std::size_t sz = 0;
+      while (h[sz] && l[sz] == h[sz])
+        ++sz;
+      if (h[sz])
+        ++sz;
+      char* s = static_cast<char*>(target);
+      std::memcpy(s, h, sz);
+      s[sz] = '\0';
+      return sz + 1;
+    }
+
     std::ostream& operator<<(std::ostream& os, const c_str_proxy& x)
       { os << x.c_str(); return os;
     }
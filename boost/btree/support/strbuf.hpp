@@ -70,6 +70,22 @@ namespace btree
     bool operator> (const strbuf& rhs) const {return std::strcmp(m_buf, rhs.m_buf) > 0;}
     bool operator>=(const strbuf& rhs) const {return std::strcmp(m_buf, rhs.m_buf) >= 0;}
 
+    friend std::size_t shortest_separator(const strbuf& lo, const strbuf& hi,
+      void* target)
+    {
+      // the shortest prefix of hi that is greater than lo
+      std::size_t sz = 0;
+      while (sz < hi.m_size && lo.m_buf[sz] == hi.m_buf[sz])
+        ++sz;
+      if (sz < hi.m_size)
+        ++sz;
+      strbuf* s = static_cast<strbuf*>(target);
+      s->m_size = static_cast<boost::uint8_t>(sz);
+      std::memcpy(s->m_buf, hi.m_buf, sz);
+      s->m_buf[sz] = '\0';
+      return s->size();
+    }
+
   private:
     boost::uint8_t  m_size;  // std::strlen(m_buf); for speed, particularly on large strings 
     char            m_buf[max_size+1];  // '\0' terminated
@@ -83,6 +99,7 @@ namespace btree
   }
 
   inline std::size_t dynamic_size(const strbuf& sb)  {return sb.size();}
+  std::size_t shortest_separator(const strbuf& lo, const strbuf& hi, void* target);
   template<> struct has_dynamic_size<strbuf> : public true_type{};
 
 }  // namespace btree
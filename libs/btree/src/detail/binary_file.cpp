@@ -42,8 +42,16 @@ using boost::system::system_category;
 #   include<boost/iostreams/detail/config/rtl.hpp>  // for BOOST_IOSTREAMS_FD_SEEK,
                                                     //  BOOST_IOSTREAMS_FD_OFFSET 
 #   include <sys/types.h>
+#   include <sys/mman.h>
+#   include <sys/uio.h>
+#   include <climits>  // for IOV_MAX
 #   include "unistd.h"
 #   include "fcntl.h"
+#   ifdef BOOST_BTREE_IO_URING
+#     include <linux/io_uring.h>
+#     include <sys/syscall.h>
+#     include <vector>
+#   endif
 # endif
 // #include <iostream>    // for debugging only; comment out when not in use
 
@@ -76,7 +84,189 @@ namespace boost
 {
   namespace btree
   {
+    namespace detail
+    {
+#   ifdef BOOST_BTREE_IO_URING
+
+//  -------------------------------  io_engine  --------------------------------------  //
+//
+//  A minimal io_uring submission/completion loop, driven by the raw system calls.
+//  run() queues a batch of reads or writes, submits them with io_uring_enter(), and
+//  waits for all of them to complete. Results are the byte counts or negated errno
+//  values reported in the completion queue; short transfers and unsupported opcodes
+//  are finished by the caller with synchronous I/O.
+
+      class io_engine
+      {
+      public:
+        static io_engine* create(int fd);
+        // Returns: A new engine for fd, or 0 if io_uring is not available
+
+        ~io_engine();
+
+        bool run(bool is_read, const binary_file::io_request* requests,
+          std::size_t count, long* results);
+        // Returns: true if all requests completed, in which case results[i] holds the
+        // result for requests[i]. false if the ring failed; the engine is then unusable.
+
+      private:
+        io_engine() : m_ring_fd(-1), m_sq_ring(MAP_FAILED), m_cq_ring(MAP_FAILED),
+          m_sqes(MAP_FAILED) {}
+
+        bool m_run_some(bool is_read, const binary_file::io_request* requests,
+          std::size_t count, long* results);
+
+        enum { ring_entries = 64 };
+
+        int          m_fd;
+        int          m_ring_fd;
+        void*        m_sq_ring;
+        std::size_t  m_sq_ring_sz;
+        void*        m_cq_ring;
+        std::size_t  m_cq_ring_sz;
+        void*        m_sqes;
+        std::size_t  m_sqes_sz;
+        unsigned     m_entries;
+
+        unsigned*      m_sq_tail;
+        unsigned*      m_sq_mask;
+        unsigned*      m_sq_array;
+        unsigned*      m_cq_head;
+        unsigned*      m_cq_tail;
+        unsigned*      m_cq_mask;
+        io_uring_cqe*  m_cqes;
+      };
+
+      io_engine* io_engine::create(int fd)
+      {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        int ring_fd = static_cast<int>(::syscall(__NR_io_uring_setup,
+          static_cast<unsigned>(ring_entries), &params));
+        if (ring_fd < 0)
+          return 0;  // ENOSYS, EPERM (e.g. disabled by seccomp), ...
+
+        io_engine* e = new io_engine;
+        e->m_fd = fd;
+        e->m_ring_fd = ring_fd;
+        e->m_entries = params.sq_entries;
+        e->m_sq_ring_sz = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        e->m_cq_ring_sz = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap && e->m_cq_ring_sz > e->m_sq_ring_sz)
+          e->m_sq_ring_sz = e->m_cq_ring_sz;
+
+        e->m_sq_ring = ::mmap(0, e->m_sq_ring_sz, PROT_READ | PROT_WRITE,
+          MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        if (e->m_sq_ring == MAP_FAILED)
+          { delete e; return 0; }
+        if (single_mmap)
+          e->m_cq_ring = e->m_sq_ring;
+        else
+        {
+          e->m_cq_ring = ::mmap(0, e->m_cq_ring_sz, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+          if (e->m_cq_ring == MAP_FAILED)
+            { delete e; return 0; }
+        }
+        e->m_sqes_sz = params.sq_entries * sizeof(io_uring_sqe);
+        e->m_sqes = ::mmap(0, e->m_sqes_sz, PROT_READ | PROT_WRITE,
+          MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (e->m_sqes == MAP_FAILED)
+          { delete e; return 0; }
+
+        char* sq = static_cast<char*>(e->m_sq_ring);
+        char* cq = static_cast<char*>(e->m_cq_ring);
+        e->m_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        e->m_sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        e->m_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        e->m_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        e->m_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        e->m_cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        e->m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return e;
+      }
+
+      io_engine::~io_engine()
+      {
+        if (m_sqes != MAP_FAILED)
+          ::munmap(m_sqes, m_sqes_sz);
+        if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring)
+          ::munmap(m_cq_ring, m_cq_ring_sz);
+        if (m_sq_ring != MAP_FAILED)
+          ::munmap(m_sq_ring, m_sq_ring_sz);
+        if (m_ring_fd >= 0)
+          ::close(m_ring_fd);
+      }
+
+      bool io_engine::run(bool is_read, const binary_file::io_request* requests,
+        std::size_t count, long* results)
+      {
+        // the completion queue holds twice the submission queue entries, so batches
+        // of at most m_entries can never overflow it
+        for (std::size_t done = 0; done < count; done += m_entries)
+        {
+          std::size_t n = count - done < m_entries ? count - done : m_entries;
+          if (!m_run_some(is_read, requests + done, n, results + done))
+            return false;
+        }
+        return true;
+      }
+
+      bool io_engine::m_run_some(bool is_read, const binary_file::io_request* requests,
+        std::size_t count, long* results)
+      {
+        //  queue the submissions; only this thread touches the submission queue tail
+        unsigned tail = *m_sq_tail;
+        for (std::size_t i = 0; i < count; ++i, ++tail)
+        {
+          unsigned index = tail & *m_sq_mask;
+          io_uring_sqe* sqe = static_cast<io_uring_sqe*>(m_sqes) + index;
+          std::memset(sqe, 0, sizeof(*sqe));
+          sqe->opcode = is_read ? IORING_OP_READ : IORING_OP_WRITE;
+          sqe->fd = m_fd;
+          sqe->off = static_cast<__u64>(requests[i].offset);
+          sqe->addr = reinterpret_cast<__u64>(requests[i].data);
+          sqe->len = static_cast<__u32>(requests[i].size);
+          sqe->user_data = i;
+          m_sq_array[index] = index;
+        }
+        __atomic_store_n(m_sq_tail, tail, __ATOMIC_RELEASE);
+
+        //  submit and reap until every request has completed
+        std::size_t to_submit = count;
+        std::size_t completed = 0;
+        while (completed < count)
+        {
+          long ret = ::syscall(__NR_io_uring_enter, m_ring_fd,
+            static_cast<unsigned>(to_submit), 1U, IORING_ENTER_GETEVENTS, 0, 0);
+          if (ret < 0)
+          {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+              continue;
+            return false;
+          }
+          to_submit -= static_cast<std::size_t>(ret);
+
+          unsigned head = *m_cq_head;
+          unsigned cq_tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+          for (; head != cq_tail; ++head, ++completed)
+          {
+            const io_uring_cqe& cqe = m_cqes[head & *m_cq_mask];
+            results[cqe.user_data] = cqe.res;
+          }
+          __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+        }
+        return true;
+      }
+
+#   else
+      class io_engine {};  // never instantiated
+#   endif
+    }  // namespace detail
+
 # ifdef BOOST_WINDOWS_API
+
     BOOST_BTREE_DECL const binary_file::handle_type binary_file::invalid_handle
       = reinterpret_cast<binary_file::handle_type>(-1);
 #   endif
@@ -165,9 +355,21 @@ namespace boost
         ec.assign(errno, system_category());
         return false;
       }
+
+#     ifdef POSIX_FADV_RANDOM
+      //  the access pattern hints; failure is ignored, as for FILE_FLAG_RANDOM_ACCESS
+      if ((flags & oflag::random) != 0)
+        ::posix_fadvise(m_handle, 0, 0, POSIX_FADV_RANDOM);
+      if ((flags & oflag::sequential) != 0)
+        ::posix_fadvise(m_handle, 0, 0, POSIX_FADV_SEQUENTIAL);
+#     endif
 #   endif
 
       ec.clear();
+#   ifdef BOOST_BTREE_IO_URING
+      if (flags & oflag::async_io)
+        m_io_engine = detail::io_engine::create(m_handle);  // 0 if not available
+#   endif
       if (flags & oflag::seek_end)
       {
         seek(0, seekdir::end, ec);
@@ -191,6 +393,9 @@ namespace boost
     bool binary_file::close(system::error_code& ec)
     {
       ec.clear();
+      unmap(ec);
+      delete m_io_engine;
+      m_io_engine = 0;
 
 #   ifdef BOOST_WINDOWS_API
       if (m_handle == INVALID_HANDLE_VALUE)
@@ -225,6 +430,101 @@ namespace boost
           file_path(), ec));
     }
 
+//  ------------------------------------  map  ---------------------------------------  //
+
+    const char* binary_file::map(system::error_code& ec)
+    {
+      BOOST_ASSERT(is_open());
+      BOOST_ASSERT(!mapped());
+
+      offset_type sz = seek(0, seekdir::end, ec);
+      if (ec)
+        return 0;
+      if (sz == 0)
+      {
+        ec.assign(EINVAL, system::generic_category());  // can't map an empty file
+        return 0;
+      }
+
+#   ifdef BOOST_WINDOWS_API
+      HANDLE mh(::CreateFileMappingW(m_handle, 0, PAGE_READONLY, 0, 0, 0));
+      if (mh == 0)
+      {
+        ec.assign(::GetLastError(), system_category());
+        return 0;
+      }
+      void* p = ::MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+      if (p == 0)
+      {
+        ec.assign(::GetLastError(), system_category());
+        ::CloseHandle(mh);
+        return 0;
+      }
+      m_map_handle = mh;
+
+#   else  // BOOST_POSIX_API
+      void* p = ::mmap(0, static_cast<std::size_t>(sz), PROT_READ, MAP_SHARED,
+        m_handle, 0);
+      if (p == MAP_FAILED)
+      {
+        ec.assign(errno, system_category());
+        return 0;
+      }
+
+#   endif
+
+      m_map = static_cast<char*>(p);
+      m_map_size = sz;
+      ec.clear();
+      return m_map;
+    }
+
+    const char* binary_file::map()
+    {
+      error_code ec;
+      const char* p = map(ec);
+      if (ec)
+        BOOST_BTREE_THROW(filesystem::filesystem_error("binary_file::map",
+          file_path(), ec));
+      return p;
+    }
+
+//  -----------------------------------  unmap  --------------------------------------  //
+
+    bool binary_file::unmap(system::error_code& ec)
+    {
+      ec.clear();
+      if (!m_map)
+        return true;
+
+#   ifdef BOOST_WINDOWS_API
+      bool ok (::UnmapViewOfFile(m_map) != 0);
+      if (!ok)
+        ec.assign(::GetLastError(), system_category());
+      ::CloseHandle(m_map_handle);
+      m_map_handle = 0;
+
+#   else  // BOOST_POSIX_API
+      bool ok (::munmap(m_map, static_cast<std::size_t>(m_map_size)) == 0);
+      if (!ok)
+        ec.assign(errno, system_category());
+
+#   endif
+
+      m_map = 0;
+      m_map_size = 0;
+      return ok;
+    }
+
+    void binary_file::unmap()
+    {
+      error_code ec;
+      unmap(ec);
+      if (ec)
+        BOOST_BTREE_THROW(filesystem::filesystem_error("binary_file::unmap",
+          file_path(), ec));
+    }
+
 //  --------------------------------  destructor  ------------------------------------  //
 
     binary_file::~binary_file()
@@ -421,8 +721,322 @@ namespace boost
         BOOST_BTREE_THROW(filesystem::filesystem_error("binary_file::write", file_path(), ec));
     }
 
+//  ---------------------------------  read_at  --------------------------------------  //
+
+    bool binary_file::m_read_at(offset_type offset, void* target, std::size_t sz,
+      system::error_code& ec)
+    {
+      BOOST_ASSERT(is_open());
+//std::cout << "*** read_at " << m_path.string() << " offset " << offset
+//  << " into " << target << " size " << sz << std::endl;
+#   ifdef BOOST_WINDOWS_API
+      OVERLAPPED ov;
+      std::memset(&ov, 0, sizeof(ov));
+      ov.Offset = static_cast<DWORD>(offset);
+      ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+      DWORD sz_read;
+      if (!::ReadFile(handle(), target, DWORD(sz), &sz_read, &ov))
+      {
+        if (::GetLastError() == ERROR_HANDLE_EOF)  // normal eof
+        {
+          ec.clear();
+          return false;
+        }
+        ec.assign(::GetLastError(), system_category());
+        return false;
+      }
+      // As with m_read(), consider a partial read an error.
+      if (sz_read != 0 && sz_read != sz)
+      {
+        ec = error_code(ERROR_READ_FAULT, system_category());
+        return false;
+      }
+      ec.clear();
+      return sz_read != 0;
+
+#   else  // BOOST_POSIX_API
+      //  Allow for partial reads
+      ssize_t sz_read=0;
+      ssize_t sz_to_read=sz;
+      do
+      {
+        sz_read = ::pread(handle(), target, sz_to_read, static_cast< ::off_t>(offset));
+        if (sz_read < 0)
+        {
+          ec.assign(errno, system_category());
+          return false;
+        }
+        if (sz_read == 0)
+        {
+          if (sz_to_read == static_cast<ssize_t>(sz)) // no bytes read, so it is a normal eof
+            ec.clear();
+          else  // premature eof
+            ec.assign(EIO, system_category());
+          return false;
+        }
+        target = static_cast<char*>(target) + sz_read;
+        offset += sz_read;
+        sz_to_read -= sz_read;
+
+      } while (sz_to_read); // more to read
+
+      ec.clear();
+      return true;
+
+#   endif
+    }
+
+    bool binary_file::m_read_at(offset_type offset, void* target, std::size_t sz)
+    {
+      error_code ec;
+      bool result(m_read_at(offset, target, sz, ec));
+      if (ec)
+        BOOST_BTREE_THROW(filesystem::filesystem_error("binary_file::read_at",
+          file_path(), ec));
+      return result;
+    }
+
+//  --------------------------------  write_at  --------------------------------------  //
+
+    void binary_file::m_write_at(offset_type offset, const void* source, std::size_t sz,
+      system::error_code& ec)
+    {
+      BOOST_ASSERT(is_open());
+//std::cout << "*** write_at " << m_path.string() << " offset " << offset
+//  << " from " << source << " size " << sz << std::endl;
+#   ifdef BOOST_WINDOWS_API
+      OVERLAPPED ov;
+      std::memset(&ov, 0, sizeof(ov));
+      ov.Offset = static_cast<DWORD>(offset);
+      ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+      DWORD sz_written;
+      if (!::WriteFile(handle(), source, DWORD(sz), &sz_written, &ov))
+        ec.assign(::GetLastError(), system_category());
+      // As with m_write(), consider a partial write an error.
+      else if (sz_written != sz)
+        ec.assign(ERROR_WRITE_FAULT, system_category());
+      else
+        ec.clear();
+
+#   else // BOOST_POSIX_API
+      // Allow for partial writes
+      ssize_t sz_write = 0;
+      ssize_t sz_written = 0;
+      do
+      {
+        if ((sz_write = ::pwrite(handle(), static_cast<const char*>(source) + sz_written,
+          sz - sz_written, static_cast< ::off_t>(offset + sz_written))) < 0)
+        {
+          ec.assign(errno, system_category());
+          return;
+        }
+        sz_written += sz_write;
+      } while (sz_written < static_cast<ssize_t>(sz));
+      ec.clear();
+
+#   endif
+    }
+
+    void binary_file::m_write_at(offset_type offset, const void* source, std::size_t sz)
+    {
+      error_code ec;
+      m_write_at(offset, source, sz, ec);
+      if (ec)
+        BOOST_BTREE_THROW(filesystem::filesystem_error("binary_file::write_at",
+          file_path(), ec));
+    }
+
+//  ----------------------------  gather_write_at  -----------------------------------  //
+
+    void binary_file::gather_write_at(offset_type offset, const write_segment* segments,
+      std::size_t count, system::error_code& ec)
+    {
+      BOOST_ASSERT(is_open());
+      ec.clear();
+#   ifdef BOOST_WINDOWS_API
+      // WriteFileGather() requires unbuffered, page aligned I/O, so just write each
+      // segment in turn
+      for (std::size_t i = 0; i < count; ++i)
+      {
+        m_write_at(offset, segments[i].source, segments[i].size, ec);
+        if (ec)
+          return;
+        offset += segments[i].size;
+      }
+
+#   else // BOOST_POSIX_API
+#     ifdef IOV_MAX
+      const std::size_t max_iov = IOV_MAX;
+#     else
+      const std::size_t max_iov = 16;  // POSIX minimum, _XOPEN_IOV_MAX
+#     endif
+      ::iovec iov[max_iov < 1024 ? max_iov : 1024];
+      const std::size_t iov_cap = sizeof(iov) / sizeof(iov[0]);
+
+      std::size_t seg = 0;       // first segment not yet completely written
+      std::size_t seg_done = 0;  // bytes of segments[seg] already written
+      while (seg < count)
+      {
+        std::size_t n = 0;
+        for (; n < iov_cap && seg + n < count; ++n)
+        {
+          iov[n].iov_base = const_cast<char*>(
+            static_cast<const char*>(segments[seg + n].source) + (n ? 0 : seg_done));
+          iov[n].iov_len = segments[seg + n].size - (n ? 0 : seg_done);
+        }
+        ssize_t sz_written = ::pwritev(handle(), iov, static_cast<int>(n),
+          static_cast< ::off_t>(offset));
+        if (sz_written < 0)
+        {
+          ec.assign(errno, system_category());
+          return;
+        }
+        offset += sz_written;
+
+        // advance past what was written, allowing for a partial write
+        std::size_t remaining = static_cast<std::size_t>(sz_written);
+        while (seg < count && remaining >= segments[seg].size - seg_done)
+        {
+          remaining -= segments[seg].size - seg_done;
+          seg_done = 0;
+          ++seg;
+        }
+        seg_done += remaining;
+      }
+
+#   endif
+    }
+
+    void binary_file::gather_write_at(offset_type offset, const write_segment* segments,
+      std::size_t count)
+    {
+      error_code ec;
+      gather_write_at(offset, segments, count, ec);
+      if (ec)
+        BOOST_BTREE_THROW(filesystem::filesystem_error("binary_file::gather_write_at",
+          file_path(), ec));
+    }
+
+//  ------------------------------  read_batch_at  -----------------------------------  //
+
+    bool binary_file::read_batch_at(const io_request* requests, std::size_t count,
+      system::error_code& ec)
+    {
+      BOOST_ASSERT(is_open());
+      return m_run_batch(true, requests, count, ec);
+    }
+
+    bool binary_file::read_batch_at(const io_request* requests, std::size_t count)
+    {
+      error_code ec;
+      bool result(read_batch_at(requests, count, ec));
+      if (ec)
+        BOOST_BTREE_THROW(filesystem::filesystem_error("binary_file::read_batch_at",
+          file_path(), ec));
+      return result;
+    }
+
+//  ------------------------------  write_batch_at  ----------------------------------  //
+
+    void binary_file::write_batch_at(const io_request* requests, std::size_t count,
+      system::error_code& ec)
+    {
+      BOOST_ASSERT(is_open());
+      m_run_batch(false, requests, count, ec);
+    }
+
+    void binary_file::write_batch_at(const io_request* requests, std::size_t count)
+    {
+      error_code ec;
+      write_batch_at(requests, count, ec);
+      if (ec)
+        BOOST_BTREE_THROW(filesystem::filesystem_error("binary_file::write_batch_at",
+          file_path(), ec));
+    }
+
+//  -------------------------------  m_run_batch  ------------------------------------  //
+
+    bool binary_file::m_run_batch(bool is_read, const io_request* requests,
+      std::size_t count, system::error_code& ec)
+    {
+      ec.clear();
+      bool ok = true;
+
+#   ifdef BOOST_BTREE_IO_URING
+      if (m_io_engine && count > 1)  // a single request is cheaper as a plain pread
+      {
+        std::vector<long> results(count);
+        if (m_io_engine->run(is_read, requests, count, &results[0]))
+        {
+          //  finish synchronously any short transfers, and any requests the kernel
+          //  could not perform asynchronously, such as -EINVAL from a kernel that
+          //  predates IORING_OP_READ and IORING_OP_WRITE
+          for (std::size_t i = 0; i < count; ++i)
+          {
+            long res = results[i];
+            if (res == static_cast<long>(requests[i].size))
+              continue;
+            if (res < 0 && res != -EINVAL && res != -EOPNOTSUPP)
+            {
+              ec.assign(static_cast<int>(-res), system_category());
+              return false;
+            }
+            std::size_t done = res < 0 ? 0 : static_cast<std::size_t>(res);
+            if (is_read)
+            {
+              if (!m_read_at(requests[i].offset + done, requests[i].data + done,
+                requests[i].size - done, ec))
+              {
+                if (!ec && done)  // premature eof
+                  ec.assign(EIO, system_category());
+                ok = false;
+              }
+            }
+            else
+              m_write_at(requests[i].offset + done, requests[i].data + done,
+                requests[i].size - done, ec);
+            if (ec)
+              return false;
+          }
+          return ok;
+        }
+        //  the ring failed; give up on it and do the whole batch synchronously
+        delete m_io_engine;
+        m_io_engine = 0;
+      }
+#   endif
+
+      for (std::size_t i = 0; i < count; ++i)
+      {
+        if (is_read)
+        {
+          if (!m_read_at(requests[i].offset, requests[i].data, requests[i].size, ec))
+            ok = false;
+        }
+        else
+          m_write_at(requests[i].offset, requests[i].data, requests[i].size, ec);
+        if (ec)
+          return false;
+      }
+      return ok;
+    }
+
+//  --------------------------------  will_need  -------------------------------------  //
+
+    void binary_file::will_need(offset_type offset, std::size_t sz)
+    {
+      BOOST_ASSERT(is_open());
+#   if defined(BOOST_POSIX_API) && defined(POSIX_FADV_WILLNEED)
+      ::posix_fadvise(m_handle, offset, static_cast< ::off_t>(sz), POSIX_FADV_WILLNEED);
+#   else
+      (void)offset;
+      (void)sz;
+#   endif
+    }
+
 //  -----------------------------------  seek  ---------------------------------------  //
 
+
     binary_file::offset_type
     binary_file::seek(offset_type offset, seekdir::pos from, system::error_code& ec)
     {
@@ -12,41 +12,261 @@
 #define BOOST_BTREE_SOURCE 
 
 #include <boost/btree/detail/buffer_manager.hpp>
+#include <boost/btree/support/timer.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/bind/bind.hpp>
+#include <exception>
 #include <ostream>
+#include <algorithm>
 
 namespace boost
 {
 namespace btree
 {
+//------------------------------------ latch_wait() ------------------------------------//
+
+void latch_wait(unsigned k)
+{
+  if (k < 16)
+    return;
+  if (k < 32)
+    boost::this_thread::yield();
+  else
+    boost::this_thread::sleep(boost::posix_time::microseconds(1));
+}
+
+//---------------------------------- optimistic_copy() --------------------------------//
+
+//  The source races with writers by design, as in a seqlock; the reader validates the
+//  copy afterwards. The loads are atomic, but the writers' stores are not, so a thread
+//  sanitizer would report the race it is designed to tolerate.
+
+#if defined(__SANITIZE_THREAD__)
+# define BOOST_BTREE_NO_SANITIZE_THREAD __attribute__((no_sanitize_thread))
+#elif defined(__has_feature)
+# if __has_feature(thread_sanitizer)
+#   define BOOST_BTREE_NO_SANITIZE_THREAD __attribute__((no_sanitize("thread")))
+# endif
+#endif
+#ifndef BOOST_BTREE_NO_SANITIZE_THREAD
+# define BOOST_BTREE_NO_SANITIZE_THREAD
+#endif
+
+BOOST_BTREE_NO_SANITIZE_THREAD
+void optimistic_copy(void* to, const void* from, std::size_t n)
+{
+  unsigned char* p = static_cast<unsigned char*>(to);
+  const unsigned char* q = static_cast<const unsigned char*>(from);
+#if defined(__GNUC__)
+  for (; n; --n)
+    *p++ = __atomic_load_n(q++, __ATOMIC_RELAXED);
+#else
+  std::memcpy(p, q, n);
+#endif
+}
+
+//--------------------------------------------------------------------------------------//
+//                                    buffer_index                                      //
+//--------------------------------------------------------------------------------------//
+
+//------------------------------------- insert() ---------------------------------------//
+
+void buffer_index::insert(buffer& buf)
+{
+  BOOST_ASSERT(!find(buf.buffer_id()));
+  if ((m_size + 1) * 2 > m_capacity)
+    m_grow();
+  std::size_t i = m_home(buf.buffer_id());
+  while (m_slots[i].ptr)
+    i = (i + 1) & (m_capacity - 1);
+  m_slots[i].id = buf.buffer_id();
+  m_slots[i].ptr = &buf;
+  ++m_size;
+}
+
+//------------------------------------- erase() ----------------------------------------//
+
+void buffer_index::erase(const buffer& buf)
+{
+  BOOST_ASSERT(m_size);
+  const std::size_t mask = m_capacity - 1;
+  std::size_t i = m_home(buf.buffer_id());
+  while (m_slots[i].ptr != &buf)
+  {
+    BOOST_ASSERT_MSG(m_slots[i].ptr, "buffer_index::erase() of buffer not present");
+    i = (i + 1) & mask;
+  }
+
+  //  backward shift deletion: move later members of the probe sequence into the hole
+  //  unless their home slot lies cyclically in (hole, j]
+  for (std::size_t j = (i + 1) & mask; m_slots[j].ptr; j = (j + 1) & mask)
+  {
+    std::size_t home = m_home(m_slots[j].id);
+    if (i <= j ? (home <= i || home > j) : (home <= i && home > j))
+    {
+      m_slots[i] = m_slots[j];
+      i = j;
+    }
+  }
+  m_slots[i].ptr = 0;
+  --m_size;
+}
+
+//------------------------------------- clear() ----------------------------------------//
+
+void buffer_index::clear()
+{
+  for (std::size_t i = 0; i < m_capacity; ++i)
+    m_slots[i].ptr = 0;
+  m_size = 0;
+}
+
+//------------------------------------- m_grow() ---------------------------------------//
+
+void buffer_index::m_grow()
+{
+  slot* old_slots = m_slots;
+  std::size_t old_capacity = m_capacity;
+
+  m_capacity = old_capacity ? old_capacity * 2 : 16;
+  m_shift = old_capacity ? m_shift - 1 : 28;  // 32 - log2(16) == 28
+  m_slots = new slot[m_capacity];
+  for (std::size_t i = 0; i < m_capacity; ++i)
+    m_slots[i].ptr = 0;
+
+  for (std::size_t i = 0; i < old_capacity; ++i)
+  {
+    if (old_slots[i].ptr)
+    {
+      std::size_t j = m_home(old_slots[i].id);
+      while (m_slots[j].ptr)
+        j = (j + 1) & (m_capacity - 1);
+      m_slots[j] = old_slots[i];
+    }
+  }
+  delete [] old_slots;
+}
+
+//--------------------------------------------------------------------------------------//
+//                                 replacement policies                                 //
+//--------------------------------------------------------------------------------------//
+
+//----------------------------------- lru_policy ---------------------------------------//
+
+buffer* lru_policy::victim()
+{
+  if (m_list.empty())
+    return 0;
+  buffer* buf = &m_list.front();
+  m_list.pop_front();
+  return buf;
+}
+
+//-------------------------------- two_queue_policy ------------------------------------//
+
+void two_queue_policy::released(buffer& buf)
+{
+  if (buf.retain() || (buf.policy_state() & referenced))
+  {
+    buf.policy_state(on_protected);
+    m_protected.push_back(buf);
+  }
+  else
+  {
+    buf.policy_state(0);
+    m_probation.push_back(buf);
+  }
+}
+
+void two_queue_policy::reclaimed(buffer& buf)
+{
+  if (buf.policy_state() & on_protected)
+    m_protected.erase(m_protected.iterator_to(buf));
+  else
+    m_probation.erase(m_probation.iterator_to(buf));
+  buf.policy_state(referenced);  // read while available, so promote when next released
+}
+
+buffer* two_queue_policy::victim()
+{
+  buffer_list* queue;
+  if (m_probation.empty())
+    queue = &m_protected;
+  else if (m_protected.size() * 100 > size() * m_protected_percent)
+    queue = &m_protected;
+  else
+    queue = &m_probation;
+  if (queue->empty())
+    return 0;
+  buffer* buf = &queue->front();
+  queue->pop_front();
+  buf->policy_state(0);
+  return buf;
+}
+
+//--------------------------------------------------------------------------------------//
+//                                   buffer_manager                                     //
+//--------------------------------------------------------------------------------------//
+
+struct buffer_manager::flusher
+{
+  boost::mutex               mutex;  // held by the flusher except while waiting
+  boost::condition_variable  wake;
+  bool                       stop;
+  unsigned                   high_percent;
+  unsigned                   low_percent;
+  boost::thread              thread;
+
+  //  m_flusher_pass() workspace, kept to avoid reallocation on every pass
+  std::vector<buffer*>         buffers;  // the buffers copied
+  std::vector<buffer_id_type>  ids;      // their ids when copied
+  std::vector<char>            copies;
+};
+
+//---------------------------------- replacement() -------------------------------------//
+
+void buffer_manager::replacement(replacement_policy& p)
+{
+  if (&p == m_policy)
+    return;
+  //  oldest first, so that p sees the buffers in the same relative order
+  while (buffer* buf = m_policy->victim())
+    p.released(*buf);
+  m_policy = &p;
+}
+
 //------------------------------------ close() -----------------------------------------//
 
 void buffer_manager::close()
 {
   BOOST_ASSERT(is_open());
 
-  buffer_cache.clear();
+  stop_flusher();
+  flush();
+  if (concurrent())
+  {
+    m_unpin_all();
+    m_shared_close();
+  }
+  m_policy->clear();
 
-  // clear buffers, deleting those with use_count() == 0
-  for (buffers_type::iterator itr = buffers.begin(); itr != buffers.end();)
+  // clear buffers, deleting those with use_count() == 0; the index only holds pointers,
+  // so it is safe to delete buffers while iterating and clear the index afterwards
+  for (buffers_type::iterator itr = buffers.begin(); itr != buffers.end(); ++itr)
   {
-    if (itr->needs_write())
-    {
-      write(*itr);
-      itr->needs_write(false);
-    }
-    buffers_type::iterator cur = itr++;
-    buffer* buf = &*cur;
-    buffers.erase(cur);
+    buffer* buf = &*itr;
     if (buf->use_count() == 0)
     {
       //std::cout << "   deleting buffer " << buf->buffer_id() << " at " << buf << std::endl;
       delete buf;
     }
     else
-      cur->manager(0);  // mark buffer as orphaned; it has outlived its manager
+      buf->manager(0);  // mark buffer as orphaned; it has outlived its manager
   }
-  BOOST_ASSERT(buffers.empty());
-  BOOST_ASSERT(buffer_cache.empty());
+  buffers.clear();
+  BOOST_ASSERT(!m_policy->size());
   //std::cout << " all buffers deleted" << std::endl;
   binary_file::close();
   m_buffer_count = 0;
@@ -75,14 +295,33 @@ bool buffer_manager::open(const boost::filesystem::path& p, oflag::bitmask flags
   BOOST_ASSERT(!is_open());
   BOOST_ASSERT(data_sz);
   BOOST_ASSERT(buffers.empty());
-  BOOST_ASSERT(buffer_cache.empty());
+  BOOST_ASSERT(!m_policy->size());
+
+  BOOST_ASSERT_MSG(!(flags & oflag::mapped) || !(flags & (oflag::out | oflag::truncate)),
+    "oflag::mapped requires a read-only file");
 
   m_buffer_count = 0;
   m_data_size = data_sz;
   m_max_cache_size = max_cache_pgs;
+  m_map_requested = (flags & oflag::mapped) != 0;
 
   m_active_buffers_read = m_cached_buffers_read = m_file_buffers_read
-    = m_file_buffers_written = m_new_buffer_requests = m_buffer_allocs = 0;
+    = m_file_buffers_written = m_new_buffer_requests = m_buffer_allocs
+    = m_flush_writes = m_batch_reads = m_buffers_prefetched = 0;
+  m_flusher_microseconds = 0;
+  m_flusher_failed = false;
+  m_flusher_error.clear();
+
+  m_shards.reset(flags & oflag::concurrent ? new shard[shard_count] : 0);
+  m_pins.reset(flags & oflag::concurrent
+    ? new boost::atomic<pin_slot*>[pin_limit / pin_chunk_size] : 0);
+  for (std::size_t i = 0; m_pins && i < pin_limit / pin_chunk_size; ++i)
+    m_pins[i].store(0, boost::memory_order_relaxed);
+  for (std::size_t i = 0; m_shards && i < shard_count; ++i)
+    m_shards[i].active_buffers_read = m_shards[i].cached_buffers_read
+      = m_shards[i].file_buffers_read = m_shards[i].buffer_allocs
+      = m_shards[i].file_buffers_written = m_shards[i].flusher_buffers_written
+      = m_shards[i].buffers_prefetched = 0;
 
   if (flags & oflag::truncate)
     flags |= oflag::out;
@@ -109,6 +348,8 @@ void buffer_manager::data_size(data_size_type sz)
     BOOST_BUFFER_FILE_THROW(buffer_manager_error(
       "buffer_manager_error: file size error; too large or not multiple of data size: ",
       binary_file::file_path()));
+  if (m_map_requested && m_buffer_count)
+    binary_file::map();
 }
 
 //------------------------------- m_prepare_buffer() -----------------------------------//
@@ -117,8 +358,8 @@ buffer* buffer_manager::m_prepare_buffer(buffer_id_type pg_id)
 {
   buffer* pg;
 
-  if (buffer_cache.empty()
-    || buffer_cache.size() < max_cache_size())
+  if (!m_policy->size()
+    || m_policy->size() < max_cache_size())
   {
     // allocate a new buffer
     pg = m_alloc(pg_id, *this);
@@ -130,16 +371,17 @@ buffer* buffer_manager::m_prepare_buffer(buffer_id_type pg_id)
   else
   {
     // reuse an existing buffer
-    BOOST_ASSERT(!buffer_cache.empty());
-    pg = &*buffer_cache.begin();
-    buffer_cache.pop_front();
-    buffers.erase(buffers.iterator_to(*pg));
+    pg = m_policy->victim();
+    BOOST_ASSERT(pg);
+    buffers.erase(*pg);
     if (pg->needs_write())
     {
       write(*pg);
       pg->m_needs_write = false;
     }
     pg->reuse(pg_id);
+    if (mapped())
+      pg->m_data = m_mapped_data(pg_id);
   }
   buffers.insert(*pg);
   return pg;
@@ -151,7 +393,10 @@ buffer_ptr buffer_manager::new_buffer()
 {
   BOOST_ASSERT(is_open());
   BOOST_ASSERT(data_size());
+  BOOST_ASSERT_MSG(!mapped(), "new_buffer() on mapped, hence read-only, buffer_manager");
   ++m_new_buffer_requests;
+  if (concurrent())
+    return m_shared_reuse(m_buffer_count++);
   buffer* pg = m_prepare_buffer(m_buffer_count++);
   // clear the memory; this makes troubleshooting ever so much easier
   std::memset(pg->data(), 0, data_size());
@@ -167,25 +412,28 @@ buffer_ptr buffer_manager::read(buffer_id_type pg_id)
   BOOST_ASSERT(data_size());
   BOOST_ASSERT(pg_id < buffer_count());
 
-  buffer key(pg_id);   // TODO: move the key buffer to buffer_manager to avoid construction
+  if (concurrent())
+    return m_shared_read(pg_id);
 
-  buffers_type::iterator found = buffers.find(key);
+  buffer* found = buffers.find(pg_id);
 
-  if (found == buffers.end()) // the buffer is not in memory
+  if (!found) // the buffer is not in memory
   {
     ++m_file_buffers_read;
     buffer* pg = m_prepare_buffer(pg_id);
-    binary_file::seek(pg_id * data_size());
-    binary_file::read(*pg->data(), data_size());
+    if (!mapped())  // a mapped buffer's data() already points to its contents
+    {
+      binary_file::read_at(static_cast<offset_type>(pg_id) * data_size(),
+        *pg->data(), data_size());
+    }
     return buffer_ptr(*pg);
   }
   else // the buffer is in memory
   {
-    if (found->use_count() == 0)  // buffer not in use, but is in buffer_cache
+    if (found->use_count() == 0)  // buffer not in use, but is available
     { 
       ++m_cached_buffers_read;
-      // remove from buffer_cache
-      buffer_cache.erase(buffer_cache.iterator_to(*found));  
+      m_policy->reclaimed(*found);
     }
     else
       ++m_active_buffers_read;
@@ -193,14 +441,568 @@ buffer_ptr buffer_manager::read(buffer_id_type pg_id)
   }
 }
  
+//-------------------------------------- reuse() ---------------------------------------//
+
+buffer_ptr buffer_manager::reuse(buffer_id_type pg_id)
+{
+  BOOST_ASSERT(is_open());
+  BOOST_ASSERT(data_size());
+  BOOST_ASSERT(pg_id < buffer_count());
+  BOOST_ASSERT_MSG(!mapped(), "reuse() on mapped, hence read-only, buffer_manager");
+
+  if (concurrent())
+  {
+    ++m_new_buffer_requests;
+    return m_shared_reuse(pg_id);
+  }
+
+  buffer* pg = buffers.find(pg_id);
+  if (pg)
+  {
+    if (pg->use_count() == 0)
+    { 
+      ++m_cached_buffers_read;
+      m_policy->reclaimed(*pg);
+    }
+    else
+      ++m_active_buffers_read;
+  }
+  else
+  {
+    ++m_new_buffer_requests;
+    pg = m_prepare_buffer(pg_id);
+    std::memset(pg->data(), 0, data_size());
+  }
+  pg->needs_write(true);
+  return buffer_ptr(*pg);
+}
+ 
+//------------------------------------- read_many() ------------------------------------//
+
+void buffer_manager::read_many(const buffer_id_type* ids, std::size_t count,
+  buffer_ptr* result)
+{
+  BOOST_ASSERT(is_open());
+  BOOST_ASSERT(data_size());
+
+  if (concurrent())
+  {
+    for (std::size_t i = 0; i < count; ++i)
+      result[i] = read(ids[i]);
+    return;
+  }
+
+  //  buffers in memory are handled as by read(); the others are prepared, held by
+  //  result so they can't be reused, and then read as one batch
+  std::vector<io_request> requests;
+  std::vector<buffer*> prepared;
+  try
+  {
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      BOOST_ASSERT(ids[i] < buffer_count());
+      if (buffers.find(ids[i]) || mapped())
+        result[i] = read(ids[i]);  // includes ids repeated earlier in this batch
+      else
+      {
+        ++m_file_buffers_read;
+        buffer* pg = m_prepare_buffer(ids[i]);
+        prepared.push_back(pg);
+        result[i] = buffer_ptr(*pg);
+        offset_type off
+          = static_cast<offset_type>(ids[i]) * static_cast<offset_type>(data_size());
+        io_request rq = { off, pg->data(), data_size() };
+        requests.push_back(rq);
+      }
+    }
+    if (requests.empty())
+      return;
+    ++m_batch_reads;
+    if (!binary_file::read_batch_at(&requests[0], requests.size()))
+      BOOST_BUFFER_FILE_THROW(buffer_manager_error(
+        "buffer_manager_error: read_many() premature end-of-file: ", file_path()));
+  }
+  catch (...)
+  {
+    m_discard(prepared, result, count);
+    throw;
+  }
+}
+
+//------------------------------------- m_discard() ------------------------------------//
+
+void buffer_manager::m_discard(const std::vector<buffer*>& prepared, buffer_ptr* result,
+  std::size_t count)
+{
+  //  the prepared buffers are in the index but hold no valid contents, so must not be
+  //  found by read() or handed to the replacement policy; an id of -1, as for dummy
+  //  buffers, keeps dec_use_count() from releasing them to the policy
+  for (std::vector<buffer*>::const_iterator it = prepared.begin();
+    it != prepared.end(); ++it)
+  {
+    buffers.erase(**it);
+    (*it)->m_buffer_id = static_cast<buffer_id_type>(-1);
+  }
+  for (std::size_t i = 0; i < count; ++i)
+    result[i].reset();
+  for (std::vector<buffer*>::const_iterator it = prepared.begin();
+    it != prepared.end(); ++it)
+    delete *it;
+}
+
+//------------------------------------- prefetch() -------------------------------------//
+
+void buffer_manager::prefetch(const buffer_id_type* ids, std::size_t count)
+{
+  BOOST_ASSERT(is_open());
+  BOOST_ASSERT(data_size());
+
+  if (mapped())
+    return;
+
+  //  hint each run of adjacent ids not in memory with a single will_need() call
+  buffer_id_type run_begin = 0;
+  std::size_t run_size = 0;
+  for (std::size_t i = 0; i <= count; ++i)
+  {
+    bool wanted = false;
+    if (i < count && ids[i] < buffer_count())
+    {
+      if (concurrent())
+      {
+        shard& sh = m_shard(ids[i]);
+        boost::detail::lightweight_mutex::scoped_lock lock(sh.mutex);
+        if (!sh.buffers.find(ids[i]))
+        {
+          wanted = true;
+          ++sh.buffers_prefetched;
+        }
+      }
+      else if (!buffers.find(ids[i]))
+      {
+        wanted = true;
+        ++m_buffers_prefetched;
+      }
+    }
+
+    if (wanted && run_size && ids[i] == run_begin + run_size)
+      ++run_size;
+    else
+    {
+      if (run_size)
+        binary_file::will_need(static_cast<offset_type>(run_begin) * data_size(),
+          run_size * data_size());
+      run_begin = wanted ? ids[i] : 0;
+      run_size = wanted ? 1 : 0;
+    }
+  }
+}
+
+//---------------------------------- m_shared_read() -----------------------------------//
+
+//  Invariant, for concurrent(): while a shard's mutex is not held, each of its buffers
+//  is on its available list if and only if its use_count() is 0. The count only leaves
+//  or reaches 0 with the mutex held, here and in m_shared_release(), so an available
+//  buffer has no buffer_ptr's anywhere and may be reused.
+
+buffer* buffer_manager::m_shared_prepare(shard& sh, buffer_id_type pg_id)
+//  Returns: a buffer for pg_id, not yet in sh.buffers, reusing the least recently used
+//    available buffer of the shard if the shard's share of the cache is full
+//  Requires: sh.mutex is held
+{
+  //  a buffer whose copy the flusher is writing is passed over, lest a newer write of
+  //  its contents here land before the flusher's
+  buffer* pg = 0;
+  if (sh.available.size()
+    && sh.available.size() >= (max_cache_size() + shard_count - 1) / shard_count)
+  {
+    for (lru_policy::iterator itr = sh.available.begin(); itr != sh.available.end();
+      ++itr)
+      if (itr->m_flusher_copy == buffer::not_copied)
+      {
+        pg = &*itr;
+        break;
+      }
+  }
+  if (pg)
+  {
+    sh.available.reclaimed(*pg);
+    sh.buffers.erase(*pg);
+    if (pg->needs_write())
+    {
+      binary_file::write_at(static_cast<offset_type>(pg->buffer_id()) * data_size(),
+        pg->data(), data_size());
+      pg->needs_write(false);
+      ++sh.file_buffers_written;
+      if (m_flusher)
+        m_flusher->wake.notify_one();  // the flusher is falling behind
+    }
+    pg->reuse(pg_id);
+    if (mapped())
+      pg->m_data = m_mapped_data(pg_id);
+  }
+  else
+  {
+    pg = m_alloc(pg_id, *this);
+    ++sh.buffer_allocs;
+  }
+  return pg;
+}
+
+buffer_ptr buffer_manager::m_shared_read(buffer_id_type pg_id)
+{
+  shard& sh = m_shard(pg_id);
+  boost::detail::lightweight_mutex::scoped_lock lock(sh.mutex);
+
+  buffer* pg = sh.buffers.find(pg_id);
+  if (pg)
+  {
+    if (pg->use_count() == 0)
+    {
+      ++sh.cached_buffers_read;
+      sh.available.reclaimed(*pg);
+      if (pg->m_flusher_copy)  // its user may change it; see m_flusher_pass()
+        pg->m_flusher_copy = buffer::copied_changed;
+    }
+    else
+      ++sh.active_buffers_read;
+    return buffer_ptr(*pg);
+  }
+
+  ++sh.file_buffers_read;
+  pg = m_shared_prepare(sh, pg_id);
+  //  read with the mutex held, since once in the index the buffer may be found by
+  //  other threads; this only delays reads of other buffers in the same shard
+  if (!mapped())
+  {
+    try
+    {
+      binary_file::read_at(static_cast<offset_type>(pg_id) * data_size(),
+        *pg->data(), data_size());
+    }
+    catch (...)
+    {
+      delete pg;
+      throw;
+    }
+  }
+  sh.buffers.insert(*pg);
+  return buffer_ptr(*pg);
+}
+
+//---------------------------------- m_shared_reuse() ----------------------------------//
+
+buffer_ptr buffer_manager::m_shared_reuse(buffer_id_type pg_id)
+//  new_buffer() and reuse() for concurrent()
+{
+  shard& sh = m_shard(pg_id);
+  boost::detail::lightweight_mutex::scoped_lock lock(sh.mutex);
+
+  buffer* pg = sh.buffers.find(pg_id);
+  if (pg)
+  {
+    if (pg->use_count() == 0)
+    {
+      ++sh.cached_buffers_read;
+      sh.available.reclaimed(*pg);
+      if (pg->m_flusher_copy)  // its user may change it; see m_flusher_pass()
+        pg->m_flusher_copy = buffer::copied_changed;
+    }
+    else
+      ++sh.active_buffers_read;
+  }
+  else
+  {
+    pg = m_shared_prepare(sh, pg_id);
+    std::memset(pg->data(), 0, data_size());
+    sh.buffers.insert(*pg);
+  }
+  pg->needs_write(true);
+  return buffer_ptr(*pg);
+}
+
+//--------------------------------- m_shared_release() ---------------------------------//
+
+void buffer_manager::m_shared_release(buffer& buf)
+{
+  //  the common case, dropping a reference other than the last, takes no lock
+  buffer::use_count_type n = buf.m_use_count.load(boost::memory_order_relaxed);
+  while (n > 1)
+  {
+    if (buf.m_use_count.compare_exchange_weak(n, n - 1, boost::memory_order_release,
+      boost::memory_order_relaxed))
+      return;
+  }
+
+  shard& sh = m_shard(buf.buffer_id());
+  boost::detail::lightweight_mutex::scoped_lock lock(sh.mutex);
+  if (buf.m_use_count.fetch_sub(1, boost::memory_order_acq_rel) == 1)
+    sh.available.released(buf);  // reused by a later m_shared_read() of another id
+}
+
+//---------------------------------- m_shared_close() ----------------------------------//
+
+void buffer_manager::m_shared_close()
+{
+  for (std::size_t i = 0; i < shard_count; ++i)
+  {
+    shard& sh = m_shards[i];
+    sh.available.clear();
+    for (buffers_type::iterator itr = sh.buffers.begin(); itr != sh.buffers.end(); ++itr)
+    {
+      if (itr->use_count() == 0)
+        delete &*itr;
+      else
+        itr->manager(0);  // orphaned
+    }
+    sh.buffers.clear();
+  }
+  m_shards.reset();
+}
+
+//------------------------------------- pin() ------------------------------------------//
+
+const std::size_t buffer_manager::pin_chunk_size;
+const std::size_t buffer_manager::pin_limit;
+
+void buffer_manager::pin(buffer& pg)
+{
+  BOOST_ASSERT_MSG(concurrent(), "pin() requires oflag::concurrent");
+  buffer_id_type id = pg.buffer_id();
+  if (id >= pin_limit)
+    return;
+  boost::atomic<pin_slot*>& slots = m_pins[id / pin_chunk_size];
+  pin_slot* chunk = slots.load(boost::memory_order_acquire);
+  if (!chunk)  // racing pin() calls may each allocate the chunk; one wins
+  {
+    pin_slot* fresh = new pin_slot[pin_chunk_size];
+    for (std::size_t i = 0; i < pin_chunk_size; ++i)
+      fresh[i].store(0, boost::memory_order_relaxed);
+    if (slots.compare_exchange_strong(chunk, fresh, boost::memory_order_acq_rel,
+      boost::memory_order_acquire))
+      chunk = fresh;
+    else
+      delete [] fresh;
+  }
+  pin_slot& slot = chunk[id % pin_chunk_size];
+  buffer* expected = 0;
+  if (slot.load(boost::memory_order_relaxed))
+    return;
+  pg.inc_use_count();  // held by the pin; the caller's use count keeps it above 1
+  if (!slot.compare_exchange_strong(expected, &pg, boost::memory_order_acq_rel,
+    boost::memory_order_relaxed))
+    pg.dec_use_count();  // pinned meanwhile by another thread
+}
+
+//------------------------------------ unpin() -----------------------------------------//
+
+void buffer_manager::unpin(buffer_id_type buffer_id)
+{
+  if (!m_pins || buffer_id >= pin_limit)
+    return;
+  pin_slot* chunk = m_pins[buffer_id / pin_chunk_size].load(boost::memory_order_acquire);
+  buffer* pg = chunk
+    ? chunk[buffer_id % pin_chunk_size].exchange(0, boost::memory_order_acq_rel) : 0;
+  if (pg)
+    pg->dec_use_count();
+}
+
+void buffer_manager::m_unpin_all()
+{
+  for (std::size_t i = 0; i < pin_limit / pin_chunk_size; ++i)
+  {
+    pin_slot* chunk = m_pins[i].exchange(0, boost::memory_order_acq_rel);
+    for (std::size_t j = 0; chunk && j < pin_chunk_size; ++j)
+      if (buffer* pg = chunk[j].load(boost::memory_order_relaxed))
+        pg->dec_use_count();
+    delete [] chunk;
+  }
+  m_pins.reset();
+}
+
+const unsigned buffer_manager::flusher_interval;  // bound to a reference below
+
+//---------------------------------- start_flusher() -----------------------------------//
+
+void buffer_manager::start_flusher(unsigned high_percent, unsigned low_percent)
+{
+  BOOST_ASSERT(is_open());
+  BOOST_ASSERT_MSG(concurrent(), "start_flusher() requires oflag::concurrent");
+  BOOST_ASSERT_MSG(!mapped(), "start_flusher() on mapped, hence read-only, buffer_manager");
+  BOOST_ASSERT_MSG(low_percent < high_percent && high_percent <= 100,
+    "start_flusher() requires low_percent < high_percent <= 100");
+  if (m_flusher && m_flusher_failed)
+    stop_flusher();  // joins the ended thread, so that a new one can start
+  if (m_flusher)
+  {
+    boost::lock_guard<boost::mutex> lock(m_flusher->mutex);
+    m_flusher->high_percent = high_percent;
+    m_flusher->low_percent = low_percent;
+    return;
+  }
+  m_flusher_failed = false;
+  m_flusher_error.clear();
+  m_flusher = new flusher;
+  m_flusher->stop = false;
+  m_flusher->high_percent = high_percent;
+  m_flusher->low_percent = low_percent;
+  m_flusher->thread = boost::thread(boost::bind(&buffer_manager::m_flusher_run, this));
+}
+
+//---------------------------------- stop_flusher() ------------------------------------//
+
+void buffer_manager::stop_flusher()
+{
+  if (!m_flusher)
+    return;
+  {
+    boost::lock_guard<boost::mutex> lock(m_flusher->mutex);
+    m_flusher->stop = true;
+  }
+  m_flusher->wake.notify_one();
+  m_flusher->thread.join();
+  delete m_flusher;
+  m_flusher = 0;
+}
+
+//---------------------------------- m_flusher_run() -----------------------------------//
+
+void buffer_manager::m_flusher_run()
+{
+  boost::unique_lock<boost::mutex> lock(m_flusher->mutex);
+  try
+  {
+    while (!m_flusher->stop)
+    {
+      for (std::size_t i = 0; i < shard_count; ++i)
+        m_flusher_pass(m_shards[i], m_flusher->high_percent, m_flusher->low_percent);
+      m_flusher->wake.timed_wait(lock,
+        boost::posix_time::milliseconds(flusher_interval));
+    }
+  }
+  //  a write error ends the flusher; the buffers still need writing, so the error is
+  //  also reported to whichever thread writes them next
+  catch (const std::exception& ex)
+  {
+    m_flusher_error = ex.what();
+    m_flusher_failed = true;
+  }
+  catch (...)
+  {
+    m_flusher_error = "unknown exception";
+    m_flusher_failed = true;
+  }
+}
+
+//--------------------------------- m_flusher_pass() -----------------------------------//
+
+void buffer_manager::m_flusher_pass(shard& sh, unsigned high_percent,
+  unsigned low_percent)
+//  The least recently used available buffers that need writing are copied with
+//  sh.mutex held; available buffers have no users, so can't change meanwhile. The
+//  copies are written with the mutex released. Meanwhile the buffers are not reused,
+//  see m_shared_prepare(), and one read again may change, so is marked
+//  copied_changed and still needs writing afterwards.
+{
+  std::vector<buffer*>& bufs = m_flusher->buffers;
+  std::vector<buffer_id_type>& ids = m_flusher->ids;
+  std::vector<char>& copies = m_flusher->copies;
+  bufs.clear();
+  ids.clear();
+  {
+    boost::detail::lightweight_mutex::scoped_lock lock(sh.mutex);
+    std::size_t share = (max_cache_size() + shard_count - 1) / shard_count;
+    std::size_t dirty = 0;
+    for (lru_policy::iterator itr = sh.available.begin(); itr != sh.available.end();
+      ++itr)
+      if (itr->needs_write())
+        ++dirty;
+    if (dirty * 100 <= share * high_percent)
+      return;
+
+    for (lru_policy::iterator itr = sh.available.begin();
+      itr != sh.available.end() && dirty * 100 > share * low_percent; ++itr)
+    {
+      if (!itr->needs_write())
+        continue;
+      bufs.push_back(&*itr);
+      ids.push_back(itr->buffer_id());
+      --dirty;
+    }
+    copies.resize(bufs.size() * data_size());
+    for (std::size_t i = 0; i < bufs.size(); ++i)
+    {
+      std::memcpy(&copies[i * data_size()], bufs[i]->data(), data_size());
+      bufs[i]->m_flusher_copy = buffer::copied;
+    }
+  }
+
+  //  buffers are not deleted until close(), which stops the flusher first
+  times_t start, finish;
+  times(start);
+  std::size_t written = 0;
+  try
+  {
+    for (; written < bufs.size(); ++written)
+      binary_file::write_at(static_cast<offset_type>(ids[written])
+        * static_cast<offset_type>(data_size()), &copies[written * data_size()],
+        data_size());
+  }
+  catch (...)
+  {
+    boost::detail::lightweight_mutex::scoped_lock lock(sh.mutex);
+    for (std::size_t i = 0; i < bufs.size(); ++i)
+      bufs[i]->m_flusher_copy = buffer::not_copied;  // all still need writing
+    throw;
+  }
+  times(finish);
+  m_flusher_microseconds += static_cast<boost::uint64_t>(finish.wall - start.wall);
+
+  boost::detail::lightweight_mutex::scoped_lock lock(sh.mutex);
+  for (std::size_t i = 0; i < bufs.size(); ++i)
+  {
+    if (bufs[i]->m_flusher_copy == buffer::copied)  // unchanged since it was copied
+      bufs[i]->needs_write(false);
+    bufs[i]->m_flusher_copy = buffer::not_copied;
+  }
+  sh.file_buffers_written += written;
+  sh.flusher_buffers_written += written;
+}
+
+//---------------------------------- m_shard_total() -----------------------------------//
+
+boost::uint32_t buffer_manager::m_shard_total(boost::uint32_t shard::* count) const
+{
+  boost::uint32_t total = 0;
+  for (std::size_t i = 0; m_shards && i < shard_count; ++i)
+  {
+    boost::detail::lightweight_mutex::scoped_lock lock(m_shards[i].mutex);
+    total += m_shards[i].*count;
+  }
+  return total;
+}
+
+boost::uint32_t
+buffer_manager::m_shard_total(boost::uint32_t (shard::* count)() const) const
+{
+  boost::uint32_t total = 0;
+  for (std::size_t i = 0; m_shards && i < shard_count; ++i)
+  {
+    boost::detail::lightweight_mutex::scoped_lock lock(m_shards[i].mutex);
+    total += (m_shards[i].*count)();
+  }
+  return total;
+}
+
 //-------------------------------------- write() ----------------------------------------//
 
 void buffer_manager::write(buffer& pg)
 {
   BOOST_ASSERT(is_open());
   BOOST_ASSERT(pg.buffer_id() < buffer_count());
-  seek(pg.buffer_id()*data_size());
-  binary_file::write(pg.data(), data_size());
+  BOOST_ASSERT_MSG(!mapped(), "write() on mapped, hence read-only, buffer_manager");
+  binary_file::write_at(static_cast<offset_type>(pg.buffer_id()) * data_size(),
+    pg.data(), data_size());
   pg.needs_write(false);
   ++m_file_buffers_written;
 }
@@ -209,12 +1011,19 @@ void buffer_manager::write(buffer& pg)
 
 void buffer_manager::clear_write_needed()
 {
+  boost::unique_lock<boost::mutex> pause;  // wait for a flusher pass to end
+  if (m_flusher)
+    boost::unique_lock<boost::mutex>(m_flusher->mutex).swap(pause);
   for (buffer_manager::buffers_type::iterator itr = buffers.begin();
     itr != buffers.end();
     ++itr)
   {
     itr->needs_write(false);
   }
+  for (std::size_t i = 0; m_shards && i < shard_count; ++i)
+    for (buffers_type::iterator itr = m_shards[i].buffers.begin();
+      itr != m_shards[i].buffers.end(); ++itr)
+      itr->needs_write(false);
 }
 
 //-------------------------------------- flush() ---------------------------------------//
@@ -222,19 +1031,75 @@ void buffer_manager::clear_write_needed()
 bool buffer_manager::flush()
 {
   BOOST_ASSERT(is_open());
-  bool buffer_written = false;
+  boost::unique_lock<boost::mutex> pause;  // wait for a flusher pass to end
+  if (m_flusher)
+    boost::unique_lock<boost::mutex>(m_flusher->mutex).swap(pause);
+
+  //  collect the dirty buffers in buffer_id order, then write each run of adjacent
+  //  buffer_ids with a single gather write, so that after a large number of inserts
+  //  the flush becomes a few large sequential writes rather than one per buffer
+  m_flush_list.clear();
   for (buffers_type::iterator itr = buffers.begin();
     itr != buffers.end();
     ++itr)
   {
     if (itr->needs_write())
+      m_flush_list.push_back(&*itr);
+  }
+  for (std::size_t i = 0; m_shards && i < shard_count; ++i)
+    for (buffers_type::iterator itr = m_shards[i].buffers.begin();
+      itr != m_shards[i].buffers.end(); ++itr)
+      if (itr->needs_write())
+        m_flush_list.push_back(&*itr);
+  if (m_flush_list.empty())
+    return false;
+  std::sort(m_flush_list.begin(), m_flush_list.end(), buffer_id_less());
+
+  if (async_io())
+  {
+    //  hand the kernel all of the writes at once, in file order
+    std::vector<io_request> requests(m_flush_list.size());
+    for (std::vector<buffer*>::size_type i = 0; i < m_flush_list.size(); ++i)
     {
-      write(*itr);
-      itr->needs_write(false);
-      buffer_written = true;
+      BOOST_ASSERT(m_flush_list[i]->buffer_id() < buffer_count());
+      requests[i].offset
+        = static_cast<offset_type>(m_flush_list[i]->buffer_id()) * data_size();
+      requests[i].data = m_flush_list[i]->data();
+      requests[i].size = data_size();
     }
+    binary_file::write_batch_at(&requests[0], requests.size());
+    for (std::vector<buffer*>::size_type i = 0; i < m_flush_list.size(); ++i)
+      m_flush_list[i]->needs_write(false);
+    m_file_buffers_written += static_cast<boost::uint32_t>(m_flush_list.size());
+    ++m_flush_writes;
+    return true;
+  }
+
+  std::vector<write_segment> segments;
+  for (std::vector<buffer*>::size_type run_begin = 0, run_end;
+    run_begin < m_flush_list.size(); run_begin = run_end)
+  {
+    segments.clear();
+    run_end = run_begin;
+    do
+    {
+      write_segment seg = { m_flush_list[run_end]->data(), data_size() };
+      segments.push_back(seg);
+      ++run_end;
+    } while (run_end < m_flush_list.size()
+      && m_flush_list[run_end]->buffer_id()
+         == m_flush_list[run_end-1]->buffer_id() + 1);
+
+    BOOST_ASSERT(m_flush_list[run_end-1]->buffer_id() < buffer_count());
+    binary_file::gather_write_at(
+      static_cast<offset_type>(m_flush_list[run_begin]->buffer_id()) * data_size(),
+      &segments[0], segments.size());
+    for (std::vector<buffer*>::size_type i = run_begin; i < run_end; ++i)
+      m_flush_list[i]->needs_write(false);
+    m_file_buffers_written += static_cast<boost::uint32_t>(run_end - run_begin);
+    ++m_flush_writes;
   }
-  return buffer_written;
+  return true;
 }
   
 //------------------------------------ operator<<() ------------------------------------//
@@ -248,7 +1113,13 @@ std::ostream& operator<<(std::ostream& os, const buffer_manager& pm)
     << "  buffer count ------------: " << pm.buffer_count() << "\n"  
     << "  buffer allocs -----------: " << pm.buffer_allocs() << "\n"
     << "  new buffer requests -----: " << pm.new_buffer_requests() << "\n"  
-    << "  file buffers written ----: " << pm.file_buffers_written() << "\n\n"  
+    << "  file buffers written ----: " << pm.file_buffers_written() << "\n"
+    << "  flush write calls -------: " << pm.flush_writes() << "\n"
+    << "  flusher buffers written -: " << pm.flusher_buffers_written()
+    << " in " << pm.flusher_microseconds() << " us\n"
+    << "  batch read calls --------: " << pm.batch_reads()
+    << (pm.async_io() ? " (async)" : "") << "\n"
+    << "  buffers prefetched ------: " << pm.buffers_prefetched() << "\n\n"
     << "  in-use buffers read -----: " << pm.active_buffers_read() << "\n"  
     << "  cached buffers read -----: " << pm.cached_buffers_read() << "\n"  
     << "  file buffers read -------: " << pm.file_buffers_read() << "\n"
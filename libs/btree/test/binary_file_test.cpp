@@ -85,6 +85,81 @@ namespace
     fs::remove(p);
     std::cout << "  completed open flag tests" << std::endl;
   }
+
+  void map_tests()
+  {
+    std::cout << "map tests..." << std::endl;
+
+    fs::path p("test.map");
+    boost::system::error_code ec;
+
+    {
+      bt::binary_file f(p, bt::oflag::out | bt::oflag::truncate);
+      BOOST_TEST(!f.mapped());
+      BOOST_TEST(!f.map(ec));   // empty file
+      BOOST_TEST(ec);
+      BOOST_TEST(!f.mapped());
+      f.write("0123456789", 10);
+    }
+    {
+      bt::binary_file f(p, bt::oflag::in);
+      const char* m = f.map();
+      BOOST_TEST(m);
+      BOOST_TEST(f.mapped());
+      BOOST_TEST(f.mapping() == m);
+      BOOST_TEST_EQ(f.mapping_size(), 10);
+      BOOST_TEST(std::memcmp(m, "0123456789", 10) == 0);
+      f.unmap();
+      BOOST_TEST(!f.mapped());
+      BOOST_TEST(f.map(ec));
+      BOOST_TEST(!ec);
+      f.close();  // must unmap
+      BOOST_TEST(!f.mapped());
+    }
+
+    fs::remove(p);
+    std::cout << "  completed map tests" << std::endl;
+  }
+
+  void batch_tests(bt::oflag::bitmask extra)
+  {
+    std::cout << "batch tests" << ((extra & bt::oflag::async_io) ? ", async_io" : "")
+      << "..." << std::endl;
+
+    fs::path p("test.batch");
+    const std::size_t n = 100;  // more than one io_uring ring full
+    const std::size_t sz = 64;
+    static char out[n][sz];
+    static char in[n][sz];
+    bt::binary_file::io_request rq[n];
+
+    bt::binary_file f(p, bt::oflag::in | bt::oflag::out | bt::oflag::truncate | extra);
+    std::cout << "  async_io() is " << f.async_io() << std::endl;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      std::memset(out[i], static_cast<int>(i), sz);
+      rq[i].offset = static_cast<bt::binary_file::offset_type>((n - 1 - i) * sz);
+      rq[i].data = out[i];
+      rq[i].size = sz;
+    }
+    f.write_batch_at(rq, n);
+    BOOST_TEST_EQ(fs::file_size(p), n * sz);
+
+    for (std::size_t i = 0; i < n; ++i)
+      rq[i].data = in[i];
+    BOOST_TEST(f.read_batch_at(rq, n));
+    BOOST_TEST(std::memcmp(in, out, sizeof(in)) == 0);
+
+    //  end-of-file is reported, but is not an error
+    boost::system::error_code ec;
+    rq[n-1].offset = n * sz;
+    BOOST_TEST(!f.read_batch_at(rq, n, ec));
+    BOOST_TEST(!ec);
+
+    f.close();
+    fs::remove(p);
+    std::cout << "  completed batch tests" << std::endl;
+  }
 }
 
 //  cpp_main  --------------------------------------------------------------------------//
@@ -97,6 +172,9 @@ int cpp_main(int argc, char * argv[])
     static_cast<bt::binary_file::offset_type>(std::atol(argv[1])) * 1024;
 
   open_flag_tests();
+  map_tests();
+  batch_tests(bt::oflag::bitmask());
+  batch_tests(bt::oflag::async_io);
 
   char buf[128] = "0123456789abcdef";
 
@@ -147,6 +225,22 @@ int cpp_main(int argc, char * argv[])
 
   BOOST_TEST(!f.read(buf, 1));
 
+  //  positional I/O does not use or move the file offset
+  BOOST_TEST(f.seek(3, bt::seekdir::begin) == 3);
+  f.write_at(gap + 10, "END", 3);
+  BOOST_TEST(f.seek(0, bt::seekdir::current) == 3);
+  std::memset(buf, 0, sizeof(buf));
+  BOOST_TEST(f.read_at(gap + 10, buf, 7));
+  BOOST_TEST(std::strcmp(buf, "ENDing") == 0);
+  BOOST_TEST(f.read_at(0, buf, 10));
+  BOOST_TEST(std::strcmp(buf, beginning) == 0);
+  BOOST_TEST(f.seek(0, bt::seekdir::current) == 3);
+  BOOST_TEST(!f.read_at(gap + 17, buf, 1));  // eof
+  BOOST_TEST(!f.read_at(gap + 16, buf, 2, ec));  // premature eof
+  BOOST_TEST(ec);
+  f.write_at(gap + 10, ending, 7, ec);
+  BOOST_TEST(!ec);
+
   BOOST_TEST(f.is_open());
   f.close();
   BOOST_TEST(!f.is_open());
@@ -17,19 +17,24 @@
 
 #include <boost/btree/map.hpp>
 #include <boost/btree/set.hpp>
+#include <boost/btree/sort_loader.hpp>
 #include <boost/btree/support/strbuf.hpp>
+#include <boost/btree/support/c_str_proxy.hpp>
 #include <boost/btree/support/fixstr.hpp>
 #include <boost/detail/lightweight_main.hpp>
 #include <boost/detail/lightweight_test.hpp>
 #include <boost/cstdint.hpp>
 #include <boost/random.hpp>
 #include <boost/btree/support/random_string.hpp>
+#include <boost/thread/thread.hpp>
 
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <utility>
 #include <map>
 #include <set>
+#include <vector>
 #include <algorithm>
 
 using namespace boost;
@@ -1044,6 +1049,34 @@ void pack_optimization()
   BOOST_TEST_EQ(np.size(), p.size());
   BOOST_TEST(p.header().node_count() < np.header().node_count());
 
+  //  ascending runs are still packed after unordered inserts and erases, and when
+  //  several runs are interleaved, each at the end of its own key range
+  const int m = 4000;
+  const int max_nodes = (2 * m / per_node) * 5 / 4;  // 100% leaf fill plus branches
+  btree::btree_map<int, int> runs("pack_runs.btr", btree::flags::truncate, node_sz);
+  runs.emplace(3000000, 0);
+  runs.emplace(1500000, 0);
+  runs.emplace(-1, 0);
+  runs.erase(1500000);
+  boost::uint32_t initial_nodes = runs.header().node_count();
+  for (int i=0; i < m; ++i)
+  {
+    runs.emplace(i, i);
+    runs.emplace(1000000+i, i);
+  }
+  BOOST_TEST_EQ(runs.size(), 2U * m + 2);
+  cout << "    interleaved runs use " << runs.header().node_count() - initial_nodes
+       << " nodes; " << 2 * m / per_node << " leaves if full" << endl;
+  BOOST_TEST(static_cast<int>(runs.header().node_count() - initial_nodes) < max_nodes);
+  int k = 0;
+  btree::btree_map<int, int>::const_iterator it = runs.begin();
+  BOOST_TEST_EQ((it++)->key(), -1);
+  for (; k < m; ++k, ++it)
+    BOOST_TEST_EQ(it->key(), k);
+  for (k = 0; k < m; ++k, ++it)
+    BOOST_TEST_EQ(it->key(), 1000000+k);
+  BOOST_TEST_EQ(it->key(), 3000000);
+
   cout << "    pack_optimization complete" << endl;
 }
 
@@ -1118,6 +1151,1654 @@ void  reopen_btree_object_test()
   cout << "     reopen_btree_object_test complete" << endl;
 }
 
+//------------------------------------  find_many  -------------------------------------//
+
+template <class BTree>
+void find_many_tests(BTree& bt)
+{
+  //  keys 0, 3, 6, ... 3*(n-1); non-unique containers get each key twice
+  const long n = 2000;
+  for (long i = 0; i < n; ++i)
+  {
+    bt.emplace(i * 3, i);
+    if (!(bt.header().flags() & btree::flags::unique))
+      bt.emplace(i * 3, -i);
+  }
+
+  //  probes include present keys, absent keys, duplicates, and keys beyond either end
+  std::vector<long> probes;
+  rand48  rng;
+  uniform_int<long> dist(-10, n * 3 + 10);
+  variate_generator<rand48&, uniform_int<long> > probe(rng, dist);
+  for (int i = 0; i < 3000; ++i)
+    probes.push_back(probe());
+  probes.push_back(probes[0]);
+
+  std::vector<typename BTree::const_iterator> results;
+  bt.lower_bound_many(probes.begin(), probes.end(), std::back_inserter(results));
+  BOOST_TEST_EQ(results.size(), probes.size());
+  for (std::size_t i = 0; i < probes.size(); ++i)
+    BOOST_TEST(results[i] == bt.lower_bound(probes[i]));
+
+  results.clear();
+  boost::uint32_t reads_before = bt.manager().active_buffers_read()
+    + bt.manager().cached_buffers_read() + bt.manager().file_buffers_read();
+  bt.find_many(probes.begin(), probes.end(), std::back_inserter(results));
+  boost::uint32_t reads_many = bt.manager().active_buffers_read()
+    + bt.manager().cached_buffers_read() + bt.manager().file_buffers_read()
+    - reads_before;
+  BOOST_TEST_EQ(results.size(), probes.size());
+  for (std::size_t i = 0; i < probes.size(); ++i)
+    BOOST_TEST(results[i] == bt.find(probes[i]));
+  boost::uint32_t reads_single = bt.manager().active_buffers_read()
+    + bt.manager().cached_buffers_read() + bt.manager().file_buffers_read()
+    - reads_before - reads_many;
+  cout << "    node reads: find_many " << reads_many
+       << ", find " << reads_single << endl;
+  BOOST_TEST(reads_many < reads_single);
+
+  results.clear();
+  bt.find_many(probes.begin(), probes.begin(), std::back_inserter(results));
+  BOOST_TEST(results.empty());
+}
+
+void  find_many()
+{
+  cout << "  find_many..." << endl;
+  {
+    btree::btree_map<long, long> bt("find_many.btree", btree::flags::truncate, 128);
+    find_many_tests(bt);
+  }
+  {
+    btree::btree_multimap<long, long> bt("find_many.btree", btree::flags::truncate, 128);
+    find_many_tests(bt);
+  }
+  {
+    //  on a freshly opened btree, the leaves after the first under each parent are read
+    //  in batches
+    btree::btree_multimap<long, long> bt("find_many.btree");
+    std::vector<long> probes;
+    for (long i = 0; i < 1000; ++i)
+      probes.push_back((i * 7919) % 6000);
+    std::vector<btree::btree_multimap<long, long>::const_iterator> results;
+    bt.find_many(probes.begin(), probes.end(), std::back_inserter(results));
+    BOOST_TEST(bt.manager().batch_reads() > 0);
+    for (std::size_t i = 0; i < probes.size(); ++i)
+      BOOST_TEST(results[i] == bt.find(probes[i]));
+    boost::uint32_t batches = bt.manager().batch_reads();
+
+    bt.read_ahead(0);
+    results.clear();
+    bt.find_many(probes.begin(), probes.end(), std::back_inserter(results));
+    BOOST_TEST_EQ(bt.manager().batch_reads(), batches);
+  }
+  cout << "     find_many complete" << endl;
+}
+
+//--------------------------------------  mapped  --------------------------------------//
+
+void  mapped()
+{
+  cout << "  mapped..." << endl;
+
+  fs::path p("mapped.btree");
+  typedef btree::btree_map<long, long> map_type;
+  const long n = 1000;
+
+  {
+    map_type bt(p, btree::flags::truncate, 128);
+    for (long i = 1; i <= n; ++i)
+      bt.emplace(i * 2, i);
+  }
+
+  {
+    bool thrown = false;
+    try { map_type bt(p, btree::flags::read_write | btree::flags::mapped); }
+    catch (const std::runtime_error&) { thrown = true; }
+    BOOST_TEST(thrown);
+  }
+
+  map_type bt(p, btree::flags::read_only | btree::flags::mapped);
+  BOOST_TEST(bt.manager().mapped());
+  BOOST_TEST_EQ(bt.manager().mapping_size(),
+    static_cast<btree::binary_file::offset_type>(fs::file_size(p)));
+  BOOST_TEST_EQ(bt.size(), static_cast<map_type::size_type>(n));
+  BOOST_TEST(!(bt.header().flags() & btree::flags::mapped));
+
+  bt.max_cache_size(4);  // force buffer reuse
+  long count = 0;
+  for (map_type::iterator it = bt.begin(); it != bt.end(); ++it)
+  {
+    ++count;
+    BOOST_TEST_EQ(it->key(), count * 2);
+    BOOST_TEST_EQ(it->mapped_value(), count);
+  }
+  BOOST_TEST_EQ(count, n);
+
+  for (long i = n; i >= 1; i -= 7)
+  {
+    map_type::iterator it = bt.find(i * 2);
+    BOOST_TEST(it != bt.end() && it->mapped_value() == i);
+    BOOST_TEST(bt.find(i * 2 + 1) == bt.end());
+  }
+  bt.close();
+  BOOST_TEST(!bt.manager().mapped());
+
+  cout << "     mapped complete" << endl;
+}
+
+//------------------------------------  bulk_load  -------------------------------------//
+
+struct map_equal
+{
+  bool operator()(const btree::map_value<long, long>& x,
+    const btree::map_value<long, long>& y) const
+  {
+    return x.key() == y.key() && x.mapped_value() == y.mapped_value();
+  }
+};
+
+void  bulk_load()
+{
+  cout << "  bulk_load..." << endl;
+
+  typedef btree::btree_map<long, long> map_type;
+  typedef btree::btree_multimap<long, long> multimap_type;
+  const long n = 5000;
+
+  map_type src("bulk_load_src.btree", btree::flags::truncate, 128);
+  for (long i = n; i >= 1; --i)
+    src.emplace(i * 2, i);
+
+  {
+    map_type bt("bulk_load.btree", btree::flags::truncate, 128);
+    bt.bulk_load(src.begin(), src.end());
+    BOOST_TEST_EQ(bt.size(), src.size());
+    BOOST_TEST(bt.header().root_level() > 1);  // exercise multiple branch levels
+    BOOST_TEST(bt.header().node_count() < src.header().node_count());
+  }
+
+  {
+    map_type bt("bulk_load.btree", btree::flags::read_write);
+    BOOST_TEST_EQ(bt.size(), static_cast<map_type::size_type>(n));
+    long count = 0;
+    for (map_type::iterator it = bt.begin(); it != bt.end(); ++it)
+    {
+      ++count;
+      BOOST_TEST_EQ(it->key(), count * 2);
+      BOOST_TEST_EQ(it->mapped_value(), count);
+    }
+    BOOST_TEST_EQ(count, n);
+    BOOST_TEST_EQ(bt.last()->key(), n * 2);
+    for (long i = 1; i <= n; i += 3)
+    {
+      BOOST_TEST(bt.find(i * 2) != bt.end() && bt.find(i * 2)->mapped_value() == i);
+      BOOST_TEST(bt.find(i * 2 + 1) == bt.end());
+    }
+
+    //  the result is an ordinary btree; inserts and erases work as usual
+    for (long i = 0; i <= n; i += 2)
+      BOOST_TEST(bt.emplace(i * 2 + 1, -i).second);
+    for (long i = 1; i <= n; i += 2)
+      BOOST_TEST_EQ(bt.erase(i * 2), 1U);
+    long prior = -1;
+    count = 0;
+    for (map_type::iterator it = bt.begin(); it != bt.end(); ++it, ++count)
+    {
+      BOOST_TEST(prior < it->key());
+      prior = it->key();
+    }
+    BOOST_TEST_EQ(static_cast<map_type::size_type>(count), bt.size());
+  }
+
+  //  fill percent
+  {
+    map_type full("bulk_load.btree", btree::flags::truncate, 128);
+    full.bulk_load(src.begin(), src.end());
+    map_type half("bulk_load_2.btree", btree::flags::truncate, 128);
+    half.bulk_load(src.begin(), src.end(), 50);
+    BOOST_TEST_EQ(half.size(), src.size());
+    BOOST_TEST(half.header().node_count() > full.header().node_count() * 3 / 2);
+    BOOST_TEST(std::equal(half.begin(), half.end(), full.begin(), map_equal()));
+  }
+
+  //  unique containers ignore duplicates; non-unique containers keep them in order
+  {
+    std::vector<long> keys;
+    for (long i = 0; i < 1000; ++i)
+    {
+      keys.push_back(i);
+      if (i % 3 == 0)
+        keys.push_back(i);
+    }
+
+    btree::btree_set<long> set("bulk_load.btree", btree::flags::truncate, 128);
+    set.bulk_load(keys.begin(), keys.end());
+    BOOST_TEST_EQ(set.size(), 1000U);
+    long expected = 0;
+    for (btree::btree_set<long>::iterator it = set.begin(); it != set.end(); ++it)
+      BOOST_TEST_EQ(*it, expected++);
+
+    btree::btree_multiset<long> multiset("bulk_load_2.btree", btree::flags::truncate, 128);
+    multiset.bulk_load(keys.begin(), keys.end());
+    BOOST_TEST_EQ(multiset.size(), keys.size());
+    BOOST_TEST(std::equal(multiset.begin(), multiset.end(), keys.begin()));
+    BOOST_TEST_EQ(multiset.count(998), 1U);
+    BOOST_TEST_EQ(multiset.count(996), 2U);
+  }
+
+  {
+    multimap_type src2("bulk_load_src.btree", btree::flags::truncate, 128);
+    for (long i = 1; i <= n; ++i)
+    {
+      src2.emplace(i / 10, i);
+    }
+    multimap_type bt("bulk_load.btree", btree::flags::truncate, 128);
+    bt.bulk_load(src2.begin(), src2.end());
+    BOOST_TEST_EQ(bt.size(), src2.size());
+    BOOST_TEST(std::equal(bt.begin(), bt.end(), src2.begin(), map_equal()));
+    for (long k = 0; k <= n / 10; k += 7)
+      BOOST_TEST_EQ(bt.count(k), src2.count(k));
+  }
+
+  //  out of order input
+  {
+    std::vector<long> keys;
+    keys.push_back(1);
+    keys.push_back(3);
+    keys.push_back(2);
+    btree::btree_set<long> set("bulk_load.btree", btree::flags::truncate, 128);
+    bool thrown = false;
+    try { set.bulk_load(keys.begin(), keys.end()); }
+    catch (const std::runtime_error&) { thrown = true; }
+    BOOST_TEST(thrown);
+  }
+
+  cout << "     bulk_load complete" << endl;
+}
+
+//-----------------------------------  sort_loader  ------------------------------------//
+
+void  sort_loader()
+{
+  cout << "  sort_loader..." << endl;
+
+  typedef btree::btree_map<long, long> map_type;
+  typedef btree::btree_multimap<long, long> multimap_type;
+  typedef btree::btree_set<long> set_type;
+  const long n = 3000;
+
+  rand48  rng;
+  uniform_int<long> dist(0, n);
+  variate_generator<rand48&, uniform_int<long> > key(rng, dist);
+  std::vector<long> keys;
+  for (long i = 0; i < n; ++i)
+    keys.push_back(key());
+
+  //  unique: same result as insert(), whether or not runs are spilled
+  {
+    map_type expected("sort_loader_expected.btree", btree::flags::truncate, 128);
+    for (long i = 0; i < n; ++i)
+      expected.emplace(keys[i], i);
+
+    for (int spill = 0; spill < 2; ++spill)
+    {
+      map_type bt("sort_loader.btree", btree::flags::truncate, 128);
+      btree::sort_loader<map_type> loader(bt, spill ? 100 * 16 : 1000000);
+      for (long i = 0; i < n; ++i)
+        loader.emplace(keys[i], i);
+      BOOST_TEST_EQ(loader.size(), static_cast<map_type::size_type>(n));
+      if (spill)
+      {
+        BOOST_TEST_EQ(loader.runs(), static_cast<std::size_t>(n / 100));
+        BOOST_TEST(fs::exists(loader.temp_path()));
+      }
+      else
+        BOOST_TEST_EQ(loader.runs(), 0U);
+      fs::path temp(loader.temp_path());
+      loader.finish();
+      BOOST_TEST_EQ(loader.size(), 0U);
+      BOOST_TEST_EQ(loader.runs(), 0U);
+      if (spill)
+        BOOST_TEST(!fs::exists(temp));
+      BOOST_TEST_EQ(bt.size(), expected.size());
+      BOOST_TEST(std::equal(bt.begin(), bt.end(), expected.begin(), map_equal()));
+    }
+  }
+
+  //  non-unique: equivalent keys keep their insertion order
+  {
+    multimap_type bt("sort_loader.btree", btree::flags::truncate, 128);
+    btree::sort_loader<multimap_type> loader(bt, 64 * 16);
+    for (long i = 0; i < n; ++i)
+      loader.emplace(keys[i], i);
+    loader.finish();
+    BOOST_TEST_EQ(bt.size(), static_cast<multimap_type::size_type>(n));
+    multimap_type::iterator it = bt.begin();
+    multimap_type::iterator prior = it;
+    for (++it; it != bt.end(); ++it, ++prior)
+    {
+      BOOST_TEST(prior->key() <= it->key());
+      if (prior->key() == it->key())
+        BOOST_TEST(prior->mapped_value() < it->mapped_value());
+    }
+  }
+
+  //  set, loaded via insert(first, last)
+  {
+    set_type bt("sort_loader.btree", btree::flags::truncate, 128);
+    btree::sort_loader<set_type> loader(bt, 50 * sizeof(long));
+    loader.insert(keys.begin(), keys.end());
+    loader.finish();
+    std::set<long> expected(keys.begin(), keys.end());
+    BOOST_TEST_EQ(bt.size(), expected.size());
+    BOOST_TEST(std::equal(bt.begin(), bt.end(), expected.begin()));
+  }
+
+  cout << "     sort_loader complete" << endl;
+}
+
+//----------------------------------  separators  --------------------------------------//
+
+void  separators()
+{
+  cout << "  separators..." << endl;
+
+  using btree::shortest_separator;
+  char buf[300];
+  btree::strbuf lo, hi;
+
+  lo = "abcdefgh"; hi = "abcxyz";
+  BOOST_TEST_EQ(shortest_separator(lo, hi, buf), 4U + 2U);
+  BOOST_TEST(std::strcmp(reinterpret_cast<btree::strbuf*>(buf)->c_str(), "abcx") == 0);
+  lo = "abc"; hi = "abcdef";
+  shortest_separator(lo, hi, buf);
+  BOOST_TEST(std::strcmp(reinterpret_cast<btree::strbuf*>(buf)->c_str(), "abcd") == 0);
+  lo = "a"; hi = "b";
+  shortest_separator(lo, hi, buf);
+  BOOST_TEST(std::strcmp(reinterpret_cast<btree::strbuf*>(buf)->c_str(), "b") == 0);
+
+  BOOST_TEST_EQ(shortest_separator(btree::make_c_str("common-17"),
+    btree::make_c_str("common-2x"), buf), 9U);
+  BOOST_TEST(std::strcmp(buf, "common-2") == 0);
+
+  long lo_l = 1, hi_l = 2;  // default: the separator is hi
+  BOOST_TEST_EQ(shortest_separator(lo_l, hi_l, buf), sizeof(long));
+  BOOST_TEST_EQ(*reinterpret_cast<long*>(buf), 2L);
+
+  //  trees of long keys that differ early, so that branch keys are separators much
+  //  shorter than the first key of the node they point to
+
+  typedef btree::btree_set<btree::strbuf> set_type;
+  typedef btree::btree_multiset<btree::strbuf> multiset_type;
+  const int n = 2000;
+  std::vector<std::string> keys;
+  for (int i = 0; i < n; ++i)
+  {
+    std::ostringstream os;
+    os << std::setw(5) << (i * 7919) % n
+       << " followed by a fairly long suffix shared by every key";
+    keys.push_back(os.str());
+  }
+
+  set_type bt("separators.btree", btree::flags::truncate, 512);
+  multiset_type mbt("separators_multi.btree", btree::flags::truncate, 512);
+  for (int i = 0; i < n; ++i)
+  {
+    bt.insert(btree::strbuf(keys[i].c_str()));
+    mbt.insert(btree::strbuf(keys[i].c_str()));
+    mbt.insert(btree::strbuf(keys[i].c_str()));
+  }
+  std::sort(keys.begin(), keys.end());
+  BOOST_TEST_EQ(bt.size(), static_cast<set_type::size_type>(n));
+  BOOST_TEST_EQ(mbt.size(), static_cast<multiset_type::size_type>(2 * n));
+  BOOST_TEST(bt.header().root_level() > 0);
+  cout << "    node count " << bt.header().node_count()
+       << ", levels " << bt.header().root_level() + 1 << endl;
+
+  set_type bulk("separators_bulk.btree", btree::flags::truncate, 512);
+  bulk.bulk_load(bt.begin(), bt.end());
+  BOOST_TEST_EQ(bulk.size(), bt.size());
+
+  int i = 0;
+  for (set_type::iterator it = bt.begin(); it != bt.end(); ++it, ++i)
+    BOOST_TEST_EQ(std::string(it->c_str()), keys[i]);
+  i = 0;
+  for (set_type::iterator it = bulk.begin(); it != bulk.end(); ++it, ++i)
+    BOOST_TEST_EQ(std::string(it->c_str()), keys[i]);
+
+  for (i = 0; i < n; ++i)
+  {
+    btree::strbuf k(keys[i].c_str());
+    BOOST_TEST(bt.find(k) != bt.end());
+    BOOST_TEST(bulk.find(k) != bulk.end());
+    BOOST_TEST_EQ(mbt.count(k), 2U);
+
+    //  a key just past k, which lies between k and any separator following it
+    btree::strbuf past((keys[i] + " ").c_str());
+    set_type::iterator lb = bt.lower_bound(past);
+    if (i + 1 < n)
+    {
+      BOOST_TEST(lb != bt.end() && std::string(lb->c_str()) == keys[i + 1]);
+      BOOST_TEST(bulk.lower_bound(past) == bulk.find(btree::strbuf(keys[i + 1].c_str())));
+    }
+    else
+      BOOST_TEST(lb == bt.end());
+  }
+
+  for (i = 0; i < n; i += 2)
+  {
+    BOOST_TEST_EQ(bt.erase(btree::strbuf(keys[i].c_str())), 1U);
+    BOOST_TEST_EQ(mbt.erase(btree::strbuf(keys[i].c_str())), 2U);
+  }
+  for (i = 0; i < n; ++i)
+  {
+    btree::strbuf k(keys[i].c_str());
+    BOOST_TEST_EQ(bt.count(k), i % 2 ? 1U : 0U);
+    BOOST_TEST_EQ(mbt.count(k), i % 2 ? 2U : 0U);
+  }
+
+  cout << "     separators complete" << endl;
+}
+
+//--------------------------------  slot_directory  ------------------------------------//
+
+void  slot_directory()
+{
+  cout << "  slot_directory..." << endl;
+
+  //  large nodes holding many dynamic size elements, so searches and decrements use
+  //  the slot directory, and nodes change between searches
+
+  typedef btree::btree_set<btree::strbuf> set_type;
+  const int n = 3000;
+  std::vector<std::string> keys;
+  for (int i = 0; i < n; ++i)
+  {
+    std::ostringstream os;
+    os << (i * 7919) % n << std::string((i * 31) % 40, 'x');
+    keys.push_back(os.str());
+  }
+
+  set_type bt("slot_directory.btree", btree::flags::truncate, 8192);
+  for (int i = 0; i < n; ++i)
+  {
+    bt.insert(btree::strbuf(keys[i].c_str()));
+    BOOST_TEST(bt.find(btree::strbuf(keys[i / 2].c_str())) != bt.end());
+  }
+  std::sort(keys.begin(), keys.end());
+  BOOST_TEST_EQ(bt.size(), static_cast<set_type::size_type>(n));
+
+  int i = n;
+  for (set_type::reverse_iterator it = bt.rbegin(); it != bt.rend(); ++it)
+    BOOST_TEST_EQ(std::string(it->c_str()), keys[--i]);
+  BOOST_TEST_EQ(i, 0);
+  BOOST_TEST_EQ(std::string(bt.last()->c_str()), keys[n - 1]);
+
+  for (i = 0; i < n; i += 3)
+    BOOST_TEST_EQ(bt.erase(btree::strbuf(keys[i].c_str())), 1U);
+  for (i = 0; i < n; ++i)
+  {
+    set_type::iterator lb = bt.lower_bound(btree::strbuf(keys[i].c_str()));
+    set_type::iterator ub = bt.upper_bound(btree::strbuf(keys[i].c_str()));
+    if (i % 3)
+    {
+      BOOST_TEST(lb != bt.end() && std::string(lb->c_str()) == keys[i]);
+      BOOST_TEST(lb != ub && ++lb == ub);
+    }
+    else
+      BOOST_TEST(lb == ub);
+  }
+
+  i = n;
+  for (set_type::reverse_iterator it = bt.rbegin(); it != bt.rend(); ++it)
+  {
+    if (!(--i % 3))
+      --i;
+    BOOST_TEST_EQ(std::string(it->c_str()), keys[i]);
+  }
+
+  cout << "     slot_directory complete" << endl;
+}
+
+//---------------------------------  node_search  --------------------------------------//
+
+template <class Key>
+void node_search_kernel_test(const std::vector<Key>& keys, std::size_t stride)
+{
+  typedef btree::detail::fast_search<Key, btree::less<Key> > search;
+  BOOST_TEST(search::value);
+  std::vector<char> buf(keys.size() * stride + 1);
+  for (std::size_t i = 0; i < keys.size(); ++i)
+    std::memcpy(&buf[i * stride], &keys[i], sizeof(Key));
+
+  for (std::size_t n = 0; n <= keys.size(); ++n)
+    for (std::size_t i = 0; i < keys.size(); ++i)
+    {
+      typename search::native_type k = keys[i];
+      for (int d = -1; d <= 1; ++d)
+      {
+        typename search::native_type t = k + d;
+        std::size_t lb = std::lower_bound(keys.begin(), keys.begin() + n, Key(t))
+          - keys.begin();
+        std::size_t ub = std::upper_bound(keys.begin(), keys.begin() + n, Key(t))
+          - keys.begin();
+        BOOST_TEST_EQ(btree::detail::node_lower_bound<search>(&buf[0], stride, n, t), lb);
+        BOOST_TEST_EQ(btree::detail::node_upper_bound<search>(&buf[0], stride, n, t), ub);
+      }
+    }
+}
+
+void  node_search()
+{
+  cout << "  node_search..." << endl;
+
+  BOOST_TEST((!btree::detail::fast_search<fat, btree::less<fat> >::value));
+  BOOST_TEST((!btree::detail::fast_search<short, btree::less<short> >::value));
+  BOOST_TEST((!btree::detail::fast_search<int, std::less<int> >::value));
+
+  //  kernels, with duplicates, negative keys, and unsigned keys with the high bit set,
+  //  both packed and a stride apart
+
+  std::vector<boost::int32_t> i32;
+  std::vector<boost::uint32_t> u32;
+  std::vector<boost::int64_t> i64;
+  std::vector<boost::uint64_t> u64;
+  std::vector<integer::ubig64_t> ub64;
+  for (int i = 0; i < 70; ++i)
+  {
+    i32.push_back((i - 35) / 2 * 1000);
+    u32.push_back(0x7ffffff0u + i / 2 * 3);
+    i64.push_back((i - 35) * 100000000000LL);
+    u64.push_back(0x7ffffffffffffff0ULL + i / 3 * 5);
+    integer::ubig64_t v;
+    v = 0xfffffff0ULL + i * 2;
+    ub64.push_back(v);
+  }
+  node_search_kernel_test(i32, sizeof(boost::int32_t));
+  node_search_kernel_test(i32, 12);
+  node_search_kernel_test(u32, sizeof(boost::uint32_t));
+  node_search_kernel_test(i64, sizeof(boost::int64_t));
+  node_search_kernel_test(i64, 20);
+  node_search_kernel_test(u64, sizeof(boost::uint64_t));
+  node_search_kernel_test(ub64, sizeof(integer::ubig64_t));
+  node_search_kernel_test(ub64, 12);
+
+  //  btrees whose leaf and branch searches use the kernels
+
+  typedef btree::btree_multiset<boost::uint64_t> set_type;
+  typedef btree::btree_map<integer::big32_t, boost::int32_t> map_type;
+  set_type st("node_search_set.btree", btree::flags::truncate, 128);
+  map_type mp("node_search_map.btree", btree::flags::truncate, 128);
+  std::multiset<boost::uint64_t> st_stl;
+  for (int i = 0; i < 2000; ++i)
+  {
+    boost::uint64_t v = (i * 7919) % 1500 * 3 + 0xfffffffffff00000ULL;
+    st.insert(v);
+    st_stl.insert(v);
+    integer::big32_t k;
+    k = (i * 7919) % 2000 - 1000;
+    mp.emplace(k, i);
+  }
+  BOOST_TEST(st.header().root_level() > 0);
+  BOOST_TEST(mp.header().root_level() > 0);
+  for (int i = -1; i < 1501 * 3; ++i)
+  {
+    boost::uint64_t v = i + 0xfffffffffff00000ULL;
+    BOOST_TEST_EQ(st.count(v),
+      static_cast<set_type::size_type>(st_stl.count(v)));
+    set_type::iterator lb = st.lower_bound(v);
+    std::multiset<boost::uint64_t>::iterator lb_stl = st_stl.lower_bound(v);
+    BOOST_TEST((lb == st.end()) == (lb_stl == st_stl.end()));
+    if (lb != st.end() && lb_stl != st_stl.end())
+      BOOST_TEST_EQ(*lb, *lb_stl);
+  }
+  for (int i = -1000; i < 1000; ++i)
+  {
+    integer::big32_t k;
+    k = i;
+    map_type::iterator it = mp.find(k);
+    BOOST_TEST(it != mp.end() && it->key() == i);
+    if (i < 999)
+      BOOST_TEST(mp.upper_bound(k)->key() == i + 1);
+  }
+
+  cout << "     node_search complete" << endl;
+}
+
+//----------------------------------  key_column  --------------------------------------//
+
+template <class BTree, class Key>
+void key_column_tests(const fs::path& p)
+{
+  //  random inserts and erases interleaved with searches, so leaf key columns are
+  //  repeatedly built and invalidated
+
+  BTree bt(p, btree::flags::truncate, 256);
+  std::map<long, long> stl;
+  rand48 rng;
+  uniform_int<long> dist(-2000, 2000);
+  variate_generator<rand48&, uniform_int<long> > rnd(rng, dist);
+  for (int i = 0; i < 6000; ++i)
+  {
+    long v = rnd();
+    Key k;
+    k = v;
+    if (i % 3 == 2)
+      BOOST_TEST_EQ(bt.erase(k), static_cast<typename BTree::size_type>(stl.erase(v)));
+    else if (stl.insert(std::make_pair(v, i)).second)
+      bt.emplace(k, i);
+    BOOST_TEST_EQ(bt.count(k), static_cast<typename BTree::size_type>(stl.count(v)));
+  }
+  BOOST_TEST(bt.header().root_level() > 0);
+  BOOST_TEST_EQ(bt.size(), static_cast<typename BTree::size_type>(stl.size()));
+
+  for (long v = -2001; v <= 2001; ++v)
+  {
+    Key k;
+    k = v;
+    typename BTree::iterator lb = bt.lower_bound(k);
+    typename BTree::iterator ub = bt.upper_bound(k);
+    std::map<long, long>::iterator lb_stl = stl.lower_bound(v);
+    std::map<long, long>::iterator ub_stl = stl.upper_bound(v);
+    BOOST_TEST((lb == bt.end()) == (lb_stl == stl.end()));
+    BOOST_TEST((ub == bt.end()) == (ub_stl == stl.end()));
+    if (lb != bt.end() && lb_stl != stl.end())
+    {
+      BOOST_TEST_EQ(static_cast<long>(lb->key()), lb_stl->first);
+      BOOST_TEST_EQ(static_cast<long>(lb->mapped_value().x), lb_stl->second);
+    }
+    if (ub != bt.end() && ub_stl != stl.end())
+      BOOST_TEST_EQ(static_cast<long>(ub->key()), ub_stl->first);
+  }
+  bt.close();
+
+  //  leaves of a read only, mapped btree keep their key columns until buffers are reused
+  BTree bt2(p, btree::flags::read_only | btree::flags::mapped);
+  bt2.max_cache_size(4);
+  for (std::map<long, long>::iterator it = stl.begin(); it != stl.end(); ++it)
+  {
+    Key k;
+    k = it->first;
+    BOOST_TEST(bt2.find(k) != bt2.end() && bt2.find(k)->mapped_value().x == it->second);
+  }
+}
+
+void  key_column()
+{
+  cout << "  key_column..." << endl;
+
+  BOOST_TEST(!btree::detail::has_leaf_key_column<btree::default_native_traits>::value);
+  BOOST_TEST((btree::detail::has_leaf_key_column<
+    btree::key_column_traits<btree::default_native_traits> >::value));
+
+  key_column_tests<btree::btree_map<boost::int64_t, fat,
+    btree::key_column_traits<btree::default_native_traits> >, boost::int64_t>
+    ("key_column_native.btree");
+  key_column_tests<btree::btree_map<integer::big32_t, fat,
+    btree::key_column_traits<btree::default_endian_traits> >, integer::big32_t>
+    ("key_column_big.btree");
+
+  //  keys that the column does not apply to are searched as usual
+  typedef btree::btree_set<fat,
+    btree::key_column_traits<btree::default_native_traits> > fat_set;
+  fat_set fs("key_column_fat.btree", btree::flags::truncate, 256);
+  for (int i = 0; i < 500; ++i)
+    fs.insert(fat((i * 7919) % 500));
+  for (int i = 0; i < 500; ++i)
+    BOOST_TEST(fs.find(fat(i)) != fs.end());
+
+  cout << "     key_column complete" << endl;
+}
+
+//-----------------------------------  min_fill  ---------------------------------------//
+
+template <class BTree, class Stl>
+bool same(const BTree& bt, const Stl& stl)
+{
+  if (bt.size() != stl.size())
+    return false;
+  typename Stl::const_iterator s = stl.begin();
+  for (typename BTree::const_iterator it = bt.begin(); it != bt.end(); ++it, ++s)
+    if (it->key() != s->first || it->mapped_value() != s->second)
+      return false;
+  typename Stl::const_reverse_iterator rs = stl.rbegin();
+  for (typename BTree::const_reverse_iterator it = bt.rbegin(); it != bt.rend();
+    ++it, ++rs)
+    if (it->key() != rs->first)
+      return false;
+  return true;
+}
+
+void  min_fill()
+{
+  cout << "  min_fill..." << endl;
+
+  typedef btree::btree_map<long, long> map_type;
+  typedef btree::btree_multimap<long, long> multimap_type;
+  const long n = 4000;
+
+  map_type sparse("min_fill_sparse.btree", btree::flags::truncate, 128);
+  map_type bt("min_fill.btree", btree::flags::truncate, 128);
+  BOOST_TEST_EQ(bt.min_fill(), 0U);
+  bt.min_fill(40);
+  BOOST_TEST_EQ(bt.min_fill(), 40U);
+  std::map<long, long> stl;
+  for (long i = 0; i < n; ++i)
+  {
+    long k = (i * 7919) % n;
+    sparse.emplace(k, i);
+    bt.emplace(k, i);
+    stl.insert(std::make_pair(k, i));
+  }
+
+  //  erase most elements, in an order unrelated to the key order
+  for (long i = 0; i < n; ++i)
+  {
+    long k = (i * 1009) % n;
+    if (k % 10 == 0)
+      continue;
+    BOOST_TEST_EQ(sparse.erase(k), 1U);
+    BOOST_TEST_EQ(bt.erase(k), 1U);
+    stl.erase(k);
+    if (i % 500 == 0)
+      BOOST_TEST(same(bt, stl));
+  }
+  BOOST_TEST(same(bt, stl));
+  BOOST_TEST(same(sparse, stl));
+  BOOST_TEST(bt.node_merges() > 0);
+  BOOST_TEST(bt.node_borrows() > 0);
+  BOOST_TEST_EQ(sparse.node_merges(), 0U);
+  cout << "    merges " << bt.node_merges() << ", borrows " << bt.node_borrows() << endl;
+
+  //  a scan of the maintained tree reads far fewer nodes
+  bt.close();
+  bt.open("min_fill.btree", btree::flags::read_write);
+  bt.min_fill(40);
+  sparse.close();
+  sparse.open("min_fill_sparse.btree", btree::flags::read_write);
+  BOOST_TEST(same(bt, stl));
+  BOOST_TEST(same(sparse, stl));
+  BOOST_TEST(bt.manager().file_buffers_read() * 2 < sparse.manager().file_buffers_read());
+  cout << "    nodes read by a scan " << bt.manager().file_buffers_read() << " vs "
+       << sparse.manager().file_buffers_read() << endl;
+
+  //  erase() returns the element after the erased element
+  for (long k = 0; k < n; k += 20)
+  {
+    map_type::const_iterator it = bt.erase(bt.find(k));
+    std::map<long, long>::iterator s = stl.erase(stl.find(k));
+    BOOST_TEST((it == bt.end()) == (s == stl.end()));
+    if (it != bt.end() && s != stl.end())
+      BOOST_TEST_EQ(it->key(), s->first);
+  }
+  BOOST_TEST(same(bt, stl));
+
+  //  erase a range
+  map_type::const_iterator first = bt.lower_bound(n / 4);
+  map_type::const_iterator last = bt.lower_bound(n / 2);
+  map_type::const_iterator result = bt.erase(first, last);
+  stl.erase(stl.lower_bound(n / 4), stl.lower_bound(n / 2));
+  BOOST_TEST(result != bt.end() && result->key() == stl.lower_bound(n / 4)->first);
+  BOOST_TEST(same(bt, stl));
+
+  //  reopen, grow again, then shrink to nothing
+  bt.close();
+  bt.open("min_fill.btree", btree::flags::read_write);
+  bt.min_fill(40);
+  for (long i = 0; i < n; ++i)
+  {
+    bt.emplace(i, -i);
+    stl.insert(std::make_pair(i, -i));
+  }
+  BOOST_TEST(same(bt, stl));
+  for (long i = n - 1; i >= 0; --i)
+    BOOST_TEST_EQ(bt.erase((i * 7919) % n), 1U);
+  BOOST_TEST(bt.empty());
+  BOOST_TEST_EQ(bt.header().root_level(), 0U);
+
+  //  duplicate keys, so separators equal keys on both sides
+  multimap_type mm("min_fill_multi.btree", btree::flags::truncate, 128);
+  mm.min_fill(50);
+  std::multimap<long, long> mstl;
+  for (long i = 0; i < n; ++i)
+  {
+    mm.emplace(i % 97, i);
+    mstl.insert(std::make_pair(i % 97, i));
+  }
+  for (long k = 0; k < 97; k += 2)
+  {
+    BOOST_TEST_EQ(mm.erase(k), static_cast<multimap_type::size_type>(mstl.erase(k)));
+    BOOST_TEST_EQ(mm.count(k + 1),
+      static_cast<multimap_type::size_type>(mstl.count(k + 1)));
+  }
+  BOOST_TEST_EQ(mm.size(), static_cast<multimap_type::size_type>(mstl.size()));
+  long count = 0;
+  for (multimap_type::iterator it = mm.begin(); it != mm.end(); ++it, ++count)
+    BOOST_TEST(it->key() % 2 == 1);
+  BOOST_TEST_EQ(count, static_cast<long>(mstl.size()));
+  BOOST_TEST(mm.node_merges() > 0);
+
+  //  dynamic size keys are merged but never borrowed
+  typedef btree::btree_set<btree::strbuf> set_type;
+  set_type st("min_fill_strbuf.btree", btree::flags::truncate, 256);
+  st.min_fill(30);
+  std::set<std::string> sstl;
+  for (long i = 0; i < 2000; ++i)
+  {
+    std::ostringstream os;
+    os << (i * 7919) % 2000 << std::string(i % 17, 'y');
+    st.insert(btree::strbuf(os.str().c_str()));
+    sstl.insert(os.str());
+  }
+  for (std::set<std::string>::iterator it = sstl.begin(); it != sstl.end(); )
+  {
+    BOOST_TEST_EQ(st.erase(btree::strbuf(it->c_str())), 1U);
+    sstl.erase(it++);
+    if (it != sstl.end())
+      ++it;
+  }
+  BOOST_TEST_EQ(st.size(), static_cast<set_type::size_type>(sstl.size()));
+  std::set<std::string>::iterator s = sstl.begin();
+  for (set_type::iterator it = st.begin(); it != st.end() && s != sstl.end(); ++it, ++s)
+    BOOST_TEST_EQ(std::string(it->c_str()), *s);
+  BOOST_TEST(st.node_merges() > 0);
+  BOOST_TEST_EQ(st.node_borrows(), 0U);
+
+  //  likewise keys that cannot be assigned, erased via iterators
+  typedef btree::btree_map<btree::c_str_proxy, long> proxy_map_type;
+  proxy_map_type pm("min_fill_c_str_proxy.btree", btree::flags::truncate, 256);
+  pm.min_fill(30);
+  std::map<std::string, long> pstl;
+  for (long i = 0; i < 2000; ++i)
+  {
+    std::ostringstream os;
+    os << (i * 7919) % 2000 << std::string(i % 13, 'z');
+    pm.emplace(btree::make_c_str(os.str()), i);
+    pstl.insert(std::make_pair(os.str(), i));
+  }
+  for (std::map<std::string, long>::iterator it = pstl.begin(); it != pstl.end(); )
+  {
+    proxy_map_type::const_iterator pit = pm.find(btree::make_c_str(it->first));
+    BOOST_TEST(pit != pm.end());
+    pm.erase(pit);
+    pstl.erase(it++);
+    if (it != pstl.end())
+      ++it;
+  }
+  BOOST_TEST_EQ(pm.size(), static_cast<proxy_map_type::size_type>(pstl.size()));
+  std::map<std::string, long>::iterator ps = pstl.begin();
+  for (proxy_map_type::iterator it = pm.begin(); it != pm.end() && ps != pstl.end();
+    ++it, ++ps)
+  {
+    BOOST_TEST_EQ(std::string(it->key().c_str()), ps->first);
+    BOOST_TEST_EQ(it->mapped_value(), ps->second);
+  }
+  BOOST_TEST(pm.node_merges() > 0);
+  BOOST_TEST_EQ(pm.node_borrows(), 0U);
+
+  cout << "     min_fill complete" << endl;
+}
+
+//-----------------------------------  compact  ----------------------------------------//
+
+void  compact()
+{
+  cout << "  compact..." << endl;
+
+  typedef btree::btree_map<long, long> map_type;
+  const long n = 4000;
+
+  map_type bt("compact.btree", btree::flags::truncate, 128);
+  bt.max_cache_size(16);
+  std::map<long, long> stl;
+  for (long i = 0; i < n; ++i)
+  {
+    long k = (i * 7919) % n;
+    bt.emplace(k, i);
+    stl.insert(std::make_pair(k, i));
+  }
+  for (long k = 0; k < n; ++k)  // leave the tree sparse, with a long free list
+  {
+    if (k % 3 == 0 && k < n / 2)
+      continue;
+    BOOST_TEST_EQ(bt.erase(k), 1U);
+    stl.erase(k);
+  }
+  bt.flush();
+  BOOST_TEST(bt.header().free_node_list_head_id() != 0U);
+  boost::uintmax_t old_size = fs::file_size("compact.btree");
+
+  bt.compact(80);
+  BOOST_TEST(bt.is_open());
+  BOOST_TEST(!bt.read_only());
+  BOOST_TEST_EQ(bt.max_cache_size(), 16U);
+  BOOST_TEST(same(bt, stl));
+  BOOST_TEST(!fs::exists("compact.btree.load"));
+  BOOST_TEST(!fs::exists("compact.btree.compact"));
+  BOOST_TEST(fs::file_size("compact.btree") * 2 < old_size);
+  cout << "    file size " << old_size << " before, "
+       << fs::file_size("compact.btree") << " after" << endl;
+
+  //  branches first, then the leaves, with no free nodes
+  BOOST_TEST_EQ(bt.header().free_node_list_head_id(), 0U);
+  BOOST_TEST_EQ(bt.header().root_node_id(), 1U);
+  BOOST_TEST(bt.header().first_node_id() > 1U);
+  BOOST_TEST_EQ(bt.header().last_node_id() + 1, bt.header().node_count());
+
+  //  still fully usable, and still unique
+  BOOST_TEST(!bt.emplace(3, 0).second);
+  for (long k = 1; k < n; k += 3)
+  {
+    bt.emplace(k, -k);
+    stl.insert(std::make_pair(k, -k));
+  }
+  BOOST_TEST_EQ(bt.erase(0), 1U);
+  stl.erase(0);
+  BOOST_TEST(same(bt, stl));
+  bt.close();
+  bt.open("compact.btree");
+  BOOST_TEST(same(bt, stl));
+  bt.close();
+
+  //  duplicates keep their order
+  typedef btree::btree_multimap<long, long> multimap_type;
+  multimap_type mm("compact_multi.btree", btree::flags::truncate, 128);
+  std::multimap<long, long> mstl;
+  for (long i = 0; i < n; ++i)
+  {
+    mm.emplace(i % 97, i);
+    mstl.insert(std::make_pair(i % 97, i));
+  }
+  mm.compact();
+  BOOST_TEST(same(mm, mstl));
+
+  cout << "     compact complete" << endl;
+}
+
+//-----------------------------------  free_map  ---------------------------------------//
+
+void  free_map()
+{
+  cout << "  free_map..." << endl;
+
+  typedef btree::btree_map<long, long> map_type;
+  const long n = 4000;
+
+  map_type bt("free_map.btree", btree::flags::truncate, 128);
+  for (long i = 0; i < n; ++i)
+    bt.emplace(i, i);
+  boost::uint32_t node_count = bt.header().node_count();
+  boost::uint32_t last_id = bt.header().last_node_id();
+
+  //  free the leaves near the end of the file first, then those near the start
+  for (long i = 3 * n / 4; i < n - 1; ++i)
+    BOOST_TEST_EQ(bt.erase(i), 1U);
+  for (long i = 0; i < n / 4; ++i)
+    BOOST_TEST_EQ(bt.erase(i), 1U);
+  BOOST_TEST_EQ(bt.header().node_count(), node_count);
+
+  //  the free map survives a reopen
+  bt.close();
+  bt.open("free_map.btree", btree::flags::read_write);
+  BOOST_TEST(bt.header().free_node_list_head_id() != 0U);
+
+  //  appended leaves reuse free nodes near the last leaf, not the first freed
+  for (long i = n; i < n + 200; ++i)
+    bt.emplace(i, i);
+  BOOST_TEST(bt.header().last_node_id() != last_id);
+  BOOST_TEST(bt.header().last_node_id() > node_count / 2);
+  BOOST_TEST_EQ(bt.header().node_count(), node_count);
+
+  //  refilling the tree uses up the free nodes before the file grows
+  for (long i = 0; i < n; ++i)
+    bt.emplace(i, i);
+  BOOST_TEST_EQ(bt.size(), static_cast<map_type::size_type>(n + 200));
+  bt.close();
+  bt.open("free_map.btree", btree::flags::read_write);
+  BOOST_TEST_EQ(bt.header().free_node_list_head_id(), 0U);
+  long k = 0;
+  for (map_type::const_iterator it = bt.begin(); it != bt.end(); ++it, ++k)
+    BOOST_TEST_EQ(it->key(), k);
+  BOOST_TEST_EQ(k, n + 200);
+  BOOST_TEST_EQ(static_cast<int>(bt.header().minor_version()),
+    static_cast<int>(btree::minor_version));
+  bt.close();
+
+  //  a file from a newer minor version may use a free list this version can't read
+  {
+    btree::binary_file f("free_map.btree", btree::oflag::in | btree::oflag::out);
+    boost::uint8_t version = btree::minor_version + 1;
+    f.write_at(6, &version, 1);  // header_page::m_minor_version
+  }
+  bool thrown = false;
+  try { map_type bt2("free_map.btree", btree::flags::read_write); }
+  catch (const std::runtime_error&) { thrown = true; }
+  BOOST_TEST(thrown);
+
+  cout << "     free_map complete" << endl;
+}
+
+//-------------------------------  hinted_insert  --------------------------------------//
+
+template <class BTree>
+boost::uint32_t node_reads(const BTree& bt)
+{
+  return bt.manager().active_buffers_read() + bt.manager().cached_buffers_read()
+    + bt.manager().file_buffers_read();
+}
+
+void  hinted_insert()
+{
+  cout << "  hinted_insert..." << endl;
+
+  typedef btree::btree_map<long, long> map_type;
+  const long n = 5000;
+
+  map_type plain("hinted_plain.btree", btree::flags::truncate, 128);
+  boost::uint32_t plain_reads = node_reads(plain);
+  for (long i = 0; i < n; ++i)
+    plain.emplace(i * 2, i);
+  plain_reads = node_reads(plain) - plain_reads;
+
+  map_type bt("hinted.btree", btree::flags::truncate, 128);
+  boost::uint32_t hinted_reads = node_reads(bt);
+  bt.insert(plain.begin(), plain.end());
+  hinted_reads = node_reads(bt) - hinted_reads;
+  cout << "    node reads for " << n << " sorted inserts: " << hinted_reads
+       << " hinted vs " << plain_reads << " unhinted" << endl;
+  BOOST_TEST(hinted_reads * 2 < plain_reads);
+
+  //  any hint gives the same result, including stale and end() hints
+  std::map<long, long> stl;
+  for (long i = 0; i < n; ++i)
+    stl[i * 2] = i;
+  BOOST_TEST(same(bt, stl));
+  std::vector<map_type::const_iterator> hints;
+  hints.push_back(bt.end());
+  for (long i = 0; i < 40; ++i)
+    hints.push_back(bt.find(((i * 7919) % n) * 2));
+  for (long i = 0; i < n; ++i)
+  {
+    long k = ((i * 7877) % (2 * n)) | 1;  // odd keys are new
+    map_type::const_iterator hint = hints[i % hints.size()];
+    map_type::const_iterator it = bt.emplace_hint(hint, k, -k);
+    BOOST_TEST(it != bt.end() && it->key() == k);
+    stl.insert(std::make_pair(k, -k));
+    hints[i % hints.size()] = it;
+    BOOST_TEST_EQ(bt.insert(hint, *it)->mapped_value(), -k);  // already present
+    if (i % 100 == 0)
+      bt.erase(bt.find(k));  // invalidate some hint paths
+    if (i % 100 == 0)
+      stl.erase(k);
+    long probe = (i * 31) % (2 * n + 10) - 5;
+    map_type::const_iterator lb = bt.lower_bound(hint, probe);
+    BOOST_TEST(lb == bt.lower_bound(probe));
+  }
+  BOOST_TEST_EQ(bt.size(), stl.size());
+  BOOST_TEST(same(bt, stl));
+
+  //  non-unique hinted inserts still go after equivalent keys
+  typedef btree::btree_multimap<long, long> multimap_type;
+  multimap_type mm("hinted_multi.btree", btree::flags::truncate, 128);
+  std::multimap<long, long> mstl;
+  multimap_type::const_iterator hint = mm.end();
+  for (long i = 0; i < n; ++i)
+  {
+    hint = mm.emplace_hint(i % 3 ? hint : mm.begin(), i / 4, i);
+    BOOST_TEST_EQ(hint->mapped_value(), i);
+    mstl.insert(std::make_pair(i / 4, i));
+  }
+  BOOST_TEST(same(mm, mstl));
+
+  //  sets too
+  btree::btree_set<long> st("hinted_set.btree", btree::flags::truncate, 128);
+  std::vector<long> keys;
+  for (long i = 0; i < n; ++i)
+    keys.push_back(i % 1000);
+  st.insert(keys.begin(), keys.end());
+  BOOST_TEST_EQ(st.size(), 1000U);
+  BOOST_TEST_EQ(*st.insert(st.begin(), 500L), 500L);
+
+  cout << "     hinted_insert complete" << endl;
+}
+
+//------------------------------  insert_or_assign  ------------------------------------//
+
+void  insert_or_assign()
+{
+  cout << "  insert_or_assign..." << endl;
+
+  typedef btree::btree_map<long, long> map_type;
+  const long n = 3000;
+
+  map_type bt("insert_or_assign.btree", btree::flags::truncate, 128);
+  std::map<long, long> stl;
+  map_type::const_iterator hint = bt.end();
+  for (long i = 0; i < 2 * n; ++i)
+  {
+    long k = (i * 7919) % n;
+    std::pair<map_type::const_iterator, bool> r = bt.insert_or_assign(k, i);
+    BOOST_TEST_EQ(r.second, stl.find(k) == stl.end());
+    BOOST_TEST(r.first != bt.end() && r.first->key() == k && r.first->mapped_value() == i);
+    stl[k] = i;
+    hint = bt.insert_or_assign(i % 5 ? hint : bt.end(), k + 1, -i);  // hinted, mostly
+    BOOST_TEST(hint->key() == k + 1 && hint->mapped_value() == -i);
+    stl[k + 1] = -i;
+  }
+  BOOST_TEST_EQ(bt.size(), stl.size());
+  BOOST_TEST(same(bt, stl));
+
+  //  non-unique: the first of the equivalent elements is updated, even when they span
+  //  several leaves
+  typedef btree::btree_multimap<long, long> multimap_type;
+  multimap_type mm("insert_or_assign_multi.btree", btree::flags::truncate, 128);
+  for (long i = 0; i < 200; ++i)
+    mm.emplace(i / 50, i);
+  for (long k = 0; k < 5; ++k)
+  {
+    std::pair<multimap_type::const_iterator, bool> r = mm.insert_or_assign(k, -k);
+    BOOST_TEST_EQ(r.second, k == 4);
+    BOOST_TEST(r.first == mm.lower_bound(k));
+    BOOST_TEST_EQ(r.first->mapped_value(), -k);
+  }
+  BOOST_TEST_EQ(mm.size(), 201U);
+  BOOST_TEST_EQ(mm.count(2), 50U);
+
+  //  mapped values whose size changes, forcing leaf splits
+  typedef btree::btree_map<long, btree::strbuf> var_type;
+  var_type vt("insert_or_assign_var.btree", btree::flags::truncate, 128);
+  std::map<long, std::string> vstl;
+  for (long i = 0; i < 400; ++i)
+  {
+    vt.emplace(i, btree::strbuf("x"));
+    vstl[i] = "x";
+  }
+  vt.erase(vt.find(300));
+  vstl.erase(300);
+  for (long i = 0; i < 1200; ++i)
+  {
+    long k = (i * 37) % 500;
+    std::string v(static_cast<std::size_t>(i % 23), static_cast<char>('a' + i % 26));
+    if (i % 3)
+    {
+      std::pair<var_type::const_iterator, bool> r
+        = vt.insert_or_assign(k, btree::strbuf(v.c_str()));
+      BOOST_TEST_EQ(r.second, vstl.find(k) == vstl.end());
+      BOOST_TEST(r.first->key() == k && v == r.first->mapped_value().c_str());
+    }
+    else if (vstl.find(k) != vstl.end())
+    {
+      var_type::iterator it = vt.update(vt.find(k), btree::strbuf(v.c_str()));
+      BOOST_TEST(it->key() == k && v == it->mapped_value().c_str());
+    }
+    else
+      continue;
+    vstl[k] = v;
+  }
+
+  //  an iterator whose parent chain went stale when inserts elsewhere split branches
+  var_type::iterator stale = vt.find(17);
+  for (long k = 1000; k < 1400; ++k)
+  {
+    vt.insert_or_assign(k, btree::strbuf("new"));
+    vstl[k] = "new";
+  }
+  vstl[17] = "a string long enough to overflow the leaf it is in, if it is full";
+  stale = vt.update(stale, btree::strbuf(vstl[17].c_str()));
+  BOOST_TEST(stale->key() == 17 && vstl[17] == stale->mapped_value().c_str());
+
+  BOOST_TEST_EQ(vt.size(), vstl.size());
+  std::map<long, std::string>::const_iterator sit = vstl.begin();
+  for (var_type::const_iterator it = vt.begin(); it != vt.end(); ++it, ++sit)
+  {
+    BOOST_TEST(sit != vstl.end());
+    BOOST_TEST_EQ(it->key(), sit->first);
+    BOOST_TEST(sit->second == it->mapped_value().c_str());
+  }
+
+  cout << "     insert_or_assign complete" << endl;
+}
+
+//--------------------------------  blob_values  ---------------------------------------//
+
+std::string blob_string(long i, std::size_t sz)
+{
+  std::string v(sz, static_cast<char>('a' + i % 26));
+  for (std::size_t j = 0; j < sz; j += 97)
+    v[j] = static_cast<char>('0' + (i + j) % 10);
+  return v;
+}
+
+template <class BTree>
+bool same_blobs(const BTree& bt, const std::map<long, std::string>& stl)
+{
+  if (bt.size() != stl.size())
+    return false;
+  std::map<long, std::string>::const_iterator sit = stl.begin();
+  for (typename BTree::const_iterator it = bt.begin(); it != bt.end(); ++it, ++sit)
+  {
+    std::string v(it->mapped_value().size(), '\0');
+    if (!v.empty())
+      bt.read_blob(it->mapped_value(), &v[0]);
+    if (it->key() != sit->first || v != sit->second)
+      return false;
+  }
+  return true;
+}
+
+void  blob_values()
+{
+  cout << "  blob_values..." << endl;
+
+  typedef btree::btree_map<long, btree::blob> map_type;
+  const long n = 400;
+
+  map_type bt("blob.btree", btree::flags::truncate, 512);
+  BOOST_TEST_EQ(bt.overflow_threshold(), 64U);
+  std::map<long, std::string> stl;
+  long overflows = 0;
+  for (long i = 0; i < n; ++i)
+  {
+    long k = (i * 7919) % n;
+    std::string v(blob_string(i, (i * 37) % 2000));
+    btree::blob b = bt.make_blob(v.data(), v.size());
+    BOOST_TEST_EQ(b.size(), v.size());
+    BOOST_TEST_EQ(b.is_overflow(), v.size() > 64);
+    overflows += b.is_overflow();
+    bt.emplace(k, b);
+    stl[k] = v;
+  }
+  BOOST_TEST(same_blobs(bt, stl));
+
+  //  a key only scan reads the leaves, but none of the overflow nodes
+  bt.close();
+  bt.open("blob.btree", btree::flags::read_write);
+  boost::uint32_t reads = node_reads(bt);
+  long count = 0;
+  for (map_type::const_iterator it = bt.begin(); it != bt.end(); ++it)
+    count += it->key() >= 0;
+  reads = node_reads(bt) - reads;
+  cout << "    key scan read " << reads << " of " << bt.header().node_count()
+       << " nodes" << endl;
+  BOOST_TEST_EQ(count, n);
+  BOOST_TEST(reads * 10 < bt.header().node_count());
+  BOOST_TEST(same_blobs(bt, stl));
+  BOOST_TEST(overflows * 9 / 10 < n);
+
+  //  erase and update free overflow nodes, which later blobs reuse
+  boost::uint32_t node_count = bt.header().node_count();
+  for (long k = 0; k < n; k += 2)
+  {
+    BOOST_TEST_EQ(bt.erase(k), 1U);
+    stl.erase(k);
+  }
+  for (long k = 1; k < n; k += 4)
+  {
+    std::string v(blob_string(k, (k * 53) % 1500));
+    map_type::const_iterator it = bt.update(bt.find(k), bt.make_blob(v.data(), v.size()));
+    BOOST_TEST_EQ(it->key(), k);
+    stl[k] = v;
+  }
+  BOOST_TEST(same_blobs(bt, stl));
+  for (long k = 0; k < n; k += 2)
+  {
+    std::string v(blob_string(k, (k * 37) % 2000));
+    BOOST_TEST(bt.insert_or_assign(k, bt.make_blob(v.data(), v.size())).second);
+    stl[k] = v;
+  }
+  BOOST_TEST(same_blobs(bt, stl));
+  BOOST_TEST(bt.header().node_count() < node_count + node_count / 4);
+
+  //  a blob that is not inserted is freed by the caller
+  std::string big(blob_string(1, 5000));
+  btree::blob b = bt.make_blob(big.data(), big.size());
+  BOOST_TEST(!bt.emplace(1, b).second);
+  bt.free_blob(b);
+
+  //  compact() carries the overflow nodes over, after the leaves
+  bt.compact();
+  BOOST_TEST_EQ(bt.header().free_node_list_head_id(), 0U);
+  BOOST_TEST(bt.header().last_node_id() + 1 < bt.header().node_count());
+  BOOST_TEST(same_blobs(bt, stl));
+  bt.close();
+  bt.open("blob.btree");
+  BOOST_TEST(same_blobs(bt, stl));
+
+  cout << "     blob_values complete" << endl;
+}
+
+//------------------------------  concurrent_readers  ----------------------------------//
+
+typedef btree::btree_map<long, long> reader_map_type;
+
+//  each reader does random finds, lower_bounds, and short forward and backward scans,
+//  counting results that don't match the values inserted: for every k, k*2 -> k*3
+struct concurrent_reader
+{
+  const reader_map_type*  bt;
+  long                    n;
+  unsigned                seed;
+  long*                   errors;
+
+  void operator()() const
+  {
+    boost::minstd_rand rng(seed);
+    long errs = 0;
+    for (int i = 0; i < 2000; ++i)
+    {
+      long k = static_cast<long>(rng() % n);
+      reader_map_type::const_iterator it = bt->find(k * 2);
+      if (it == bt->end() || it->mapped_value() != k * 3)
+        ++errs;
+      if (bt->find(k * 2 + 1) != bt->end())
+        ++errs;
+
+      it = bt->lower_bound(k * 2 - 1);
+      long expect = k;
+      for (int j = 0; j < 40 && it != bt->end(); ++j, ++it, ++expect)
+        if (it->key() != expect * 2 || it->mapped_value() != expect * 3)
+          ++errs;
+      if (it == bt->end() ? expect != n : expect - k != 40)
+        ++errs;
+
+      for (int j = 0; j < 10 && it != bt->begin(); ++j)
+        if ((--it)->key() != (--expect) * 2)
+          ++errs;
+    }
+    *errors = errs;
+  }
+};
+
+void  concurrent_readers()
+{
+  cout << "  concurrent_readers..." << endl;
+
+  const long n = 20000;
+  {
+    reader_map_type bt("concurrent.btree", btree::flags::truncate, 128);
+    for (long k = 0; k < n; ++k)
+      bt.emplace(k * 2, k * 3);
+  }
+
+  reader_map_type bt("concurrent.btree",
+    btree::flags::read_only | btree::flags::concurrent_read);
+  BOOST_TEST(bt.manager().concurrent());
+  bt.max_cache_size(64);  // small, so threads reuse each other's buffers
+
+  const int threads = 8;
+  long errors[threads];
+  boost::thread_group group;
+  for (int t = 0; t < threads; ++t)
+  {
+    concurrent_reader reader = { &bt, n, static_cast<unsigned>(t + 1), &errors[t] };
+    group.create_thread(reader);
+  }
+  group.join_all();
+
+  for (int t = 0; t < threads; ++t)
+    BOOST_TEST_EQ(errors[t], 0);
+  BOOST_TEST(bt.manager().buffers_in_memory() < bt.header().node_count() / 4);
+  BOOST_TEST_EQ(bt.size(), static_cast<std::size_t>(n));
+
+  //  the file can still be opened for writing once the readers are done
+  bt.close();
+  bt.open("concurrent.btree", btree::flags::read_write);
+  BOOST_TEST(!bt.manager().concurrent());
+  bt.emplace(-2, -3);
+  BOOST_TEST_EQ(bt.begin()->key(), -2);
+
+  cout << "     concurrent_readers complete" << endl;
+}
+
+//------------------------------  concurrent_writers  ----------------------------------//
+
+//  each writer inserts, erases, and finds keys in its own range, [first, first + n)
+struct concurrent_writer
+{
+  reader_map_type*  bt;
+  long              first;
+  long              n;
+  long*             errors;
+
+  void operator()() const
+  {
+    long errs = 0;
+    for (long i = 0; i < n; ++i)
+    {
+      long k = first + (i * 7919) % n;  // scrambled, so that leaves fill unevenly
+      if (!bt->emplace(k, k * 3).second)
+        ++errs;
+    }
+    for (long k = first; k < first + n; ++k)
+    {
+      if (bt->count(k) != 1 || bt->find(k) == bt->end())
+        ++errs;
+      if (k % 3 == 0 && bt->erase(k) != 1)
+        ++errs;
+    }
+    for (long k = first; k < first + n; ++k)
+      if (bt->count(k) != (k % 3 != 0) || bt->emplace(k, 0).second != (k % 3 == 0))
+        ++errs;
+    *errors = errs;
+  }
+};
+
+void  concurrent_writers(bool flusher)
+{
+  cout << "  concurrent_writers" << (flusher ? " with flusher..." : "...") << endl;
+
+  const int threads = 8;
+  const long n = 3000;   // keys per thread
+  {
+    reader_map_type bt("concurrent.btree",
+      btree::flags::truncate | btree::flags::concurrent_write, 128);
+    bt.max_cache_size(32);  // small, so that dirty leaves are written when evicted
+    bt.min_fill(30);
+    if (flusher)
+      bt.start_flusher(50, 25);
+
+    long errors[threads];
+    boost::thread_group group;
+    for (int t = 0; t < threads; ++t)
+    {
+      concurrent_writer writer = { &bt, t * n, n, &errors[t] };
+      group.create_thread(writer);
+    }
+    group.join_all();
+
+    for (int t = 0; t < threads; ++t)
+      BOOST_TEST_EQ(errors[t], 0);
+    BOOST_TEST_EQ(bt.size(), static_cast<std::size_t>(threads * n));
+    bt.flush();  // copies the count to the header
+    BOOST_TEST_EQ(bt.header().element_count(), static_cast<boost::uint64_t>(threads * n));
+    BOOST_TEST_EQ(bt.manager().flusher_running(), flusher);
+  }
+
+  reader_map_type bt("concurrent.btree");
+  BOOST_TEST_EQ(bt.size(), static_cast<std::size_t>(threads * n));
+  long k = 0;
+  for (reader_map_type::const_iterator it = bt.begin(); it != bt.end(); ++it, ++k)
+  {
+    BOOST_TEST_EQ(it->key(), k);
+    BOOST_TEST_EQ(it->mapped_value(), k % 3 ? k * 3 : 0);
+  }
+  BOOST_TEST_EQ(k, threads * n);
+
+  cout << "     concurrent_writers complete" << endl;
+}
+
+//---------------------------------  optimistic_find  ----------------------------------//
+
+//  keys 4k are always present; each churner repeatedly inserts and erases keys 4k + 1
+//  in its own range, splitting and merging leaves under the searchers
+struct churner
+{
+  reader_map_type*  bt;
+  long              first;
+  long              n;
+  long*             errors;
+
+  void operator()() const
+  {
+    long errs = 0;
+    for (int round = 0; round < 4; ++round)
+    {
+      for (long k = first; k < first + n; ++k)
+        if (!bt->emplace(k * 4 + 1, round).second)
+          ++errs;
+      for (long k = first; k < first + n; ++k)
+        if (bt->erase(k * 4 + 1) != 1)
+          ++errs;
+    }
+    *errors = errs;
+  }
+};
+
+struct optimistic_searcher
+{
+  const reader_map_type*      bt;
+  long                        n;
+  unsigned                    seed;
+  const boost::atomic<bool>*  done;
+  long*                       errors;
+
+  void operator()() const
+  {
+    long errs = 0;
+    boost::minstd_rand rng(seed);
+    while (!done->load())
+    {
+      long k = static_cast<long>(rng() % n);
+      if (bt->find(k * 4) == bt->end() || bt->count(k * 4) != 1)
+        ++errs;
+      if (bt->find(k * 4 + 3) != bt->end() || bt->count(k * 4 + 3) != 0)
+        ++errs;
+    }
+    *errors = errs;
+  }
+};
+
+void  optimistic_find()
+{
+  cout << "  optimistic_find..." << endl;
+
+  const int churners = 4;
+  const int searchers = 4;
+  const long n = 1500;   // keys per churner
+  reader_map_type bt("optimistic.btree",
+    btree::flags::truncate | btree::flags::concurrent_write, 128);
+  bt.max_cache_size(32);
+  bt.min_fill(30);  // so that erases merge leaves
+  for (long k = 0; k < churners * n; ++k)
+    bt.emplace(k * 4, k);
+
+  boost::atomic<bool> done(false);
+  long errors[churners + searchers];
+  boost::thread_group churn_group, search_group;
+  for (int t = 0; t < searchers; ++t)
+  {
+    optimistic_searcher searcher = { &bt, churners * n, static_cast<unsigned>(t + 1),
+      &done, &errors[churners + t] };
+    search_group.create_thread(searcher);
+  }
+  for (int t = 0; t < churners; ++t)
+  {
+    churner c = { &bt, t * n, n, &errors[t] };
+    churn_group.create_thread(c);
+  }
+  churn_group.join_all();
+  done = true;
+  search_group.join_all();
+
+  for (int t = 0; t < churners + searchers; ++t)
+    BOOST_TEST_EQ(errors[t], 0);
+  BOOST_TEST(bt.node_merges() > 0U);
+  BOOST_TEST_EQ(bt.size(), static_cast<std::size_t>(churners * n));
+
+  //  iterators returned by find() have parent links for the final branches
+  for (long k = 0; k < churners * n; k += 97)
+  {
+    reader_map_type::const_iterator it = bt.find(k * 4);
+    for (long j = k; j < k + 40 && j < churners * n; ++j, ++it)
+    {
+      BOOST_TEST(it != bt.end());
+      BOOST_TEST_EQ(it->key(), j * 4);
+    }
+  }
+
+  //  once the branches are pinned, a search reads only its leaf through the cache
+  BOOST_TEST(bt.header().root_level() > 1U);
+  for (long k = 0; k < churners * n; ++k)
+    bt.count(k * 4);
+  boost::uint32_t reads = bt.manager().active_buffers_read()
+    + bt.manager().cached_buffers_read() + bt.manager().file_buffers_read();
+  for (long k = 0; k < churners * n; ++k)
+    BOOST_TEST_EQ(bt.count(k * 4), 1U);
+  BOOST_TEST_EQ(bt.manager().active_buffers_read() + bt.manager().cached_buffers_read()
+    + bt.manager().file_buffers_read() - reads, static_cast<boost::uint32_t>(churners * n));
+
+  cout << "     optimistic_find complete" << endl;
+}
+
+//------------------------------------  read_ahead  ------------------------------------//
+
+void  read_ahead()
+{
+  cout << "  read_ahead..." << endl;
+
+  const long n = 10000;
+  {
+    reader_map_type bt("read_ahead.btree", btree::flags::truncate, 128);
+    BOOST_TEST_EQ(bt.read_ahead(), btree::default_read_ahead_nodes);
+    for (long k = 0; k < n; ++k)
+      bt.emplace(k * 2, k * 3);
+  }
+
+  for (int pass = 0; pass < 3; ++pass)
+  {
+    btree::flags::bitmask flgs = btree::flags::read_only;
+    if (pass == 2)
+      flgs |= btree::flags::concurrent_read;
+    reader_map_type bt("read_ahead.btree", flgs);
+    bt.max_cache_size(8);  // small, so that the leaves ahead are not in memory
+    if (pass == 1)
+      bt.read_ahead(0);
+
+    long k = 0;
+    for (reader_map_type::const_iterator it = bt.begin(); it != bt.end(); ++it, ++k)
+    {
+      BOOST_TEST_EQ(it->key(), k * 2);
+      BOOST_TEST_EQ(it->mapped_value(), k * 3);
+    }
+    BOOST_TEST_EQ(k, n);
+
+    k = n / 2;
+    for (reader_map_type::const_iterator it = bt.lower_bound(n - 1);
+      it != bt.upper_bound(n + 199); ++it, ++k)
+      BOOST_TEST_EQ(it->key(), k * 2);
+    BOOST_TEST_EQ(k, n / 2 + 100);
+
+    //  a scan that starts at a leaf found by a search hints the leaves ahead of it at
+    //  its first step, even when that leaf is in the middle of its parent
+    for (long start = 1001; pass != 1 && start < 9000; start += 997)
+    {
+      reader_map_type::const_iterator it = bt.lower_bound(start * 2);
+      boost::uint64_t prefetched = bt.manager().buffers_prefetched();
+      for (int i = 0; i < 40; ++i)
+        ++it;
+      BOOST_TEST(bt.manager().buffers_prefetched() - prefetched > 2U);
+    }
+
+    if (pass == 1)
+      BOOST_TEST_EQ(bt.manager().buffers_prefetched(), 0U);
+    else
+      BOOST_TEST(bt.manager().buffers_prefetched() > 0U);
+  }
+
+  cout << "     read_ahead complete" << endl;
+}
+
 //-------------------------------------  _test  ----------------------------------------//
 
 void  _test()
@@ -1155,6 +2836,25 @@ int cpp_main(int, char*[])
   //parent_pointer_lifetime();
   pack_optimization();
   reopen_btree_object_test();
+  find_many();
+  mapped();
+  bulk_load();
+  sort_loader();
+  separators();
+  slot_directory();
+  node_search();
+  key_column();
+  min_fill();
+  compact();
+  free_map();
+  hinted_insert();
+  insert_or_assign();
+  blob_values();
+  concurrent_readers();
+  concurrent_writers(false);
+  concurrent_writers(true);
+  optimistic_find();
+  read_ahead();
   //fixstr();
   
 
@@ -15,6 +15,9 @@
 #define BOOST_BUFFER_MANAGER_TEST
 
 #include <boost/btree/detail/buffer_manager.hpp>
+#include <boost/btree/support/timer.hpp>
+#include <boost/intrusive/set.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/filesystem/v3/operations.hpp>
 #include <boost/detail/lightweight_main.hpp>
 #include <boost/detail/lightweight_test.hpp> 
@@ -23,6 +26,7 @@
 #include <iomanip>
 #include <string>
 #include <cstring>
+#include <vector>
 
 using namespace boost::btree;
 namespace fs = boost::filesystem;
@@ -40,24 +44,132 @@ namespace
 
     buffer pg (1);
 
-    buffer_manager::buffers_type set;
-
-    set.insert(pg);
-    BOOST_TEST(&*set.begin() == &pg);
-    //  buffer_manager logic relies on iterator_to working as expected:
-    BOOST_TEST(set.begin() == set.iterator_to(pg));
-
     buffer_manager::buffer_cache_type list;
 
     list.push_back(pg);
     BOOST_TEST(&*list.begin() == &pg);
     //  buffer_manager logic relies on iterator_to working as expected:
     BOOST_TEST(list.begin() == list.iterator_to(pg));
+    list.clear();
+  }
+
+//  buffer_index_test  -----------------------------------------------------------------//
+
+  void buffer_index_test()
+  {
+    cout << "buffer_index_test..." << endl;
+
+    const buffer::buffer_id_type n = 1000;
+    std::vector<buffer*> v;
+    for (buffer::buffer_id_type i = 0; i < n; ++i)
+      v.push_back(new buffer(i * 3));  // spread ids a bit
+
+    buffer_manager::buffers_type index;
+    BOOST_TEST(index.empty());
+    BOOST_TEST(!index.find(0));
+    BOOST_TEST(index.begin() == index.end());
+
+    for (buffer::buffer_id_type i = 0; i < n; ++i)
+      index.insert(*v[i]);
+    BOOST_TEST_EQ(index.size(), n);
+    BOOST_TEST(index.capacity() >= 2 * n);
+
+    for (buffer::buffer_id_type i = 0; i < n; ++i)
+    {
+      BOOST_TEST(index.find(i * 3) == v[i]);
+      BOOST_TEST(!index.find(i * 3 + 1));
+    }
+
+    std::size_t count = 0;
+    for (buffer_manager::buffers_type::iterator itr = index.begin();
+      itr != index.end(); ++itr, ++count)
+      BOOST_TEST(index.find(itr->buffer_id()) == &*itr);
+    BOOST_TEST_EQ(count, n);
+
+    //  erase every other buffer; the remainder must still be found after the shifts
+    for (buffer::buffer_id_type i = 0; i < n; i += 2)
+      index.erase(*v[i]);
+    BOOST_TEST_EQ(index.size(), n / 2);
+    for (buffer::buffer_id_type i = 0; i < n; ++i)
+      BOOST_TEST(index.find(i * 3) == (i % 2 ? v[i] : 0));
+
+    //  reinsert, as buffer_manager does when a buffer is reused
+    for (buffer::buffer_id_type i = 0; i < n; i += 2)
+      index.insert(*v[i]);
+    BOOST_TEST_EQ(index.size(), n);
+    for (buffer::buffer_id_type i = 0; i < n; ++i)
+      BOOST_TEST(index.find(i * 3) == v[i]);
+
+    std::size_t cap = index.capacity();
+    index.clear();
+    BOOST_TEST(index.empty());
+    BOOST_TEST_EQ(index.capacity(), cap);
+    BOOST_TEST(!index.find(3));
+    BOOST_TEST(index.begin() == index.end());
+
+    for (buffer::buffer_id_type i = 0; i < n; ++i)
+      delete v[i];
+  }
+
+//  buffer_index_timing  ---------------------------------------------------------------//
+
+  //  intrusive::set keyed the way buffer_manager's index was before buffer_index
+
+  struct set_entry : public boost::intrusive::set_base_hook<>
+  {
+    buffer::buffer_id_type id;
+    explicit set_entry(buffer::buffer_id_type id_) : id(id_) {}
+    bool operator<(const set_entry& rhs) const  { return id < rhs.id; }
+  };
+
+  void buffer_index_timing()
+  {
+    cout << "buffer_index_timing..." << endl;
+
+    const buffer::buffer_id_type n = 10000;   // buffers in memory
+    const long lookups = 2000000;
+    long found = 0;
+
+    std::vector<buffer*> bufs;
+    std::vector<set_entry*> entries;
+    for (buffer::buffer_id_type i = 0; i < n; ++i)
+    {
+      bufs.push_back(new buffer(i));
+      entries.push_back(new set_entry(i));
+    }
+
+    boost::intrusive::set<set_entry> set;
+    for (buffer::buffer_id_type i = 0; i < n; ++i)
+      set.insert(*entries[i]);
+
+    buffer_manager::buffers_type index;
+    for (buffer::buffer_id_type i = 0; i < n; ++i)
+      index.insert(*bufs[i]);
 
-    //  retest, just to be sure list.push_back() had no side effect on set.iterator_to()
-    BOOST_TEST(&*set.begin() == &pg);
-    BOOST_TEST(set.begin() == set.iterator_to(pg));
+    {
+      cout << "  intrusive::set find: ";
+      run_timer t(3);
+      for (long i = 0; i < lookups; ++i)
+      {
+        set_entry key((i * 7919) % n);
+        found += set.find(key) != set.end();
+      }
+    }
+    {
+      cout << "  buffer_index find:   ";
+      run_timer t(3);
+      for (long i = 0; i < lookups; ++i)
+        found += index.find((i * 7919) % n) != 0;
+    }
+    BOOST_TEST_EQ(found, 2 * lookups);
 
+    set.clear();
+    index.clear();
+    for (buffer::buffer_id_type i = 0; i < n; ++i)
+    {
+      delete bufs[i];
+      delete entries[i];
+    }
   }
 
 //  buffer_test  -------------------------------------------------------------------------//
@@ -319,6 +431,412 @@ namespace
     cout << f;
   }
 
+//  replacement_policy_test  -----------------------------------------------------------//
+
+  void replacement_policy_test()
+  {
+    cout << "replacement_policy_test..." << endl;
+
+    {
+      two_queue_policy q(50);
+      buffer b0(0), b1(1), b2(2), b3(3);
+      b1.retain(true);
+      q.released(b0);
+      q.released(b1);
+      q.released(b2);
+      BOOST_TEST_EQ(q.size(), 3U);
+      BOOST_TEST_EQ(q.probation_size(), 2U);
+      BOOST_TEST_EQ(q.protected_size(), 1U);
+      q.reclaimed(b2);   // read again while available...
+      q.released(b2);    // ...so promoted
+      BOOST_TEST_EQ(q.protected_size(), 2U);
+      q.released(b3);
+      BOOST_TEST(q.victim() == &b0);  // protected share is 2 of 4; probation first
+      BOOST_TEST(q.victim() == &b1);  // protected share now exceeds 50%
+      BOOST_TEST(q.victim() == &b3);
+      BOOST_TEST(q.victim() == &b2);
+      BOOST_TEST(q.victim() == 0);
+    }
+
+    //  a scan through the file must not flush retained buffers
+    fs::path test_path("buffer_manager_policy");
+    for (int r = 0; r < 2; ++r)
+    {
+      buffer_manager f;
+      f.replacement(r == 0 ? buffer_manager::lru : buffer_manager::two_queue);
+      f.open(test_path, oflag::out | oflag::truncate, 4, 256);
+      for (int i = 0; i < 20; ++i)
+        f.new_buffer();
+      f.flush();
+
+      f.read(0)->retain(true);
+      f.read(1)->retain(true);
+      for (buffer::buffer_id_type id = 2; id < 20; ++id)
+        f.read(id);
+      boost::uint32_t cached = f.cached_buffers_read();
+      f.read(0);
+      f.read(1);
+      if (r == 0)
+        BOOST_TEST_EQ(f.cached_buffers_read(), cached);
+      else
+        BOOST_TEST_EQ(f.cached_buffers_read(), cached + 2);
+    }
+  }
+
+//  flush_test  ------------------------------------------------------------------------//
+
+  void flush_test()
+  {
+    cout << "flush_test..." << endl;
+
+    fs::path test_path("buffer_manager_flush");
+    buffer_manager f;
+    f.open(test_path, oflag::out | oflag::truncate, 32, 256);
+    for (int i = 0; i < 10; ++i)
+    {
+      buffer_ptr bp = f.new_buffer();
+      std::memset(bp->data(), 'a' + i, f.data_size());
+    }
+    BOOST_TEST(f.flush());
+    BOOST_TEST_EQ(f.file_buffers_written(), 10U);
+    BOOST_TEST_EQ(f.flush_writes(), 1U);  // one run
+    BOOST_TEST(!f.flush());
+    BOOST_TEST_EQ(f.flush_writes(), 1U);
+
+    //  dirty ids 1, 2, 3, 5, 8, 9 form three runs
+    const buffer::buffer_id_type dirty[] = { 9, 2, 5, 1, 8, 3 };
+    for (int i = 0; i < 6; ++i)
+    {
+      buffer_ptr bp = f.read(dirty[i]);
+      bp->data()[0] = 'A' + dirty[i];
+      bp->needs_write(true);
+    }
+    BOOST_TEST(f.flush());
+    BOOST_TEST_EQ(f.file_buffers_written(), 16U);
+    BOOST_TEST_EQ(f.flush_writes(), 4U);
+    f.close();
+    BOOST_TEST_EQ(fs::file_size(test_path), 10U * 256U);
+
+    binary_file bf(test_path);
+    char buf[256];
+    for (buffer::buffer_id_type id = 0; id < 10; ++id)
+    {
+      BOOST_TEST(bf.read_at(id * 256, buf, 256));
+      bool is_dirty = id == 1 || id == 2 || id == 3 || id == 5 || id == 8 || id == 9;
+      BOOST_TEST_EQ(buf[0], static_cast<char>(is_dirty ? 'A' + id : 'a' + id));
+      BOOST_TEST_EQ(buf[255], static_cast<char>('a' + id));
+    }
+  }
+
+//  read_many_test  --------------------------------------------------------------------//
+
+  void read_many_test()
+  {
+    cout << "read_many_test..." << endl;
+
+    fs::path test_path("buffer_manager_many");
+    {
+      buffer_manager f;
+      f.open(test_path, oflag::out | oflag::truncate, 32, 256);
+      for (int i = 0; i < 20; ++i)
+      {
+        buffer_ptr bp = f.new_buffer();
+        std::memset(bp->data(), 'a' + i, f.data_size());
+      }
+    }
+
+    buffer_manager f;
+    f.open(test_path, oflag::in | oflag::async_io, 32, 256);
+    f.data_size(256);
+    buffer_ptr held = f.read(4);
+    BOOST_TEST_EQ(f.file_buffers_read(), 1U);
+
+    const buffer::buffer_id_type ids[] = { 7, 4, 19, 0, 7, 12 };
+    buffer_ptr bp[6];
+    f.read_many(ids, 6, bp);
+    BOOST_TEST_EQ(f.batch_reads(), 1U);
+    BOOST_TEST_EQ(f.file_buffers_read(), 5U);   // 7, 19, 0, 12
+    BOOST_TEST_EQ(f.active_buffers_read(), 2U); // 4, and 7 again
+    BOOST_TEST(bp[1] == held);
+    BOOST_TEST(bp[0] == bp[4]);
+    for (int i = 0; i < 6; ++i)
+    {
+      BOOST_TEST_EQ(bp[i]->buffer_id(), ids[i]);
+      BOOST_TEST_EQ(bp[i]->data()[0], static_cast<char>('a' + ids[i]));
+      BOOST_TEST_EQ(bp[i]->data()[255], static_cast<char>('a' + ids[i]));
+    }
+
+    f.read_many(ids, 4, bp);  // all in memory
+    BOOST_TEST_EQ(f.batch_reads(), 1U);
+    cout << f;
+
+    //  a batch that can't be read in full leaves none of its buffers behind
+    fs::resize_file(test_path, 10 * 256);
+    const buffer::buffer_id_type short_ids[] = { 2, 4, 18 };
+    buffer_ptr sp[3];
+    bool threw = false;
+    try { f.read_many(short_ids, 3, sp); }
+    catch (const buffer_manager_error&) { threw = true; }
+    BOOST_TEST(threw);
+    for (int i = 0; i < 3; ++i)
+      BOOST_TEST(!sp[i].get());
+    fs::resize_file(test_path, 20 * 256);  // 10 through 19 now read as zeros
+    boost::uint32_t file_reads = f.file_buffers_read();
+    BOOST_TEST_EQ(f.read(18)->data()[0], '\0');
+    BOOST_TEST_EQ(f.read(2)->data()[0], 'c');
+    BOOST_TEST_EQ(f.read(4)->data()[0], 'e');
+    BOOST_TEST_EQ(f.file_buffers_read(), file_reads + 2);  // 2 and 18 are read again
+  }
+
+//  prefetch_test  ---------------------------------------------------------------------//
+
+  void prefetch_test()
+  {
+    cout << "prefetch_test..." << endl;
+
+    fs::path test_path("buffer_manager_prefetch");
+    {
+      buffer_manager f;
+      f.open(test_path, oflag::out | oflag::truncate, 32, 256);
+      for (int i = 0; i < 20; ++i)
+      {
+        buffer_ptr bp = f.new_buffer();
+        std::memset(bp->data(), 'a' + i, f.data_size());
+      }
+    }
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+      buffer_manager f;
+      f.open(test_path, pass ? oflag::in | oflag::concurrent : oflag::in, 32, 256);
+      f.data_size(256);
+      buffer_ptr held = f.read(5);
+
+      const buffer::buffer_id_type ids[] = { 3, 4, 5, 6, 7, 12, 25 };
+      f.prefetch(ids, 7);  // 5 is in memory, 25 does not exist
+      BOOST_TEST_EQ(f.buffers_prefetched(), 5U);
+      BOOST_TEST_EQ(f.file_buffers_read(), 1U);  // a hint reads nothing itself
+
+      buffer_ptr bp = f.read(6);
+      BOOST_TEST_EQ(bp->data()[0], 'a' + 6);
+      f.prefetch(ids + 3, 1);  // 6 is in memory now
+      BOOST_TEST_EQ(f.buffers_prefetched(), 5U);
+    }
+  }
+
+//  reuse_test  ------------------------------------------------------------------------//
+
+  void reuse_test()
+  {
+    cout << "reuse_test..." << endl;
+
+    fs::path test_path("buffer_manager_reuse");
+    {
+      buffer_manager f;
+      f.open(test_path, oflag::out | oflag::truncate, 32, 256);
+      for (int i = 0; i < 10; ++i)
+      {
+        buffer_ptr bp = f.new_buffer();
+        std::memset(bp->data(), 'a' + i, f.data_size());
+      }
+    }
+
+    buffer_manager f;
+    f.open(test_path, oflag::in | oflag::out, 32, 256);
+    f.data_size(256);
+    buffer_ptr bp = f.reuse(3);  // not in memory, so not read
+    BOOST_TEST_EQ(f.file_buffers_read(), 0U);
+    BOOST_TEST(bp->needs_write());
+    BOOST_TEST_EQ(bp->data()[0], 0);
+    BOOST_TEST_EQ(bp->data()[255], 0);
+    std::memset(bp->data(), 'X', f.data_size());
+    bp.reset();
+
+    bp = f.read(5);
+    BOOST_TEST_EQ(f.file_buffers_read(), 1U);
+    bp.reset();
+    bp = f.reuse(5);  // in memory, so contents kept
+    BOOST_TEST_EQ(f.file_buffers_read(), 1U);
+    BOOST_TEST(bp->needs_write());
+    BOOST_TEST_EQ(bp->data()[0], 'f');
+    BOOST_TEST_EQ(f.buffer_count(), 10U);
+    bp.reset();
+
+    f.close();
+    f.open(test_path, oflag::in, 32, 256);
+    f.data_size(256);
+    BOOST_TEST_EQ(f.read(3)->data()[0], 'X');
+  }
+
+  void aux_test()
+  {
+    cout << "aux_test..." << endl;
+
+    fs::path test_path("buffer_manager_aux");
+    buffer_manager f;
+    f.open(test_path, oflag::out | oflag::truncate, 2, 128);
+    {
+      buffer_ptr bp = f.new_buffer();
+      BOOST_TEST(!bp->aux_valid());
+      char* a = bp->aux(16);
+      BOOST_TEST(a);
+      BOOST_TEST(bp->aux() == a);
+      BOOST_TEST(bp->aux(8) == a);  // no shrink
+      bp->aux_valid(true);
+      bp->needs_write(false);
+      BOOST_TEST(bp->aux_valid());
+      bp->needs_write(true);
+      BOOST_TEST(!bp->aux_valid());  // contents changing
+      bp->aux_valid(true);
+    }
+    f.flush();
+    {
+      f.new_buffer();
+      f.new_buffer();
+      f.flush();
+      buffer_ptr bp = f.new_buffer();  // cache size 2, so a buffer is reused
+      BOOST_TEST(!bp->aux_valid());
+    }
+  }
+
+  void flusher_test()
+  {
+    cout << "flusher_test..." << endl;
+
+    fs::path test_path("buffer_manager_flusher");
+    {
+      buffer_manager f;
+      f.open(test_path, oflag::out | oflag::truncate | oflag::concurrent, 32, 256);
+      for (int i = 0; i < 64; ++i)
+      {
+        buffer_ptr bp = f.new_buffer();
+        std::memset(bp->data(), 'a' + i % 26, f.data_size());
+      }
+
+      //  each shard's share of the cache, 2 buffers, is now full of buffers that need
+      //  writing; the others were written when their memory was reused
+      boost::uint32_t available = f.buffers_available();
+      boost::uint32_t written = f.file_buffers_written();
+      BOOST_TEST_EQ(available, 32U);
+      BOOST_TEST_EQ(written, 32U);
+
+      f.start_flusher(50, 10);
+      BOOST_TEST(f.flusher_running());
+      for (int i = 0; i < 500 && f.flusher_buffers_written() < available; ++i)
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+      BOOST_TEST_EQ(f.flusher_buffers_written(), available);
+      BOOST_TEST_EQ(f.file_buffers_written(), written + available);
+      BOOST_TEST(!f.flush());  // nothing left to write
+      f.start_flusher(90, 50);  // changes the percentages
+      BOOST_TEST(f.flusher_running());
+      f.stop_flusher();
+      BOOST_TEST(!f.flusher_running());
+    }
+
+    buffer_manager f;
+    f.open(test_path, oflag::in, 32, 256);
+    f.data_size(256);
+    for (int i = 0; i < 64; ++i)
+    {
+      buffer_ptr bp = f.read(i);
+      BOOST_TEST_EQ(bp->data()[0], static_cast<char>('a' + i % 26));
+      BOOST_TEST_EQ(bp->data()[255], static_cast<char>('a' + i % 26));
+    }
+  }
+
+  void flusher_error_test()
+  {
+    cout << "flusher_error_test..." << endl;
+
+#ifndef BOOST_WINDOWS_API
+    if (!fs::exists("/dev/full"))
+      return;
+    buffer_manager f;
+    f.open("/dev/full", oflag::out | oflag::truncate | oflag::concurrent, 32, 256);
+    for (int i = 0; i < 32; ++i)
+    {
+      buffer_ptr bp = f.new_buffer();
+      std::memset(bp->data(), 'a', f.data_size());
+    }
+
+    //  every write fails, so the flusher ends at its first pass
+    f.start_flusher(50, 10);
+    for (int i = 0; i < 500 && f.flusher_running(); ++i)
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    BOOST_TEST(!f.flusher_running());
+    BOOST_TEST(!f.flusher_error().empty());
+    BOOST_TEST_EQ(f.flusher_buffers_written(), 0U);
+    BOOST_TEST_EQ(f.buffers_available(), 32U);  // still need writing
+
+    //  a new flusher starts, and fails the same way
+    f.start_flusher(50, 10);
+    BOOST_TEST(f.flusher_error().empty() || !f.flusher_running());
+    for (int i = 0; i < 500 && f.flusher_running(); ++i)
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    BOOST_TEST(!f.flusher_running());
+    BOOST_TEST(!f.flusher_error().empty());
+    f.stop_flusher();
+    BOOST_TEST(!f.flusher_error().empty());  // kept until start_flusher() or open()
+    f.clear_write_needed();  // so close() doesn't throw
+#endif
+  }
+
+  void pin_test()
+  {
+    cout << "pin_test..." << endl;
+
+    buffer_manager f;
+    f.open("buffer_manager_pin", oflag::out | oflag::truncate | oflag::concurrent, 2, 128);
+    for (int i = 0; i < 4; ++i)
+      f.new_buffer();
+    BOOST_TEST(!f.pinned(1));
+    {
+      buffer_ptr bp = f.read(1);
+      f.pin(*bp);
+      f.pin(*bp);  // already pinned
+      BOOST_TEST(f.pinned(1) == bp.get());
+      BOOST_TEST_EQ(bp->use_count(), 2U);
+      std::memset(bp->data(), 'p', f.data_size());
+    }
+    for (int i = 2; i < 64; ++i)  // the cache holds 2, so unpinned buffers are reused
+      f.read(i % 4 == 1 ? 2 : i % 4);
+    buffer* pg = f.pinned(1);
+    BOOST_TEST(pg != 0);
+    BOOST_TEST_EQ(pg->buffer_id(), 1U);
+    BOOST_TEST_EQ(pg->use_count(), 1U);
+    BOOST_TEST_EQ(pg->data()[0], 'p');
+    BOOST_TEST(f.read(1).get() == pg);
+    f.unpin(1);
+    BOOST_TEST(!f.pinned(1));
+    f.unpin(1);  // not pinned
+    f.pin(*f.read(3));
+    f.close();  // unpins 3
+  }
+
+  void rw_latch_version_test()
+  {
+    cout << "rw_latch_version_test..." << endl;
+
+    rw_latch latch;
+    boost::uint32_t v = latch.version_begin();
+    BOOST_TEST(latch.version_valid(v));
+    {
+      rw_latch::shared_guard g(latch);
+      BOOST_TEST(latch.version_valid(v));  // shared owners don't change the structure
+    }
+    BOOST_TEST(latch.version_valid(v));
+    latch.lock();
+    BOOST_TEST(!latch.version_valid(v));  // held exclusive
+    latch.unlock();
+    BOOST_TEST(!latch.version_valid(v));  // was held exclusive
+    v = latch.version_begin();
+    BOOST_TEST(latch.version_valid(v));
+    {
+      rw_latch::guard g(latch, false);  // not engaged
+    }
+    BOOST_TEST(latch.version_valid(v));
+  }
+
 } // unnamed namespace
 
 //  cpp_main  --------------------------------------------------------------------------//
@@ -326,12 +844,24 @@ namespace
 int cpp_main(int argc, char * argv[])
 {
   iterator_to_test();
+  buffer_index_test();
+  buffer_index_timing();
   buffer_test();
 //  buffer_ptr_test();
   open_new_file_test();
   open_existing_file_test();
   new_buffer_test();
   existing_buffer_test();
+  replacement_policy_test();
+  flush_test();
+  read_many_test();
+  prefetch_test();
+  reuse_test();
+  aux_test();
+  rw_latch_version_test();
+  pin_test();
+  flusher_test();
+  flusher_error_test();
 
   cout << "all tests complete" << endl;
 
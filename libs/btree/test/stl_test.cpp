@@ -50,6 +50,7 @@ namespace
   boost::int32_t seed = 1;
   boost::int32_t node_sz = 128; // smaller than usual default to increase stress
   boost::int32_t cache_sz = 2;  // ditto
+  boost::int32_t min_fill = 0;
   boost::int32_t dump = 0;
   bool restart = false;
   bool verbose = false;
@@ -105,7 +106,9 @@ namespace
            +upper_bound_exist_count+upper_bound_may_exist_count
          << '\n' 
          << "  cycles complete             " << cycles_complete  << '\n'
-         << "  current size()              " << stl.size()
+         << "  current size()              " << stl.size() << '\n'
+         << "  node merges since open      " << bt.node_merges() << '\n'
+         << "  node borrows since open     " << bt.node_borrows()
          << endl
          ;
   }
@@ -674,6 +677,7 @@ namespace
       restart ? boost::btree::flags::read_write : boost::btree::flags::truncate,
       node_sz);
     bt.max_cache_size(cache_sz);
+    bt.min_fill(min_fill);
 
     if (restart)
       verify_restart();
@@ -688,7 +692,8 @@ namespace
          << "  seed = " << seed << '\n'
          << "  dump = " << dump << '\n'
          << "  node size = " << node_sz << '\n'
-         << "  max cache nodes = " << cache_sz << "\n";
+         << "  max cache nodes = " << cache_sz << '\n'
+         << "  min fill = " << min_fill << "\n";
 
     boost::btree::run_timer total_times(3);
     boost::btree::run_timer cycle_times(3);
@@ -761,6 +766,8 @@ int cpp_main(int argc, char *argv[])
         node_sz = atol(argv[1]+6);
       else if (strncmp(argv[1]+1, "cache=", 6) == 0)
         cache_sz = atol(argv[1]+7);
+      else if (strncmp(argv[1]+1, "fill=", 5) == 0)
+        min_fill = atol(argv[1]+6);
       else if (strncmp(argv[1]+1, "dump=", 5) == 0)
         dump = atol(argv[1]+6);
       else if (strncmp(argv[1]+1, "restart", 7) == 0)
@@ -794,6 +801,8 @@ int cpp_main(int argc, char *argv[])
       "   -node=#      Node size (>=128); default " << node_sz << "\n"
       "                Small node sizes increase stress\n"
       "   -cache=#     Cache size; default " << cache_sz << " nodes\n"
+      "   -fill=#      Minimum fill percent for erase underflow maintenance;\n"
+      "                default " << min_fill << " (no maintenance)\n"
       "   -dump=#      Dump restart files when cycles run mod dump # == 0, except \n"
       "                dump # -1 means dump at end only, 0 means never dump;\n"
       "                default " << dump << "\n"
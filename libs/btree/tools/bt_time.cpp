@@ -8,10 +8,12 @@
 //  See http://www.boost.org/libs/btree for documentation.
 
 #include <boost/btree/map.hpp>
+#include <boost/btree/sort_loader.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/random.hpp>
 #include <boost/btree/support/timer.hpp>
 #include <boost/detail/lightweight_main.hpp>
+#include <boost/thread/thread.hpp>
 
 #include <iostream>
 #include <string>
@@ -36,9 +38,19 @@ namespace
   int node_sz = btree::default_node_size;
   bool do_create (true);
   bool do_preload (false);
+  bool do_scan_resistant (false);
+  bool do_async_io (false);
   bool do_insert (true);
   bool do_pack (false);
+  unsigned compact_fill = 0;  // 0 means don't compact
+  bool do_sort_load (false);
+  bool do_key_column (false);
+  std::size_t sort_budget = btree::sort_loader<btree::btree_map<long, long> >
+    ::default_memory_budget;
   bool do_find (true);
+  int threads = 0;  // 0 means don't do the concurrent find test
+  int writers = 0;  // 0 means don't do the concurrent insert test
+  bool do_flusher (false);
   bool do_iterate (true);
   bool do_erase (true);
   bool verbose (false);
@@ -55,6 +67,51 @@ namespace
   btree::times_t erase_tm;
   const long double sec = 1000000.0L;
 
+  template <class BT>
+  struct finder  // one thread's share of the concurrent find test: every stride'th
+  {               // key inserted, starting with the first'th
+    const BT*  bt;
+    int        first;
+    int        stride;
+
+    void operator()() const
+    {
+      rand48  rng;
+      rng.seed(seed);
+      uniform_int<long> n_dist(0, n-1);
+      variate_generator<rand48&, uniform_int<long> > key(rng, n_dist);
+      for (long i = 0; i < n; ++i)
+      {
+        long k = key();
+        if (i % stride == first
+          && bt->find(k)->key() != k)
+          throw std::runtime_error("btree concurrent find() returned wrong iterator");
+      }
+    }
+  };
+
+  template <class BT>
+  struct inserter  // one thread's share of the concurrent insert test: every stride'th
+  {                 // key of the insert sequence, starting with the first'th
+    BT*  bt;
+    int  first;
+    int  stride;
+
+    void operator()() const
+    {
+      rand48  rng;
+      rng.seed(seed);
+      uniform_int<long> n_dist(0, n-1);
+      variate_generator<rand48&, uniform_int<long> > key(rng, n_dist);
+      for (long i = 0; i < n; ++i)
+      {
+        long k = key();
+        if (i % stride == first)
+          bt->emplace(k, i);
+      }
+    }
+  };
+
   template <class BT>
   void test()
   {
@@ -69,6 +126,10 @@ namespace
                   : btree::flags::read_write;
       if (!do_create && do_preload)
         flgs |= btree::flags::preload;
+      if (do_scan_resistant)
+        flgs |= btree::flags::scan_resistant;
+      if (do_async_io)
+        flgs |= btree::flags::async_io;
 
       cout << "\nopening " << path << endl;
       t.start();
@@ -93,6 +154,42 @@ namespace
         t.report();
       }
 
+      if (do_sort_load)
+      {
+        cout << "\nsort loading " << n << " btree elements..." << endl;
+        fs::path sl_path(path + ".sl");
+        rng.seed(seed);
+        std::size_t runs;
+        typename BT::size_type sl_size;
+        t.start();
+        {
+          BT bt_sl(sl_path, btree::flags::truncate, node_sz);
+          bt_sl.max_cache_size(cache_sz);
+          btree::sort_loader<BT> loader(bt_sl, sort_budget);
+          for (long i = 1; i <= n; ++i)
+          {
+            if (lg && i % lg == 0)
+              std::cout << i << std::endl; 
+            loader.emplace(key(), i);
+          }
+          runs = loader.runs();
+          loader.finish();
+          sl_size = bt_sl.size();
+        }
+        btree::times_t sl_tm = t.stop();
+        t.report();
+        cout << "  " << runs << " runs spilled\n";
+        if (do_insert)
+        {
+          if (sl_size != bt.size())
+            throw std::runtime_error("btree sort load size error");
+          if (sl_tm.wall)
+            cout << "  ratio of insert to sort load wall clock time: "
+                 << (insert_tm.wall * 1.0) / sl_tm.wall << '\n';
+        }
+        fs::remove(sl_path);
+      }
+
       if (do_pack)
       {
         cout << "\npacking btree..." << endl;
@@ -104,10 +201,7 @@ namespace
         bt_old.max_cache_size(cache_sz);
         BT bt_new(path, btree::flags::truncate, node_sz);
         bt_new.max_cache_size(cache_sz);
-        for (typename BT::iterator it = bt_old.begin(); it != bt_old.end(); ++it)
-        {
-          bt_new.emplace(it->key(), it->mapped_value());
-        }
+        bt_new.bulk_load(bt_old.begin(), bt_old.end());
         cout << "  bt_old.size() " << bt_old.size() << std::endl;
         cout << "  bt_new.size() " << bt_new.size() << std::endl;
         BOOST_ASSERT(bt_new.size() == bt_old.size());
@@ -120,6 +214,18 @@ namespace
         bt.max_cache_size(cache_sz);
       }
 
+      if (compact_fill)
+      {
+        cout << "\ncompacting btree to " << compact_fill << "% fill..." << endl;
+        bt.flush();
+        boost::uintmax_t old_size = fs::file_size(path);
+        t.start();
+        bt.compact(compact_fill);
+        t.report();
+        cout << "  file size before: " << old_size << '\n';
+        cout << "  file size after:  " << fs::file_size(path) << '\n';
+      }
+
       if (do_find)
       {
         cout << "\nfinding " << n << " btree elements..." << endl;
@@ -165,6 +271,68 @@ namespace
           throw std::runtime_error("btree iteration count error");
       }
 
+      if (threads)
+      {
+        bt.close();
+        bt.open(path, btree::flags::read_only | btree::flags::concurrent_read);
+        bt.max_cache_size(cache_sz);
+        for (int thr = 1; thr <= threads; thr *= 2)
+        {
+          cout << "\nfinding " << n << " btree elements with " << thr
+               << " concurrent reader thread(s)..." << endl;
+          thread_group group;
+          t.start();
+          for (int j = 0; j < thr; ++j)
+          {
+            finder<BT> f = { &bt, j, thr };
+            group.create_thread(f);
+          }
+          group.join_all();
+          t.stop();
+          t.report();
+          if (thr < threads && thr * 2 > threads)
+            thr = threads / 2;  // so that the last pass uses all threads
+        }
+        bt.close();
+        bt.open(path, btree::flags::read_write);
+        bt.max_cache_size(cache_sz);
+      }
+
+      if (writers)
+      {
+        std::string thw_path(path + ".thw");
+        for (int thr = 1; thr <= writers; thr *= 2)
+        {
+          BT thw(thw_path, btree::flags::truncate | btree::flags::concurrent_write,
+            node_sz);
+          thw.max_cache_size(cache_sz);
+          if (do_flusher)
+            thw.start_flusher();
+          cout << "\ninserting " << n << " btree elements with " << thr
+               << " concurrent writer thread(s)..." << endl;
+          thread_group group;
+          t.start();
+          for (int j = 0; j < thr; ++j)
+          {
+            inserter<BT> f = { &thw, j, thr };
+            group.create_thread(f);
+          }
+          group.join_all();
+          t.stop();
+          t.report();
+          if (do_flusher)
+            cout << "  flusher wrote " << thw.manager().flusher_buffers_written()
+                 << " of " << thw.manager().file_buffers_written()
+                 << " nodes written, in " << thw.manager().flusher_microseconds() / sec
+                 << " sec" << endl;
+          if (thw.size() != bt.size())
+            throw std::runtime_error("btree concurrent insert size error");
+          if (thr < writers && thr * 2 > writers)
+            thr = writers / 2;  // so that the last pass uses all threads
+        }
+        fs::remove(thw_path);
+      }
+
       if (verbose)
       {
         bt.flush();
@@ -415,8 +583,22 @@ int cpp_main(int argc, char * argv[])
         do_create = false;
         do_insert = false;
       }
+      else if ( std::strncmp( argv[2]+1, "aio", 3 )==0 )
+        do_async_io = true;
+      else if ( std::strncmp( argv[2]+1, "2q", 2 )==0 )
+        do_scan_resistant = true;
       else if ( std::strncmp( argv[2]+1, "stl", 3 )==0 )
         stl_tests = true;
+      else if ( std::strncmp( argv[2]+1, "sl", 2 )==0 )
+        do_sort_load = true;
+      else if ( std::strncmp( argv[2]+1, "col", 3 )==0 )
+        do_key_column = true;
+      else if ( std::strncmp( argv[2]+1, "thr", 3 )==0 )
+        threads = atoi( argv[2]+4 );
+      else if ( std::strncmp( argv[2]+1, "thw", 3 )==0 )
+        writers = atoi( argv[2]+4 );
+      else if ( std::strncmp( argv[2]+1, "fl", 2 )==0 )
+        do_flusher = true;
       else if ( std::strncmp( argv[2]+1, "html", 4 )==0 )
         html = true;
       else if ( std::strncmp( argv[2]+1, "big", 3 )==0 )
@@ -429,6 +611,10 @@ int cpp_main(int argc, char * argv[])
         seed = atol( argv[2]+2 );
       else if ( *(argv[2]+1) == 'n' )
         node_sz = atoi( argv[2]+2 );
+      else if ( *(argv[2]+1) == 'm' )
+        sort_budget = std::atol( argv[2]+2 ) * 1024 * 1024;
+      else if ( std::strncmp( argv[2]+1, "cp", 2 )==0 )
+        compact_fill = atoi( argv[2]+3 );
       else if ( *(argv[2]+1) == 'c' )
         cache_sz = atoi( argv[2]+2 );
       else if ( *(argv[2]+1) == 'i' )
@@ -467,13 +653,28 @@ int cpp_main(int argc, char * argv[])
       "   -xi      No iterate test\n"
       "   -xe      No erase test; use to save file intact\n"
       "   -k       Pack tree after insert test\n"
+      "   -cp#     Compact tree to # percent fill after insert test (and -k)\n"
+      "   -sl      Also load the same elements into a second tree with\n"
+      "            btree::sort_loader, and compare with the insert time\n"
+      "   -m#      Memory budget in megabytes for -sl; default "
+        << btree::sort_loader<btree::btree_map<long, long> >::default_memory_budget
+           / (1024 * 1024) << "\n"
       "   -v       Verbose output statistics\n"
       "   -stl     Also run the tests against std::map\n"
+      "   -2q      Use the scan resistant cache replacement policy\n"
+      "   -aio     Use asynchronous batched I/O, if available\n"
+      "   -thr#    After the find test, reopen the tree with concurrent_read and\n"
+      "            time the finds split across 1, 2, 4, ... # threads\n"
+      "   -thw#    Also time inserts into a new tree opened with concurrent_write,\n"
+      "            split across 1, 2, 4, ... # threads\n"
+      "   -fl      With -thw#, write cached nodes ahead of eviction with a\n"
+      "            background flusher, and report what it wrote\n"
       "   -r       Read entire file to preload operating system disk cache;\n"
       "            only applicable if -xc option is active\n"
       "   -big     Use btree::default_big_endian_traits\n"
       "   -little  Use btree::default_little_endian_traits\n"
       "   -native  Use btree::default_native_traits; this is the default\n"
+      "   -col     Use btree::key_column_traits with the above traits\n"
       "   -html    Output html table of results to cerr\n"
       ;
     return 1;
@@ -486,15 +687,27 @@ int cpp_main(int argc, char * argv[])
   {
   case integer::endianness::big:
     cout << "and big endianness\n";
-    test< btree::btree_map<long, long, btree::default_big_endian_traits> >();
+    if (do_key_column)
+      test< btree::btree_map<long, long,
+        btree::key_column_traits<btree::default_big_endian_traits> > >();
+    else
+      test< btree::btree_map<long, long, btree::default_big_endian_traits> >();
     break;
   case integer::endianness::little:
     cout << "and little endianness\n";
-    test< btree::btree_map<long, long, btree::default_little_endian_traits> >();
+    if (do_key_column)
+      test< btree::btree_map<long, long,
+        btree::key_column_traits<btree::default_little_endian_traits> > >();
+    else
+      test< btree::btree_map<long, long, btree::default_little_endian_traits> >();
     break;
   case integer::endianness::native:
     cout << "and native endianness\n";
-    test< btree::btree_map<long, long, btree::default_native_traits> >();
+    if (do_key_column)
+      test< btree::btree_map<long, long,
+        btree::key_column_traits<btree::default_native_traits> > >();
+    else
+      test< btree::btree_map<long, long, btree::default_native_traits> >();
     break;
   }
 